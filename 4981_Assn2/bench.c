@@ -0,0 +1,1096 @@
+/*---------------------------------------------------------------------------------------
+  --	SOURCE FILE:	bench.c -   Load generator and benchmark driver for the message
+  --                            queue file server (server.c)
+  --
+  --	PROGRAM:		bench
+  --
+  --	FUNCTIONS:
+  --      int parse_mix(const char *spec, struct bench_opts *opts);
+  --      int generate_file(const char *path, long long bytes);
+  --      pid_t start_server(struct bench_opts *opts);
+  --      int stop_server(struct bench_opts *opts, pid_t server_pid);
+  --      int proc_usage(pid_t root, struct usage *u);
+  --      int run_round(struct bench_opts *opts, int round, struct sample *samples);
+  --      void report(struct bench_opts *opts, struct sample *samples, int n,
+  --                  struct usage *server_use, double wall_s, const char *csv);
+  --      int compare(const char *baseline, const char *current);
+  --      int main(int argc, char *argv[]);
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	NOTES:
+  --     Build next to the server:
+  --         gcc -Wall -O2 -o server server.c mesgq.c -lpthread
+  --         gcc -Wall -O2 -o bench bench.c
+  --     bench starts its own server (the binary given with -S), runs rounds of
+  --     concurrent clients against it and shuts it down again. Each client is the
+  --     server binary in client mode; a round starts them all at once and waits
+  --     for every one of them. The first rounds (-w) only warm up the page cache
+  --     and the worker pool and are not counted.
+  --     Per client it takes from the client's own output the bytes received and the
+  --     time to the first packet ("wake-up latency: first msg"), and measures the
+  --     time from its start to its exit and, through wait4, its CPU time and
+  --     context switches. The server's CPU time and context switches (its own and
+  --     its workers', from /proc) are the difference over the counted rounds.
+  --     It reports aggregate throughput, time-to-first-byte and completion latency
+  --     percentiles, and CPU time and context switches per byte. With -o the
+  --     summary is saved as "metric,value" lines; -b compares a run against such a
+  --     file, metric by metric, so a change to the server can be judged by numbers.
+  --     Only one server may use the queue at a time: do not run bench while another
+  --     server is up.
+---------------------------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#define OPTIONS "?S:c:r:w:p:f:g:d:e:n:x:o:b:"
+#define SERVER_DEFAULT "./server"
+#define CLIENTS_DEFAULT 8
+#define CLIENTS_MAX 1024
+#define ROUNDS_DEFAULT 3
+#define WARMUP_DEFAULT 1
+#define MIX_DEFAULT "sometext64.txt:4,sometext4096.txt:2" /* plus -g files, weight 1 */
+#define GEN_DEFAULT "64"                 /* MB of each generated file, -g "" for none */
+#define GEN_DIR_DEFAULT "/tmp"
+#define MIX_MAX 32
+#define PRIORITIES_MAX 32
+#define EXTRA_ARGS_MAX 16
+#define PATH_SIZE 256
+#define SERVER_START_MS 300   /* time the server gets to fork its pool */
+#define SERVER_STOP_MS 10000  /* the server is killed if it has not exited by then */
+#define METRICS_MAX 64
+
+// One file of the mix: clients pick it in proportion to its weight
+struct mix_entry
+{
+  char path[PATH_SIZE];
+  int weight;
+};
+
+// Command line settings
+struct bench_opts
+{
+  const char *server;   /* server binary, also run as the clients */
+  int clients;          /* concurrent clients per round */
+  int rounds;           /* counted rounds */
+  int warmup;           /* rounds run first and not counted */
+  int priorities[PRIORITIES_MAX];
+  int npriorities;      /* client i gets priorities[i % npriorities] */
+  struct mix_entry mix[MIX_MAX];
+  int nmix;
+  int total_weight;
+  const char *engine;   /* -e for the server, NULL for its default */
+  const char *pool;     /* -n for the server */
+  char *extra[EXTRA_ARGS_MAX]; /* further client arguments, e.g. -m shm */
+  int nextra;
+};
+
+// One client run
+struct sample
+{
+  const char *file;
+  int priority;
+  int status;         /* exit status, -1 if it did not exit normally */
+  long long bytes;    /* received, from its output */
+  long first_us;      /* request to first packet, from its output; -1 if unknown */
+  long done_us;       /* start to exit, measured here */
+  double cpu_s;       /* user + system */
+  long csw;           /* voluntary + involuntary context switches */
+};
+
+// CPU time and context switches of a process tree
+struct usage
+{
+  double cpu_s;
+  long csw;
+};
+
+// A metric of the summary, for -o and -b
+struct metric
+{
+  char name[64];
+  double value;
+};
+
+static struct metric metrics[METRICS_MAX];
+static int nmetrics = 0;
+
+// Function prototypes
+int parse_mix(const char *spec, struct bench_opts *opts);
+int generate_file(const char *path, long long bytes);
+pid_t start_server(struct bench_opts *opts);
+int stop_server(struct bench_opts *opts, pid_t server_pid);
+int proc_usage(pid_t root, struct usage *u);
+int run_round(struct bench_opts *opts, int round, struct sample *samples);
+void report(struct bench_opts *opts, struct sample *samples, int n, struct usage *server_use,
+            double wall_s, const char *csv);
+int compare(const char *baseline, const char *current);
+int main(int argc, char *argv[]);
+
+static long elapsed_us(struct timespec *a, struct timespec *b)
+{
+  return (b->tv_sec - a->tv_sec) * 1000000L + (b->tv_nsec - a->tv_nsec) / 1000L;
+}
+
+static void sleep_ms(int ms)
+{
+  struct timespec ts;
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (ms % 1000) * 1000000L;
+  while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+  {
+  }
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+  long x = *(const long *)a;
+  long y = *(const long *)b;
+  return x < y ? -1 : x > y;
+}
+
+// Nearest-rank percentile of n sorted values
+static long percentile(const long *sorted, int n, int pct)
+{
+  int rank;
+  if (n == 0)
+  {
+    return 0;
+  }
+  rank = (pct * n + 99) / 100;
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+// Records a summary metric and prints it
+static void metric(const char *name, double value, const char *unit)
+{
+  if (nmetrics < METRICS_MAX)
+  {
+    strncpy(metrics[nmetrics].name, name, sizeof(metrics[nmetrics].name) - 1);
+    metrics[nmetrics].value = value;
+    ++nmetrics;
+  }
+  printf("  %-22s %14.3f %s\n", name, value, unit);
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		parse_mix
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int parse_mix(const char *spec, struct bench_opts *opts)
+  --               const char *spec:      "path[:weight],path[:weight],..."
+  --      struct bench_opts *opts:      mix to add the files to
+  --
+  --	RETURNS:
+  --					 0    on success
+  --          -1    on a malformed entry or too many files
+  --	NOTES:
+  --		Adds the files of a -f list to the mix; a file without a weight gets 1.
+------------------------------------------------------------------------------------*/
+int parse_mix(const char *spec, struct bench_opts *opts)
+{
+  char buf[4096];
+  char *entry;
+  char *save;
+  char *colon;
+  strncpy(buf, spec, sizeof(buf) - 1);
+  buf[sizeof(buf) - 1] = '\0';
+  for (entry = strtok_r(buf, ",", &save); entry != NULL; entry = strtok_r(NULL, ",", &save))
+  {
+    if (opts->nmix >= MIX_MAX)
+    {
+      return -1;
+    }
+    struct mix_entry *m = &opts->mix[opts->nmix];
+    m->weight = 1;
+    if ((colon = strrchr(entry, ':')) != NULL)
+    {
+      *colon = '\0';
+      if ((m->weight = atoi(colon + 1)) < 1)
+      {
+        return -1;
+      }
+    }
+    if (entry[0] == '\0' || strlen(entry) >= sizeof(m->path))
+    {
+      return -1;
+    }
+    strcpy(m->path, entry);
+    opts->total_weight += m->weight;
+    ++opts->nmix;
+  }
+  return 0;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		generate_file
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int generate_file(const char *path, long long bytes)
+  --               const char *path:      file to create
+  --                long long bytes:      its size
+  --
+  --	RETURNS:
+  --					 0    on success, or if the file already has that size
+  --          -1    on failure to write it
+  --	NOTES:
+  --		Writes pseudo-random (incompressible) data from a fixed seed, so every run
+  --    serves the same bytes. An existing file of the right size is kept.
+------------------------------------------------------------------------------------*/
+int generate_file(const char *path, long long bytes)
+{
+  struct stat st;
+  unsigned long long x = 0x9e3779b97f4a7c15ULL;
+  unsigned long long block[8192];
+  long long left;
+  size_t i;
+  size_t chunk;
+  FILE *fp;
+  if (stat(path, &st) == 0 && st.st_size == bytes)
+  {
+    return 0;
+  }
+  if ((fp = fopen(path, "wb")) == NULL)
+  {
+    perror(path);
+    return -1;
+  }
+  printf("generating %s (%lld bytes)\n", path, bytes);
+  for (left = bytes; left > 0; left -= chunk)
+  {
+    for (i = 0; i < sizeof(block) / sizeof(block[0]); ++i)
+    {
+      // xorshift64
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      block[i] = x;
+    }
+    chunk = left < (long long)sizeof(block) ? (size_t)left : sizeof(block);
+    if (fwrite(block, 1, chunk, fp) != chunk)
+    {
+      perror(path);
+      fclose(fp);
+      return -1;
+    }
+  }
+  return fclose(fp) == 0 ? 0 : -1;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		start_server
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		pid_t start_server(struct bench_opts *opts)
+  --      struct bench_opts *opts:      server binary, engine and pool size
+  --
+  --	RETURNS:
+  --					the server's pid on success
+  --          -1    on failure to start it
+  --	NOTES:
+  --		Runs the server with its output going to bench-server.log, and gives it
+  --    SERVER_START_MS to set up before any client is started.
+------------------------------------------------------------------------------------*/
+pid_t start_server(struct bench_opts *opts)
+{
+  char *argv[8];
+  int argc = 0;
+  int fd;
+  pid_t pid;
+  argv[argc++] = (char *)opts->server;
+  argv[argc++] = "-t";
+  argv[argc++] = "server";
+  if (opts->engine != NULL)
+  {
+    argv[argc++] = "-e";
+    argv[argc++] = (char *)opts->engine;
+  }
+  if (opts->pool != NULL)
+  {
+    argv[argc++] = "-n";
+    argv[argc++] = (char *)opts->pool;
+  }
+  argv[argc] = NULL;
+  if ((pid = fork()) == -1)
+  {
+    perror("fork");
+    return -1;
+  }
+  if (pid == 0)
+  {
+    if ((fd = open("bench-server.log", O_WRONLY | O_CREAT | O_TRUNC, 0644)) != -1)
+    {
+      dup2(fd, STDOUT_FILENO);
+      dup2(fd, STDERR_FILENO);
+      close(fd);
+    }
+    execv(argv[0], argv);
+    perror(argv[0]);
+    _exit(127);
+  }
+  sleep_ms(SERVER_START_MS);
+  if (waitpid(pid, NULL, WNOHANG) == pid)
+  {
+    printf("server exited on start, see bench-server.log\n");
+    return -1;
+  }
+  return pid;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		stop_server
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int stop_server(struct bench_opts *opts, pid_t server_pid)
+  --      struct bench_opts *opts:      server binary
+  --             pid_t server_pid:      the server started by start_server
+  --
+  --	RETURNS:
+  --					 0    if it shut down cleanly
+  --          -1    if it had to be killed
+  --	NOTES:
+  --		Asks the server to stop with "-t shutdown" and waits for it; after
+  --    SERVER_STOP_MS it is sent SIGTERM, then SIGKILL.
+------------------------------------------------------------------------------------*/
+int stop_server(struct bench_opts *opts, pid_t server_pid)
+{
+  pid_t pid;
+  int waited;
+  int fd;
+  if ((pid = fork()) == 0)
+  {
+    if ((fd = open("/dev/null", O_WRONLY)) != -1)
+    {
+      dup2(fd, STDOUT_FILENO);
+      close(fd);
+    }
+    execl(opts->server, opts->server, "-t", "shutdown", (char *)NULL);
+    _exit(127);
+  }
+  if (pid > 0)
+  {
+    waitpid(pid, NULL, 0);
+  }
+  for (waited = 0; waited < SERVER_STOP_MS; waited += 10)
+  {
+    if (waitpid(server_pid, NULL, WNOHANG) == server_pid)
+    {
+      return 0;
+    }
+    sleep_ms(10);
+  }
+  printf("server did not stop, killing it\n");
+  kill(server_pid, SIGTERM);
+  sleep_ms(500);
+  kill(server_pid, SIGKILL);
+  waitpid(server_pid, NULL, 0);
+  return -1;
+}
+
+// Adds one process's CPU time and context switches from /proc; with children
+// also those of its children it has reaped
+static int proc_add(pid_t pid, int reaped, struct usage *u, int *ppid)
+{
+  char path[64];
+  char buf[1024];
+  char *p;
+  unsigned long utime, stime;
+  long cutime, cstime;
+  long n;
+  FILE *fp;
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+  if ((fp = fopen(path, "r")) == NULL)
+  {
+    return -1;
+  }
+  p = fgets(buf, sizeof(buf), fp);
+  fclose(fp);
+  // The command name may hold spaces; fields are counted from its ')'
+  if (p == NULL || (p = strrchr(buf, ')')) == NULL ||
+      sscanf(p + 2, "%*c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %ld %ld", ppid, &utime,
+             &stime, &cutime, &cstime) != 5)
+  {
+    return -1;
+  }
+  u->cpu_s += (double)(utime + stime + (reaped ? cutime + cstime : 0)) / sysconf(_SC_CLK_TCK);
+  snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+  if ((fp = fopen(path, "r")) == NULL)
+  {
+    return 0;
+  }
+  while (fgets(buf, sizeof(buf), fp) != NULL)
+  {
+    if (sscanf(buf, "voluntary_ctxt_switches: %ld", &n) == 1 ||
+        sscanf(buf, "nonvoluntary_ctxt_switches: %ld", &n) == 1)
+    {
+      u->csw += n;
+    }
+  }
+  fclose(fp);
+  return 0;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		proc_usage
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int proc_usage(pid_t root, struct usage *u)
+  --                   pid_t root:      the server
+  --              struct usage *u:      filled with the totals
+  --
+  --	RETURNS:
+  --					 0    on success
+  --          -1    if root is gone
+  --	NOTES:
+  --		CPU time of the server, its live workers and the workers it has already
+  --    reaped, and the context switches of the server and its live workers (the
+  --    kernel keeps no count for reaped ones, nor per process for extra threads,
+  --    whose switches are left out). Taken before and after the counted rounds.
+------------------------------------------------------------------------------------*/
+int proc_usage(pid_t root, struct usage *u)
+{
+  DIR *dir;
+  struct dirent *de;
+  pid_t pid;
+  int ppid;
+  u->cpu_s = 0;
+  u->csw = 0;
+  if (proc_add(root, 1, u, &ppid) == -1 || (dir = opendir("/proc")) == NULL)
+  {
+    return -1;
+  }
+  while ((de = readdir(dir)) != NULL)
+  {
+    struct usage child = {0, 0};
+    if ((pid = atoi(de->d_name)) <= 0 || pid == root)
+    {
+      continue;
+    }
+    if (proc_add(pid, 0, &child, &ppid) == 0 && ppid == root)
+    {
+      u->cpu_s += child.cpu_s;
+      u->csw += child.csw;
+    }
+  }
+  closedir(dir);
+  return 0;
+}
+
+// Picks the file of client i of a round from the weighted mix
+static const char *pick_file(struct bench_opts *opts, int round, int i)
+{
+  int slot = (int)(((unsigned)(round * 7919 + i) * 2654435761u) % (unsigned)opts->total_weight);
+  int m;
+  for (m = 0; m < opts->nmix - 1 && slot >= opts->mix[m].weight; ++m)
+  {
+    slot -= opts->mix[m].weight;
+  }
+  return opts->mix[m].path;
+}
+
+// Fills in what a client printed: bytes received and time to the first packet
+static void parse_client_log(FILE *log, struct sample *s)
+{
+  char line[512];
+  long long bytes;
+  long us;
+  rewind(log);
+  while (fgets(line, sizeof(line), log) != NULL)
+  {
+    if (sscanf(line, "Srv end msg, totalbrecv: %lld", &bytes) == 1)
+    {
+      s->bytes = bytes;
+    }
+    else if (sscanf(line, "wake-up latency: first msg %ld us", &us) == 1)
+    {
+      s->first_us = us;
+    }
+  }
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		run_round
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int run_round(struct bench_opts *opts, int round, struct sample *samples)
+  --      struct bench_opts *opts:      clients, mix, priorities and client arguments
+  --                    int round:      round number, varies the files picked
+  --      struct sample *samples:      opts->clients entries to fill in
+  --
+  --	RETURNS:
+  --					wall time of the round in microseconds
+  --          -1    on failure to start a client
+  --	NOTES:
+  --		Starts every client of the round back to back, each with its output in an
+  --    unlinked temporary file, then reaps them with wait4 for their CPU time and
+  --    context switches, timing each from its start to its exit.
+------------------------------------------------------------------------------------*/
+int run_round(struct bench_opts *opts, int round, struct sample *samples)
+{
+  FILE *logs[CLIENTS_MAX];
+  pid_t pids[CLIENTS_MAX];
+  struct timespec started[CLIENTS_MAX];
+  struct timespec t0, now;
+  struct rusage ru;
+  char prio[16];
+  char *argv[8 + EXTRA_ARGS_MAX];
+  int argc;
+  int status;
+  int left;
+  int i;
+  int j;
+  pid_t pid;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (i = 0; i < opts->clients; ++i)
+  {
+    struct sample *s = &samples[i];
+    s->file = pick_file(opts, round, i);
+    s->priority = opts->priorities[i % opts->npriorities];
+    s->status = -1;
+    s->bytes = 0;
+    s->first_us = -1;
+    if ((logs[i] = tmpfile()) == NULL)
+    {
+      perror("tmpfile");
+      return -1;
+    }
+    snprintf(prio, sizeof(prio), "%d", s->priority);
+    argc = 0;
+    argv[argc++] = (char *)opts->server;
+    argv[argc++] = "-t";
+    argv[argc++] = "client";
+    argv[argc++] = "-f";
+    argv[argc++] = (char *)s->file;
+    argv[argc++] = "-p";
+    argv[argc++] = prio;
+    for (j = 0; j < opts->nextra; ++j)
+    {
+      argv[argc++] = opts->extra[j];
+    }
+    argv[argc] = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &started[i]);
+    if ((pids[i] = fork()) == -1)
+    {
+      perror("fork");
+      return -1;
+    }
+    if (pids[i] == 0)
+    {
+      dup2(fileno(logs[i]), STDOUT_FILENO);
+      dup2(fileno(logs[i]), STDERR_FILENO);
+      execv(argv[0], argv);
+      _exit(127);
+    }
+  }
+  for (left = opts->clients; left > 0;)
+  {
+    if ((pid = wait4(-1, &status, 0, &ru)) == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      break;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (i = 0; i < opts->clients && pids[i] != pid; ++i)
+    {
+    }
+    if (i == opts->clients)
+    {
+      continue; /* not one of ours */
+    }
+    --left;
+    samples[i].status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    samples[i].done_us = elapsed_us(&started[i], &now);
+    samples[i].cpu_s = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+                       (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+    samples[i].csw = ru.ru_nvcsw + ru.ru_nivcsw;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  for (i = 0; i < opts->clients; ++i)
+  {
+    parse_client_log(logs[i], &samples[i]);
+    fclose(logs[i]);
+  }
+  return (int)elapsed_us(&t0, &now);
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		report
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		void report(struct bench_opts *opts, struct sample *samples, int n,
+  --                            struct usage *server_use, double wall_s, const char *csv)
+  --      struct bench_opts *opts:      the run's settings
+  --      struct sample *samples:      every counted client
+  --                        int n:      how many
+  --      struct usage *server_use:      server CPU and switches over the counted rounds
+  --                  double wall_s:      summed wall time of the counted rounds
+  --              const char *csv:      file to save the summary in, or NULL
+  --
+  --	RETURNS:		void
+  --	NOTES:
+  --		Prints the per-file breakdown and the summary. Latency percentiles only
+  --    cover clients that succeeded; failures are counted separately.
+------------------------------------------------------------------------------------*/
+void report(struct bench_opts *opts, struct sample *samples, int n, struct usage *server_use,
+            double wall_s, const char *csv)
+{
+  long *first = malloc(n * sizeof(long));
+  long *done = malloc(n * sizeof(long));
+  long long bytes = 0;
+  double client_cpu = 0;
+  long client_csw = 0;
+  int nfirst = 0;
+  int ndone = 0;
+  int failures = 0;
+  int i;
+  int m;
+  FILE *fp;
+  if (first == NULL || done == NULL)
+  {
+    free(first);
+    free(done);
+    return;
+  }
+  printf("\n%-30s %8s %14s %10s %10s\n", "file", "clients", "bytes", "avg ms", "MB/s each");
+  for (m = 0; m < opts->nmix; ++m)
+  {
+    long long fbytes = 0;
+    long fdone = 0;
+    int count = 0;
+    for (i = 0; i < n; ++i)
+    {
+      if (strcmp(samples[i].file, opts->mix[m].path) == 0 && samples[i].status == 0)
+      {
+        fbytes += samples[i].bytes;
+        fdone += samples[i].done_us;
+        ++count;
+      }
+    }
+    printf("%-30s %8d %14lld %10.2f %10.2f\n", opts->mix[m].path, count, fbytes,
+           count > 0 ? fdone / 1000.0 / count : 0.0, fdone > 0 ? (double)fbytes / fdone : 0.0);
+  }
+  for (i = 0; i < n; ++i)
+  {
+    client_cpu += samples[i].cpu_s;
+    client_csw += samples[i].csw;
+    if (samples[i].status != 0)
+    {
+      ++failures;
+      continue;
+    }
+    bytes += samples[i].bytes;
+    done[ndone++] = samples[i].done_us;
+    if (samples[i].first_us >= 0)
+    {
+      first[nfirst++] = samples[i].first_us;
+    }
+  }
+  qsort(first, nfirst, sizeof(long), cmp_long);
+  qsort(done, ndone, sizeof(long), cmp_long);
+  printf("\nsummary (%d clients, %d failed)\n", n, failures);
+  nmetrics = 0;
+  metric("clients", n, "");
+  metric("failures", failures, "");
+  metric("bytes", (double)bytes, "B");
+  metric("wall_s", wall_s, "s");
+  metric("throughput_mbs", wall_s > 0 ? bytes / wall_s / 1e6 : 0, "MB/s");
+  metric("ttfb_p50_us", percentile(first, nfirst, 50), "us");
+  metric("ttfb_p90_us", percentile(first, nfirst, 90), "us");
+  metric("ttfb_p99_us", percentile(first, nfirst, 99), "us");
+  metric("ttfb_max_us", nfirst > 0 ? first[nfirst - 1] : 0, "us");
+  metric("done_p50_ms", percentile(done, ndone, 50) / 1000.0, "ms");
+  metric("done_p90_ms", percentile(done, ndone, 90) / 1000.0, "ms");
+  metric("done_p99_ms", percentile(done, ndone, 99) / 1000.0, "ms");
+  metric("done_max_ms", ndone > 0 ? done[ndone - 1] / 1000.0 : 0, "ms");
+  metric("client_cpu_s", client_cpu, "s");
+  metric("server_cpu_s", server_use->cpu_s, "s");
+  metric("cpu_ns_per_byte", bytes > 0 ? (client_cpu + server_use->cpu_s) * 1e9 / bytes : 0,
+         "ns/B");
+  metric("client_csw", client_csw, "");
+  metric("server_csw", server_use->csw, "");
+  metric("csw_per_mb", bytes > 0 ? (client_csw + server_use->csw) * 1e6 / bytes : 0, "/MB");
+  free(first);
+  free(done);
+  if (csv == NULL)
+  {
+    return;
+  }
+  if ((fp = fopen(csv, "w")) == NULL)
+  {
+    perror(csv);
+    return;
+  }
+  fprintf(fp, "metric,value\n");
+  for (m = 0; m < nmetrics; ++m)
+  {
+    fprintf(fp, "%s,%.6f\n", metrics[m].name, metrics[m].value);
+  }
+  fclose(fp);
+  printf("summary saved to %s\n", csv);
+}
+
+// Reads a saved summary. Returns the number of metrics, -1 if it cannot be read.
+static int load_metrics(const char *path, struct metric *out)
+{
+  char line[256];
+  int n = 0;
+  FILE *fp;
+  if ((fp = fopen(path, "r")) == NULL)
+  {
+    perror(path);
+    return -1;
+  }
+  while (n < METRICS_MAX && fgets(line, sizeof(line), fp) != NULL)
+  {
+    if (sscanf(line, "%63[^,],%lf", out[n].name, &out[n].value) == 2)
+    {
+      ++n;
+    }
+  }
+  fclose(fp);
+  return n;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		compare
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int compare(const char *baseline, const char *current)
+  --           const char *baseline:      summary saved by an earlier run (-o)
+  --            const char *current:      summary to compare with it, NULL for the
+  --                                      metrics of this run
+  --
+  --	RETURNS:
+  --					 0    on success
+  --          -1    if a summary cannot be read
+  --	NOTES:
+  --		Prints each metric of both runs and the change in percent.
+------------------------------------------------------------------------------------*/
+int compare(const char *baseline, const char *current)
+{
+  struct metric base[METRICS_MAX];
+  struct metric cur[METRICS_MAX];
+  int nbase;
+  int ncur;
+  int i;
+  int j;
+  if ((nbase = load_metrics(baseline, base)) == -1)
+  {
+    return -1;
+  }
+  if (current != NULL)
+  {
+    if ((ncur = load_metrics(current, cur)) == -1)
+    {
+      return -1;
+    }
+  }
+  else
+  {
+    memcpy(cur, metrics, sizeof(metrics));
+    ncur = nmetrics;
+  }
+  printf("\n%-22s %14s %14s %9s\n", "metric", "baseline", "current", "change");
+  for (i = 0; i < ncur; ++i)
+  {
+    for (j = 0; j < nbase && strcmp(base[j].name, cur[i].name) != 0; ++j)
+    {
+    }
+    if (j == nbase)
+    {
+      printf("%-22s %14s %14.3f\n", cur[i].name, "-", cur[i].value);
+    }
+    else if (base[j].value != 0)
+    {
+      printf("%-22s %14.3f %14.3f %+8.1f%%\n", cur[i].name, base[j].value, cur[i].value,
+             (cur[i].value - base[j].value) * 100.0 / base[j].value);
+    }
+    else
+    {
+      printf("%-22s %14.3f %14.3f\n", cur[i].name, base[j].value, cur[i].value);
+    }
+  }
+  return 0;
+}
+
+void usage()
+{
+  printf("Run with options: [-S server] [-c clients] [-r rounds] [-w warmup_rounds] [-p prio,prio,...] [-f file[:weight],...] [-g mb,mb,...] [-d gen_dir] [-e pool|uring] [-n pool_size] [-x \"client args\"] [-o summary.csv] [-b baseline.csv]\n"
+         "   or: -b baseline.csv current.csv to compare two saved runs\n");
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		main
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int main(int argc, char *argv[])
+  --
+  --	RETURNS:
+  --					 0    if every counted client succeeded
+  --           1    on bad options, failure to start, or failed clients
+  --	NOTES:
+  --        [OPTIONS]
+  --          -S : Server binary, also run as the clients (default SERVER_DEFAULT)
+  --          -c : Concurrent clients per round (default CLIENTS_DEFAULT)
+  --          -r : Counted rounds (default ROUNDS_DEFAULT)
+  --          -w : Warm-up rounds, run first and not counted (default WARMUP_DEFAULT)
+  --          -p : Client priorities, dealt out round robin (default 1)
+  --          -f : File mix, "path[:weight]" comma separated (default MIX_DEFAULT)
+  --          -g : Also generate files of these sizes in MB, weight 1 each
+  --               (default GEN_DEFAULT, "" for none)
+  --          -d : Directory for the generated files (default GEN_DIR_DEFAULT)
+  --          -e : Server engine, "pool" or "uring"
+  --          -n : Server pool size
+  --          -x : Further client arguments, space separated (e.g. "-m shm -k 8")
+  --          -o : Save the summary as "metric,value" lines
+  --          -b : Compare with a saved summary; with a file argument left over,
+  --               only compare those two saved summaries and run nothing
+------------------------------------------------------------------------------------*/
+int main(int argc, char *argv[])
+{
+  struct bench_opts opts;
+  struct usage before, after;
+  struct sample *samples;
+  const char *mix = MIX_DEFAULT;
+  char gen[256] = GEN_DEFAULT;
+  const char *gen_dir = GEN_DIR_DEFAULT;
+  const char *csv = NULL;
+  const char *baseline = NULL;
+  char extra[1024] = "";
+  char *tok;
+  char *save;
+  char path[PATH_SIZE];
+  double wall_s = 0;
+  pid_t server_pid;
+  int failures = 0;
+  int opt;
+  int round;
+  int us;
+  int i;
+  memset(&opts, 0, sizeof(opts));
+  opts.server = SERVER_DEFAULT;
+  opts.clients = CLIENTS_DEFAULT;
+  opts.rounds = ROUNDS_DEFAULT;
+  opts.warmup = WARMUP_DEFAULT;
+  opts.priorities[0] = 1;
+  opts.npriorities = 1;
+  while ((opt = getopt(argc, argv, OPTIONS)) != -1)
+  {
+    switch (opt)
+    {
+    case 'S':
+      opts.server = optarg;
+      break;
+    case 'c':
+      opts.clients = atoi(optarg);
+      break;
+    case 'r':
+      opts.rounds = atoi(optarg);
+      break;
+    case 'w':
+      opts.warmup = atoi(optarg);
+      break;
+    case 'p':
+      opts.npriorities = 0;
+      for (tok = strtok_r(optarg, ",", &save); tok != NULL && opts.npriorities < PRIORITIES_MAX;
+           tok = strtok_r(NULL, ",", &save))
+      {
+        opts.priorities[opts.npriorities++] = atoi(tok);
+      }
+      break;
+    case 'f':
+      mix = optarg;
+      break;
+    case 'g':
+      strncpy(gen, optarg, sizeof(gen) - 1);
+      break;
+    case 'd':
+      gen_dir = optarg;
+      break;
+    case 'e':
+      opts.engine = optarg;
+      break;
+    case 'n':
+      opts.pool = optarg;
+      break;
+    case 'x':
+      strncpy(extra, optarg, sizeof(extra) - 1);
+      break;
+    case 'o':
+      csv = optarg;
+      break;
+    case 'b':
+      baseline = optarg;
+      break;
+    default:
+    case '?':
+      usage();
+      return 1;
+    }
+  }
+  if (baseline != NULL && optind < argc)
+  {
+    return compare(baseline, argv[optind]) == 0 ? 0 : 1;
+  }
+  for (i = 0; i < opts.npriorities; ++i)
+  {
+    if (opts.priorities[i] < 1)
+    {
+      opts.npriorities = 0;
+    }
+  }
+  if (opts.clients < 1 || opts.clients > CLIENTS_MAX || opts.rounds < 1 || opts.warmup < 0 ||
+      opts.npriorities < 1 || parse_mix(mix, &opts) == -1)
+  {
+    usage();
+    return 1;
+  }
+  for (tok = strtok_r(extra, " ", &save); tok != NULL && opts.nextra < EXTRA_ARGS_MAX;
+       tok = strtok_r(NULL, " ", &save))
+  {
+    opts.extra[opts.nextra++] = tok;
+  }
+  for (tok = strtok_r(gen, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save))
+  {
+    snprintf(path, sizeof(path), "%s/bench-%sM.bin", gen_dir, tok);
+    if (atoi(tok) < 1 || generate_file(path, (long long)atoi(tok) << 20) == -1 ||
+        parse_mix(path, &opts) == -1)
+    {
+      usage();
+      return 1;
+    }
+  }
+  if ((samples = calloc((size_t)opts.clients * opts.rounds, sizeof(struct sample))) == NULL)
+  {
+    perror("calloc");
+    return 1;
+  }
+  if ((server_pid = start_server(&opts)) == -1)
+  {
+    return 1;
+  }
+  for (round = 0; round < opts.warmup; ++round)
+  {
+    printf("warm-up round %d\n", round + 1);
+    if (run_round(&opts, round, samples) == -1)
+    {
+      stop_server(&opts, server_pid);
+      return 1;
+    }
+  }
+  proc_usage(server_pid, &before);
+  for (round = 0; round < opts.rounds; ++round)
+  {
+    if ((us = run_round(&opts, opts.warmup + round, samples + round * opts.clients)) == -1)
+    {
+      stop_server(&opts, server_pid);
+      return 1;
+    }
+    printf("round %d: %d clients in %.1f ms\n", round + 1, opts.clients, us / 1000.0);
+    wall_s += us / 1e6;
+  }
+  if (proc_usage(server_pid, &after) == -1)
+  {
+    printf("server exited during the run, see bench-server.log\n");
+    after = before;
+  }
+  after.cpu_s -= before.cpu_s;
+  after.csw -= before.csw;
+  stop_server(&opts, server_pid);
+  report(&opts, samples, opts.clients * opts.rounds, &after, wall_s, csv);
+  if (baseline != NULL)
+  {
+    compare(baseline, NULL);
+  }
+  for (i = 0; i < opts.clients * opts.rounds; ++i)
+  {
+    failures += samples[i].status != 0;
+  }
+  free(samples);
+  return failures > 0 ? 1 : 0;
+}
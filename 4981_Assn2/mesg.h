@@ -1,15 +1,163 @@
+#ifndef MESG_H
+#define MESG_H
+
+#include <stddef.h>
+
 #define MAXMESSAGEDATA 4096 /* don't want sizeof(Mesg) > 4096 */
-#define MESGHDRSIZE (sizeof(Mesg) - MAXMESGDATA)
-/* length of mesg_len and mesg_type */
+#define MESGHDRSIZE (offsetof(Mesg, mesg_data) - sizeof(long))
+/* bytes between mtype and mesg_data; msgsnd sends these plus mesg_len bytes */
 typedef struct Mesg
 {
   long mtype;   /* message type */
   int mesg_len; /* #bytes in mesg_data */
   int pid;
   int mesg_priority;
+  int mesg_cmd; /* control command, see CMD_* below */
+  int mesg_flags; /* transport/feature flags set in the handshake, MESG_F_* */
+  unsigned int mesg_seq; /* packet number within the transfer (wraps), data packets */
+  unsigned int mesg_crc; /* data packets: CRC32C of the mesg_len payload bytes */
+  unsigned int mesg_sum; /* end marker: CRC32C of every byte of the file (or range) */
+  long long mesg_offset; /* data packets: file offset of the payload; range requests:
+                            first byte wanted */
+  long long mesg_count;  /* range requests: bytes wanted, -1 for the rest of the file;
+                            MESG_F_LZ packets: bytes once decompressed */
   char mesg_data[MAXMESSAGEDATA];
 } Mesg; //Alias for struct Mesg = Mesg
 
+#define MAX_PID 32768
+#define LISTEN_MSG (MAX_PID + 500) /* mtype of every message to the server */
+#define RECV_TIMEOUT_MS 10000 /* client gives up if the server is silent this long */
+#define CREDIT_WINDOW_DEFAULT 2 /* packets a queue transfer may have in flight */
+#define CREDIT_WINDOW_MAX 64
+#define BUSY_RETRIES 4        /* client: CMD_BUSY replies taken before giving up */
+
+// The pid of a request is the mtype its replies go to, and names the process that
+// sent it. Its low MESG_PID_BITS are that process's id; a process with several
+// requests in flight (the mesgq library) tells them apart by a tag above those.
+#define MESG_PID_BITS 22 /* pid_max is at most 2^22 */
+#define MESG_PID(pid) ((pid) & ((1 << MESG_PID_BITS) - 1))
+
+// Control commands carried in mesg_cmd of messages sent to LISTEN_MSG. Every
+// control message shares the one listen mtype so the server can block on a
+// single msgrcv and dispatch on the command.
+#define CMD_FETCH 0    /* file request, mesg_data holds the filename */
+#define CMD_SHUTDOWN 1 /* ask the server to stop listening and exit */
+#define CMD_STAT 4     /* file size request, answered by a CMD_FILEINFO alone */
+#define CMD_STATS 5    /* live counters request, answered by a CMD_STATS reply
+                          holding a struct srv_stats */
+#define CMD_DONE 7     /* from a pool worker: it finished a request and can take
+                          the next one held back for it */
+
+// Replies sent to a client's own mtype carry CMD_FETCH (file data) or:
+#define CMD_FILEINFO 2 /* first reply of a transfer, mesg_data holds a struct file_info */
+#define CMD_BUSY 6     /* instead of it: no room for the request now, ask again in
+                          mesg_count ms; mesg_data holds a text (MESG_F_ERROR set) */
+
+// Sent by a client to the worker serving it (mtype = the worker's pid, from the
+// file info reply, on the transfer's data queue), identified by pid:
+#define CMD_CREDIT 3 /* mesg_data holds an int: further packets it may queue */
+
+// Handshake flags (mesg_flags of a CMD_FETCH)
+#define MESG_F_SHM 0x1 /* file data goes through a shared memory ring, not the queue */
+#define MESG_F_BATCH 0x4    /* mesg_data holds several NUL separated filenames */
+#define MESG_F_MANIFEST 0x8 /* mesg_data names a file on the server listing them, one per line */
+#define MESG_F_RANGE 0x10   /* only mesg_count bytes from mesg_offset */
+#define MESG_F_COMPRESS 0x20 /* the client takes MESG_F_LZ packets */
+#define MESG_F_PIPE 0x40 /* file data is spliced into a FIFO the client made, not sent
+                           in packets; the end marker's mesg_count holds the bytes */
+#define MESG_F_COALESCE 0x80 /* the client takes MESG_F_PACKED messages */
+#define MESG_STRIPE_SHIFT 8      /* bits 8-15: data queues to stripe the transfer over */
+#define MESG_STRIPE_MASK 0xff00  /* (0 or 1 for an ordinary single queue transfer) */
+
+// Reply flags (mesg_flags of packets sent back to the client)
+#define MESG_F_ERROR 0x2 /* end message carrying an error text instead of file data */
+#define MESG_F_LZ 0x20   /* payload is LZ compressed, mesg_count holds its raw length */
+#define MESG_F_PACKED 0x80 /* payload is mesg_count packets, each a struct packet_rec
+                              and its data; mesg_crc is 0, every record has its own */
+
+#define STRIPES_MAX 16 /* data queues one transfer may be striped over */
+
+// Payload of a CMD_FILEINFO reply, followed by the file's path. Packet seq of a
+// queue transfer goes through data_qids[seq % stripes], each queue carrying its own
+// credits. A batch gets one per file: the first over the shared queue, the rest
+// on data_qids[0] (or the ring) right after the previous file's end marker.
+struct file_info
+{
+  long long size;  /* bytes the transfer will deliver */
+  int packet_size; /* data bytes per packet, the last one is shorter */
+  int stripes;     /* private queues carrying the data and credits, 0 for shm */
+  int data_qids[STRIPES_MAX];
+  long long mtime; /* modification time in ns, lets a resumed ranged fetch tell
+                      the file changed */
+  int status;      /* 0, or the errno that kept this file of a batch (or a
+                      CMD_STAT) from being served; no packets follow */
+  int index;       /* position of the file in the batch */
+  int files;       /* files in the request, 1 unless batched */
+  int window;      /* packets each data queue holds with room to spare: the credit
+                      window a client without one of its own should use, 0 for shm */
+  int records;     /* packets per message when they are coalesced (MESG_F_PACKED),
+                      the last message holding the rest; seq, credits and window
+                      then count messages. 0 or 1 if they are not */
+};
+
+// Sub-header of each packet of a MESG_F_PACKED message, its data right behind it.
+// Packets keep their size and checksum; only the queue message is shared.
+struct packet_rec
+{
+  int len;          /* data bytes, less than the packet size only in the last packet */
+  unsigned int crc; /* CRC32C of the data */
+};
+
+#define STATS_ROWS_MAX 64 /* transfers listed one by one in a CMD_STATS reply */
+
+// One transfer in progress, in a CMD_STATS reply
+struct xfer_stats
+{
+  int worker_pid;
+  int client_pid;
+  int priority;
+  int pad;
+  long long bytes;      /* payload bytes sent so far */
+  long long packets;
+  long long elapsed_us;
+};
+
+// Transfer engines of the server (-e), as reported in a CMD_STATS reply
+#define ENGINE_POOL 0  /* pre-forked worker processes */
+#define ENGINE_URING 1 /* one process, io_uring */
+
+// Payload of a CMD_STATS reply: totals since the server started (transfers in
+// progress included), then up to STATS_ROWS_MAX of those in progress. Each
+// worker's counters are read as they stand, not as one consistent cut.
+struct srv_stats
+{
+  long long uptime_us;
+  int engine;           /* ENGINE_POOL or ENGINE_URING */
+  int workers;          /* processes serving transfers: the pool size, 1 for uring */
+  int max_xfers;        /* transfers served at once: the pool size, or the uring cap */
+  int active;           /* transfers in progress */
+  int rows;             /* of them listed in xfers */
+  int pad;
+  long long transfers;  /* requests served to the end */
+  long long bytes;      /* payload bytes sent */
+  long long packets;
+  long long send_failures;
+  long long stalls;     /* sends that found the client's queue or ring full */
+  long long busy_us;    /* time spent serving the finished requests */
+  int backlog;          /* requests waiting for a pool worker */
+  int backlog_cap;      /* room for them, -1 without a backlog (uring engine) */
+  long long admitted;   /* requests handed to a worker */
+  long long queued;     /* of them, ones that had to wait in the backlog */
+  long long rejected;   /* turned away busy on arrival, or bumped by a higher priority */
+  long long shed;       /* turned away busy after waiting BACKLOG_MAX_WAIT_MS */
+  long long abandoned;  /* dropped from the backlog because their client had left */
+  long long wait_p50_us; /* arrival to dispatch, over the last BACKLOG_WAIT_SAMPLES
+                            admitted requests */
+  long long wait_p99_us;
+  long long wait_max_us; /* since the server started */
+  struct xfer_stats xfers[STATS_ROWS_MAX];
+};
+
 // Expected message structure
 // struct inc_msg
 // {
@@ -17,3 +165,5 @@ typedef struct Mesg
 //   int priority;
 //   char msg[INC_MSG_SIZE];
 // } imsg;
+
+#endif
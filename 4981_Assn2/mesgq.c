@@ -0,0 +1,1280 @@
+/*---------------------------------------------------------------------------------------
+  --	SOURCE FILE:	mesgq.c -   Message queue transport of the file server (server.c)
+  --                            and an asynchronous client for it
+  --
+  --	PROGRAM:		server, and programs linking libmesgq.a
+  --
+  --	FUNCTIONS:
+  --      int mesgq_open_queue(key_t keyval);
+  --      void mesgq_watch(volatile sig_atomic_t *running);
+  --      int mesgq_read(int qid, long mtype, struct Mesg *imsg, int timeout_ms);
+  --      int mesgq_send(int qid, Mesg *omsg);
+  --      void mesgq_crc_init(void);
+  --      unsigned int mesgq_crc32c(unsigned int crc, const char *buf, int len);
+  --      unsigned int mesgq_crc32c_raw(unsigned int reg, const char *buf, int len);
+  --      unsigned int mesgq_crc32c_pad(long long n);
+  --      unsigned int mesgq_crc32c_zeros(long long n);
+  --      unsigned int mesgq_crc32c_shift(unsigned int reg, unsigned int zeros);
+  --      unsigned int mesgq_crc32c_combine(unsigned int crc1, unsigned int crc2, long long len2);
+  --      struct mesgq *mesgq_open(key_t keyval, int max_requests);
+  --      int mesgq_fetch(struct mesgq *mq, const struct mesgq_fetch *req);
+  --      int mesgq_poll(struct mesgq *mq, int timeout_ms);
+  --      int mesgq_cancel(struct mesgq *mq, int id);
+  --      int mesgq_pending(struct mesgq *mq);
+  --      void mesgq_close(struct mesgq *mq);
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	NOTES:
+  --     Build with the server, or as a library for other clients:
+  --         gcc -Wall -O2 -o server server.c mesgq.c -lpthread
+  --         gcc -Wall -O2 -c mesgq.c && ar rcs libmesgq.a mesgq.o
+  --     The queue wrappers and the CRC32C code were moved here from server.c, which
+  --     uses them on both sides of the protocol. Everything exported starts with
+  --     mesgq_, so a program linking the library keeps names like read_message.
+  --     The wrappers block: mesgq_read with a timeout waits in msgrcv under a
+  --     SIGALRM timer, and mesgq_send waits for room on a full queue.
+  --     The request API, mesgq_open to mesgq_close, lets one process fetch many
+  --     files from the server at once, instead of a client process (and its
+  --     blocking receives) per file. A program opens a handle, starts fetches with
+  --     mesgq_fetch and calls mesgq_poll from its own loop; packets and completions
+  --     come back through callbacks. Each request is tagged in the bits above the
+  --     pid of its pid field, and the server sends its replies and packets to that
+  --     tag, so the transfers of one process never see each other's messages. The
+  --     request API sets no timers or handlers and every send and receive it makes
+  --     is IPC_NOWAIT; mesgq_poll sleeps between passes that found nothing, from
+  --     MESGQ_BACKOFF_MIN_US doubling up to MESGQ_BACKOFF_MAX_US, until its
+  --     timeout, and mesgq_close polls for up to RECV_TIMEOUT_MS. Credit the
+  --     worker's full data queue cannot take yet is kept and handed over on a
+  --     later pass. Only plain single queue transfers are asked for (no shared
+  --     memory ring, FIFO, compression, stripes or batches).
+---------------------------------------------------------------------------------------*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+#if defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#include "mesgq.h"
+
+#define TIMER_RETRY_MS 10 /* mesgq_read re-fires its timer this often once expired */
+#define CRC32C_POLY 0x82f63b78 /* Castagnoli, bit reflected */
+#define CRC_LANE 512           /* bytes per lane of the interleaved hardware CRC */
+#define MESGQ_BACKOFF_MIN_US 50   /* mesgq_poll's first sleep after an idle pass */
+#define MESGQ_BACKOFF_MAX_US 2000 /* and the longest, doubling up to it */
+#define MESGQ_LINGER_MS (3 * RECV_TIMEOUT_MS) /* a cancelled request waits this long
+                                                 for its reply */
+
+// Request states
+#define REQ_FREE 0
+#define REQ_SEND 1      /* to be sent at due_ns: the queue was full, or after CMD_BUSY */
+#define REQ_INFO 2      /* sent, waiting for the file info */
+#define REQ_DATA 3      /* receiving packets */
+#define REQ_CANCELLED 4 /* dropped before its file info came, waiting to clean up */
+
+// One request, in the slot its tag names
+struct mesgq_req
+{
+  int state;
+  int id;              /* pid field and reply mtype: (slot + 1) << MESG_PID_BITS | pid */
+  struct mesgq_fetch f; /* f.path points into omsg */
+  Mesg omsg;           /* the request, kept to send again after CMD_BUSY */
+  int tries;           /* CMD_BUSY replies so far */
+  long long due_ns;    /* REQ_SEND: when to send */
+  long long heard_ns;  /* last word from the server */
+  int data_qid;
+  pid_t worker_pid;
+  int window;
+  long long size;      /* announced in the file info */
+  long long packets;   /* in the file, the short (maybe empty) last one included */
+  long long received;
+  long long granted;
+  int owed;            /* credit the worker has not been given yet */
+  int consumed;        /* packets taken since credit was last topped up */
+  unsigned int sum;    /* CRC32C of the data so far */
+  long long start;     /* offset in the file of the first byte */
+  long long bytes;
+};
+
+struct mesgq
+{
+  int qid;             /* the server's queue */
+  int nreqs;
+  int active;          /* slots in use, cancelled ones included */
+  int pending;         /* requests on_done is still to run for */
+  int next;            /* slot the next request looks at first */
+  int events;          /* callbacks run by the current mesgq_poll */
+  unsigned int seed;   /* CMD_BUSY retry jitter */
+  struct mesgq_req *reqs;
+  Mesg msg;            /* receive buffer */
+};
+
+static volatile sig_atomic_t *watched = NULL; /* see mesgq_watch */
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		mesgq_open_queue
+  --
+  --	DATE:			    Mar 27, 2019
+  --
+  --	REVISIONS:		Mar 27, 2019
+  --                Oct 16, 2026 - renamed from open_queue, with the library's prefix
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int mesgq_open_queue(key_t keyval)
+  --
+  --	RETURNS:		
+  --					qid   on successful creation of IPC message queue
+  --          -1    on failure       
+  --	NOTES:
+  --		Wrapper function for creating a system message queue
+------------------------------------------------------------------------------------*/
+int mesgq_open_queue(key_t keyval)
+{
+  int qid;
+  if ((qid = msgget(keyval, IPC_CREAT | 0660)) == -1)
+  {
+    return (-1);
+  }
+  return qid;
+}
+
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		mesgq_watch
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		void mesgq_watch(volatile sig_atomic_t *running)
+  --  volatile sig_atomic_t *running:      flag a signal handler clears on shutdown
+  --
+  --	RETURNS:		void
+  --	NOTES:
+  --		Once the flag is cleared, mesgq_send gives up on a full queue at the next
+  --    signal instead of retrying, and mesgq_close stops waiting. Without it they
+  --    carry on until the queue has room or their time is up.
+------------------------------------------------------------------------------------*/
+void mesgq_watch(volatile sig_atomic_t *running)
+{
+  watched = running;
+}
+
+// Validates a received message's mesg_len against the msgrcv byte count
+static int check_framing(struct Mesg *imsg, int result)
+{
+  if (result == -1)
+  {
+    return -1;
+  }
+  if (result < (int)MESGHDRSIZE || imsg->mesg_len != result - (int)MESGHDRSIZE)
+  {
+    errno = EBADMSG;
+    return -1;
+  }
+  if (imsg->mesg_len < MAXMESSAGEDATA)
+  {
+    imsg->mesg_data[imsg->mesg_len] = '\0';
+  }
+  return result;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		mesgq_read
+  --
+  --	DATE:			    Mar 27, 2019
+  --
+  --	REVISIONS:		Mar 27, 2019
+  --                Oct 16, 2026 - blocking receive with optional timeout
+  --                Oct 16, 2026 - validate length-exact framing
+  --                Oct 16, 2026 - timeout told by the clock, not a flag the handler sets
+  --                Oct 16, 2026 - renamed from read_message, with the library's prefix
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int mesgq_read(int qid, long mtype, struct Mesg *imsg, int timeout_ms)
+  --                  int qid:      message queue id
+  --               long mtype:      message mtype for the queue to identify
+  --               Mseg *imsg:      The message struct to be populated from the queue
+  --           int timeout_ms:      < 0 block until a message or signal arrives
+  --                                  0 poll once (IPC_NOWAIT)
+  --                                > 0 block at most this many milliseconds
+  --
+  --	RETURNS:		
+  --					n     number of bytes written to mtext[] array in message struct
+  --          -1    on failure, errno is ETIMEDOUT on timeout, EINTR on a signal,
+  --                ENOMSG when polling an empty queue, EBADMSG if mesg_len does
+  --                not match the bytes received
+  --	NOTES:
+  --		Wrapper function for reading from a message queue
+  --    Messages carry only header + mesg_len payload bytes, so mesg_len is checked
+  --    against the received size. A NUL is placed after the payload when there is
+  --    room, for the convenience of string payloads; it is not part of mesg_len.
+  --    The timeout is a SIGALRM interval timer; the program must catch SIGALRM
+  --    without SA_RESTART. It keeps re-firing every TIMER_RETRY_MS so an alarm that
+  --    lands just before msgrcv blocks cannot leave the caller stuck. An EINTR past
+  --    the deadline is the timeout, any earlier one another signal.
+------------------------------------------------------------------------------------*/
+int mesgq_read(int qid, long mtype, struct Mesg *imsg, int timeout_ms)
+{
+  int result;
+  int length;
+  int saved_errno;
+  struct itimerval timer;
+  struct timespec deadline;
+  struct timespec now;
+  length = sizeof(struct Mesg) - sizeof(long);
+  if (timeout_ms == 0)
+  {
+    return check_framing(imsg, msgrcv(qid, imsg, length, mtype, IPC_NOWAIT));
+  }
+  if (timeout_ms > 0)
+  {
+    memset(&timer, 0, sizeof(timer));
+    timer.it_value.tv_sec = timeout_ms / 1000;
+    timer.it_value.tv_usec = (timeout_ms % 1000) * 1000;
+    timer.it_interval.tv_usec = TIMER_RETRY_MS * 1000;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+      ++deadline.tv_sec;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    setitimer(ITIMER_REAL, &timer, NULL);
+  }
+  result = msgrcv(qid, imsg, length, mtype, 0);
+  if (timeout_ms > 0)
+  {
+    saved_errno = errno;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_REAL, &timer, NULL);
+    if (result == -1 && saved_errno == EINTR)
+    {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      if (now.tv_sec > deadline.tv_sec ||
+          (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec))
+      {
+        saved_errno = ETIMEDOUT;
+      }
+    }
+    errno = saved_errno;
+  }
+  return check_framing(imsg, result);
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		mesgq_send
+  --
+  --	DATE:			    Mar 27, 2019
+  --
+  --	REVISIONS:		Mar 27, 2019
+  --                Oct 16, 2026 - send header + mesg_len bytes only
+  --                Oct 16, 2026 - renamed from send_message, with the library's prefix
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int mesgq_send(int qid, Mesg *omsg)
+  --                  int qid:      message queue id
+  --               Mseg *omsg:      The message struct to be sent over to the queue
+  --
+  --	RETURNS:		
+  --					0     on success
+  --          -1    on failure, errno EINVAL if mesg_len is out of range
+  --	NOTES:
+  --		Wrapper function for writing to a message queue
+  --    Only the header and the mesg_len bytes of payload are handed to msgsnd, so
+  --    small packets do not cost a full MAXMESSAGEDATA copy and queue space.
+  --    A send blocked on a full queue is retried after an unrelated signal (e.g.
+  --    SIGCHLD), but given up once shutdown was requested (see mesgq_watch).
+------------------------------------------------------------------------------------*/
+int mesgq_send(int qid, Mesg *omsg)
+{
+  int result;
+  if (omsg->mesg_len < 0 || omsg->mesg_len > MAXMESSAGEDATA)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  int length = MESGHDRSIZE + omsg->mesg_len;
+  while ((result = msgsnd(qid, omsg, length, 0)) < 0)
+  {
+    if (errno != EINTR || (watched != NULL && !*watched))
+    {
+      return -1;
+    }
+  }
+  return (result);
+}
+
+// CRC32C register update without the pre/post inversion, so it is linear in the
+// data. crc_update points at the fastest one this CPU has (see mesgq_crc_init).
+static unsigned int crc_table[256];
+static unsigned int crc_x2n[32]; /* x^(2^k) mod the polynomial */
+static unsigned int crc_lane_shift[4][256]; /* times x^(8 * CRC_LANE), a byte at a time */
+
+// Moves a register over CRC_LANE zero bytes
+static unsigned int crc_shift_lane(unsigned int reg)
+{
+  return crc_lane_shift[0][reg & 0xff] ^ crc_lane_shift[1][(reg >> 8) & 0xff] ^
+         crc_lane_shift[2][(reg >> 16) & 0xff] ^ crc_lane_shift[3][reg >> 24];
+}
+
+static unsigned int crc_update_table(unsigned int reg, const char *buf, int len)
+{
+  const unsigned char *p = (const unsigned char *)buf;
+  while (len-- > 0)
+  {
+    reg = crc_table[(reg ^ *p++) & 0xff] ^ (reg >> 8);
+  }
+  return reg;
+}
+
+// The CRC instructions take 3 cycles but can start one a cycle, so blocks of
+// three lanes are run side by side, each from 0, and merged by shifting.
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static unsigned int crc_update_hw(unsigned int reg,
+                                                                    const char *buf, int len)
+{
+  unsigned long long r = reg;
+  unsigned long long r1;
+  unsigned long long r2;
+  unsigned long long v;
+  unsigned long long v1;
+  unsigned long long v2;
+  int i;
+  for (; len >= 3 * CRC_LANE; len -= 3 * CRC_LANE, buf += 3 * CRC_LANE)
+  {
+    r1 = 0;
+    r2 = 0;
+    for (i = 0; i < CRC_LANE; i += 8)
+    {
+      memcpy(&v, buf + i, sizeof(v));
+      memcpy(&v1, buf + CRC_LANE + i, sizeof(v1));
+      memcpy(&v2, buf + 2 * CRC_LANE + i, sizeof(v2));
+      r = __builtin_ia32_crc32di(r, v);
+      r1 = __builtin_ia32_crc32di(r1, v1);
+      r2 = __builtin_ia32_crc32di(r2, v2);
+    }
+    r = crc_shift_lane(crc_shift_lane(r) ^ r1) ^ r2;
+  }
+  for (; len >= 8; len -= 8, buf += 8)
+  {
+    memcpy(&v, buf, sizeof(v));
+    r = __builtin_ia32_crc32di(r, v);
+  }
+  for (; len > 0; --len, ++buf)
+  {
+    r = __builtin_ia32_crc32qi((unsigned int)r, *buf);
+  }
+  return (unsigned int)r;
+}
+#elif defined(__aarch64__)
+__attribute__((target("+crc"))) static unsigned int crc_update_hw(unsigned int reg,
+                                                                  const char *buf, int len)
+{
+  uint32_t r1;
+  uint32_t r2;
+  uint64_t v;
+  uint64_t v1;
+  uint64_t v2;
+  int i;
+  for (; len >= 3 * CRC_LANE; len -= 3 * CRC_LANE, buf += 3 * CRC_LANE)
+  {
+    r1 = 0;
+    r2 = 0;
+    for (i = 0; i < CRC_LANE; i += 8)
+    {
+      memcpy(&v, buf + i, sizeof(v));
+      memcpy(&v1, buf + CRC_LANE + i, sizeof(v1));
+      memcpy(&v2, buf + 2 * CRC_LANE + i, sizeof(v2));
+      reg = __crc32cd(reg, v);
+      r1 = __crc32cd(r1, v1);
+      r2 = __crc32cd(r2, v2);
+    }
+    reg = crc_shift_lane(crc_shift_lane(reg) ^ r1) ^ r2;
+  }
+  for (; len >= 8; len -= 8, buf += 8)
+  {
+    memcpy(&v, buf, sizeof(v));
+    reg = __crc32cd(reg, v);
+  }
+  for (; len > 0; --len, ++buf)
+  {
+    reg = __crc32cb(reg, *buf);
+  }
+  return reg;
+}
+#endif
+
+static unsigned int (*crc_update)(unsigned int reg, const char *buf, int len) = crc_update_table;
+
+// a * b modulo the CRC polynomial, both bit reflected (x^0 is the top bit)
+static unsigned int crc_multmodp(unsigned int a, unsigned int b)
+{
+  unsigned int m = 1u << 31;
+  unsigned int p = 0;
+  for (;;)
+  {
+    if (a & m)
+    {
+      p ^= b;
+      if ((a & (m - 1)) == 0)
+      {
+        break;
+      }
+    }
+    m >>= 1;
+    b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+  }
+  return p;
+}
+
+// x^(8n) modulo the polynomial: multiplying a register by it appends n zero bytes
+static unsigned int crc_x8n(long long n)
+{
+  unsigned int p = 1u << 31;
+  int k = 3;
+  for (; n > 0; n >>= 1, ++k)
+  {
+    if (n & 1)
+    {
+      p = crc_multmodp(crc_x2n[k & 31], p);
+    }
+  }
+  return p;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		mesgq_crc_init
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		void mesgq_crc_init(void)
+  --
+  --	RETURNS:		void
+  --	NOTES:
+  --		Builds the CRC32C tables and picks the CRC instruction of the CPU (SSE4.2
+  --    on x86-64, the ARMv8 CRC extension on arm64) when it has one, the table
+  --    otherwise. Runs once at startup, before any thread or worker exists.
+------------------------------------------------------------------------------------*/
+void mesgq_crc_init(void)
+{
+  unsigned int c;
+  unsigned int p;
+  int n;
+  int k;
+  for (n = 0; n < 256; ++n)
+  {
+    for (c = n, k = 0; k < 8; ++k)
+    {
+      c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+    }
+    crc_table[n] = c;
+  }
+  p = 1u << 30; /* x^1 */
+  crc_x2n[0] = p;
+  for (n = 1; n < 32; ++n)
+  {
+    crc_x2n[n] = p = crc_multmodp(p, p);
+  }
+  p = crc_x8n(CRC_LANE);
+  for (k = 0; k < 4; ++k)
+  {
+    for (n = 0; n < 256; ++n)
+    {
+      crc_lane_shift[k][n] = crc_multmodp(p, (unsigned int)n << (8 * k));
+    }
+  }
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2"))
+  {
+    crc_update = crc_update_hw;
+  }
+#elif defined(__aarch64__)
+  if (getauxval(AT_HWCAP) & HWCAP_CRC32)
+  {
+    crc_update = crc_update_hw;
+  }
+#endif
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		mesgq_crc32c
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		unsigned int mesgq_crc32c(unsigned int crc, const char *buf, int len)
+  --                unsigned int crc:      CRC32C of the data so far, 0 to start
+  --                 const char *buf:      more data
+  --                         int len:      its length
+  --
+  --	RETURNS:		the CRC32C of the data so far followed by buf
+  --	NOTES:
+  --		The iSCSI/ext4 checksum (Castagnoli polynomial). Protects each packet's
+  --    payload (mesg_crc) and the whole file (mesg_sum of the end marker).
+------------------------------------------------------------------------------------*/
+unsigned int mesgq_crc32c(unsigned int crc, const char *buf, int len)
+{
+  return ~crc_update(~crc, buf, len);
+}
+
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		mesgq_crc32c_raw
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		unsigned int mesgq_crc32c_raw(unsigned int reg, const char *buf, int len)
+  --                unsigned int reg:      register so far, 0 to start
+  --                 const char *buf:      more data
+  --                         int len:      its length
+  --
+  --	RETURNS:		the register after buf
+  --	NOTES:
+  --		The CRC32C register without the pre and post inversion, so the registers of
+  --    parts taken separately XOR together (after shifting) into that of the whole;
+  --    crc32c of n bytes is the register ^ mesgq_crc32c_pad(n).
+------------------------------------------------------------------------------------*/
+unsigned int mesgq_crc32c_raw(unsigned int reg, const char *buf, int len)
+{
+  return crc_update(reg, buf, len);
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		mesgq_crc32c_pad
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		unsigned int mesgq_crc32c_pad(long long n)
+  --                     long long n:      bytes of data
+  --
+  --	RETURNS:		what the inversions add to the raw register of n bytes
+------------------------------------------------------------------------------------*/
+unsigned int mesgq_crc32c_pad(long long n)
+{
+  return ~crc_multmodp(crc_x8n(n), 0xffffffffu);
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		mesgq_crc32c_zeros
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		unsigned int mesgq_crc32c_zeros(long long n)
+  --                     long long n:      bytes
+  --
+  --	RETURNS:		x^(8n) modulo the polynomial, the factor for mesgq_crc32c_shift
+  --	NOTES:
+  --		Costs a multiplication per bit of n; a shift used over and over (a packet,
+  --    a stripe) is best worked out once.
+------------------------------------------------------------------------------------*/
+unsigned int mesgq_crc32c_zeros(long long n)
+{
+  return crc_x8n(n);
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		mesgq_crc32c_shift
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		unsigned int mesgq_crc32c_shift(unsigned int reg, unsigned int zeros)
+  --                unsigned int reg:      raw register
+  --              unsigned int zeros:      mesgq_crc32c_zeros(n)
+  --
+  --	RETURNS:		the register moved over n zero bytes
+------------------------------------------------------------------------------------*/
+unsigned int mesgq_crc32c_shift(unsigned int reg, unsigned int zeros)
+{
+  return crc_multmodp(zeros, reg);
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		mesgq_crc32c_combine
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		unsigned int mesgq_crc32c_combine(unsigned int crc1, unsigned int crc2,
+  --                                                  long long len2)
+  --               unsigned int crc1:      crc32c of A
+  --               unsigned int crc2:      crc32c of B
+  --                  long long len2:      length of B
+  --
+  --	RETURNS:		the crc32c of A followed by B
+  --	NOTES:
+  --		Lets a receiver build the file checksum from the packet checksums it checks
+  --    anyway, without a second pass over the data.
+------------------------------------------------------------------------------------*/
+unsigned int mesgq_crc32c_combine(unsigned int crc1, unsigned int crc2, long long len2)
+{
+  return crc_multmodp(crc_x8n(len2), crc1) ^ crc2;
+}
+
+// Nanoseconds on the monotonic clock
+static long long mq_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Ends a request: its data queue is removed (a worker still sending sees EIDRM
+// and stops), the slot is freed and on_done is run, unless it was cancelled. The
+// slot is free before the callback, which may start another request in it.
+static void req_finish(struct mesgq *mq, struct mesgq_req *r, int status, const char *why)
+{
+  struct mesgq_fetch f = r->f;
+  long long bytes = r->bytes;
+  int notify = r->state != REQ_CANCELLED;
+  if (r->data_qid != -1)
+  {
+    msgctl(r->data_qid, IPC_RMID, NULL);
+    r->data_qid = -1;
+  }
+  r->state = REQ_FREE;
+  --mq->active;
+  if (notify)
+  {
+    --mq->pending;
+    ++mq->events;
+    if (f.on_done != NULL)
+    {
+      f.on_done(f.arg, status, bytes, why);
+    }
+  }
+}
+
+// Gives up on a request the server has gone quiet on. One still waiting for its
+// file info keeps its tag for a while, so a late reply is not taken for that of
+// the next request in the slot, and its data queue is still removed.
+static void req_expire(struct mesgq *mq, struct mesgq_req *r, long long now)
+{
+  struct mesgq_fetch f = r->f;
+  if (r->state != REQ_INFO)
+  {
+    req_finish(mq, r, ETIMEDOUT, "no reply from the server");
+    return;
+  }
+  r->state = REQ_CANCELLED;
+  r->heard_ns = now;
+  --mq->pending;
+  ++mq->events;
+  if (f.on_done != NULL)
+  {
+    f.on_done(f.arg, ETIMEDOUT, 0, "no reply from the server");
+  }
+}
+
+// Puts the request on the server's queue without blocking. Returns 1 if it went
+// (or failed for good), 0 if the queue is full and it is tried again next pass.
+static int req_send(struct mesgq *mq, struct mesgq_req *r, long long now)
+{
+  if (msgsnd(mq->qid, &r->omsg, MESGHDRSIZE + r->omsg.mesg_len, IPC_NOWAIT) == 0)
+  {
+    r->state = REQ_INFO;
+    r->heard_ns = now;
+    return 1;
+  }
+  if (errno == EAGAIN || errno == EINTR)
+  {
+    return 0;
+  }
+  req_finish(mq, r, errno, "request could not be queued");
+  return 1;
+}
+
+// Hands the worker the credit owed, if its data queue has room for it
+static int req_grant(struct mesgq_req *r)
+{
+  Mesg cmsg;
+  cmsg.mtype = r->worker_pid;
+  cmsg.pid = r->id;
+  cmsg.mesg_priority = 0;
+  cmsg.mesg_cmd = CMD_CREDIT;
+  cmsg.mesg_flags = 0;
+  cmsg.mesg_len = sizeof(int);
+  memcpy(cmsg.mesg_data, &r->owed, sizeof(int));
+  if (msgsnd(r->data_qid, &cmsg, MESGHDRSIZE + cmsg.mesg_len, IPC_NOWAIT) == 0)
+  {
+    r->granted += r->owed;
+    r->owed = 0;
+    return 0;
+  }
+  return errno == EAGAIN || errno == EINTR ? 0 : -1;
+}
+
+// Takes the reply to a queued request: the file info, CMD_BUSY or an error.
+// Returns 1 if there was one.
+static int req_info(struct mesgq *mq, struct mesgq_req *r, long long now)
+{
+  Mesg *m = &mq->msg;
+  struct file_info info;
+  int retry_ms;
+  if (mesgq_read(mq->qid, r->id, m, 0) == -1)
+  {
+    if (errno == ENOMSG || errno == EINTR)
+    {
+      return 0;
+    }
+    req_finish(mq, r, errno, "server queue failed");
+    return 1;
+  }
+  r->heard_ns = now;
+  if (m->mesg_cmd == CMD_FILEINFO && m->mesg_len >= (int)sizeof(info))
+  {
+    memcpy(&info, m->mesg_data, sizeof(info));
+  }
+  else
+  {
+    info.stripes = 0;
+  }
+  // A cancelled request only waited to remove its data queue
+  if (r->state == REQ_CANCELLED)
+  {
+    r->data_qid = info.stripes > 0 ? info.data_qids[0] : -1;
+    req_finish(mq, r, ECANCELED, NULL);
+    return 1;
+  }
+  if (m->mesg_cmd == CMD_BUSY)
+  {
+    if (r->tries++ >= BUSY_RETRIES)
+    {
+      req_finish(mq, r, EBUSY, m->mesg_data);
+      return 1;
+    }
+    retry_ms = m->mesg_count > 0 ? (int)m->mesg_count : 1;
+    retry_ms += rand_r(&mq->seed) % (retry_ms / 2 + 1);
+    r->state = REQ_SEND;
+    r->due_ns = now + retry_ms * 1000000LL;
+    return 1;
+  }
+  if (m->mesg_cmd != CMD_FILEINFO || m->mesg_len < (int)sizeof(info))
+  {
+    req_finish(mq, r, EREMOTEIO, m->mesg_data);
+    return 1;
+  }
+  // Only a single queue transfer is asked for
+  if (info.stripes != 1)
+  {
+    r->data_qid = info.stripes > 0 ? info.data_qids[0] : -1;
+    req_finish(mq, r, EPROTO, "no data queue");
+    return 1;
+  }
+  r->data_qid = info.data_qids[0];
+  r->worker_pid = m->pid;
+  if (r->window == 0)
+  {
+    r->window = info.window > 0 && info.window <= CREDIT_WINDOW_MAX ? info.window
+                                                                    : CREDIT_WINDOW_DEFAULT;
+  }
+  r->size = info.size;
+  r->packets = info.size / (info.packet_size > 0 ? info.packet_size : 1) + 1;
+  r->owed = r->packets < r->window ? r->packets : r->window;
+  r->state = REQ_DATA;
+  return 1;
+}
+
+// Takes the packets waiting on a transfer's data queue, at most a window of
+// them so one fast transfer cannot starve the others. Returns 1 if there were any.
+static int req_data(struct mesgq *mq, struct mesgq_req *r, long long now)
+{
+  Mesg *m = &mq->msg;
+  long long limit;
+  int n;
+  for (n = 0; n < r->window; ++n)
+  {
+    if (r->owed > 0 && req_grant(r) == -1)
+    {
+      req_finish(mq, r, errno == EINVAL ? EIDRM : errno, "transfer aborted by the server");
+      return 1;
+    }
+    if (mesgq_read(r->data_qid, r->id, m, 0) == -1)
+    {
+      if (errno == ENOMSG || errno == EINTR)
+      {
+        break;
+      }
+      req_finish(mq, r, errno == EINVAL ? EIDRM : errno, "transfer aborted by the server");
+      return 1;
+    }
+    r->heard_ns = now;
+    if (m->mesg_flags & MESG_F_ERROR)
+    {
+      req_finish(mq, r, EREMOTEIO, m->mesg_data);
+      return 1;
+    }
+    if (m->mesg_cmd != CMD_FETCH || m->mesg_seq != (unsigned int)r->received ||
+        (m->mesg_flags & MESG_F_LZ))
+    {
+      req_finish(mq, r, EBADMSG, "unexpected message from server");
+      return 1;
+    }
+    if (mesgq_crc32c(0, m->mesg_data, m->mesg_len) != m->mesg_crc)
+    {
+      req_finish(mq, r, EBADMSG, "packet failed its checksum");
+      return 1;
+    }
+    r->sum = mesgq_crc32c_combine(r->sum, m->mesg_crc, m->mesg_len);
+    ++r->received;
+    if (m->mesg_len > 0 && r->f.on_data != NULL)
+    {
+      ++mq->events;
+      r->f.on_data(r->f.arg, m->mesg_data, m->mesg_len, r->start + r->bytes);
+      // The callback may have cancelled it
+      if (r->state != REQ_DATA)
+      {
+        return 1;
+      }
+    }
+    r->bytes += m->mesg_len;
+    if (m->mesg_priority < 0)
+    {
+      // The sum only covers what came, so a file that shrank is caught by its size
+      if (r->sum != m->mesg_sum)
+      {
+        req_finish(mq, r, EBADMSG, "checksum mismatch");
+      }
+      else if (r->bytes < r->size)
+      {
+        req_finish(mq, r, EBADMSG, "transfer cut short");
+      }
+      else
+      {
+        req_finish(mq, r, 0, NULL);
+      }
+      return 1;
+    }
+    // Same credit schedule as the blocking client
+    if (++r->consumed >= (r->window + 1) / 2)
+    {
+      limit = r->received >= r->packets ? r->received + r->window : r->packets;
+      if (r->granted + r->owed < limit)
+      {
+        r->owed += limit - r->granted - r->owed < r->consumed ? limit - r->granted - r->owed
+                                                              : r->consumed;
+      }
+      r->consumed = 0;
+    }
+  }
+  if (r->owed > 0 && req_grant(r) == -1)
+  {
+    req_finish(mq, r, errno == EINVAL ? EIDRM : errno, "transfer aborted by the server");
+    return 1;
+  }
+  return n > 0;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		mesgq_open
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		struct mesgq *mesgq_open(key_t keyval, int max_requests)
+  --                key_t keyval:      key of the server's queue
+  --            int max_requests:      requests that may be in flight at once, 1 to
+  --                                   MESGQ_MAX_REQUESTS
+  --
+  --	RETURNS:
+  --					the handle for mesgq_fetch, mesgq_poll and mesgq_close
+  --          NULL  on failure, errno EINVAL if max_requests is out of range
+  --	NOTES:
+  --		Each request gets a slot, and the slot number (plus one) sits above the pid in
+  --    the request's pid field. The server addresses its replies and packets to that
+  --    field, so one process can have many transfers open without them mixing; the
+  --    server itself only looks at the pid bits (MESG_PID).
+------------------------------------------------------------------------------------*/
+struct mesgq *mesgq_open(key_t keyval, int max_requests)
+{
+  static int crc_ready = 0;
+  struct mesgq *mq;
+  if (max_requests < 1 || max_requests > MESGQ_MAX_REQUESTS)
+  {
+    errno = EINVAL;
+    return NULL;
+  }
+  if ((mq = calloc(1, sizeof(*mq))) == NULL ||
+      (mq->reqs = calloc(max_requests, sizeof(*mq->reqs))) == NULL)
+  {
+    free(mq);
+    return NULL;
+  }
+  if ((mq->qid = mesgq_open_queue(keyval)) == -1)
+  {
+    free(mq->reqs);
+    free(mq);
+    return NULL;
+  }
+  if (!crc_ready)
+  {
+    mesgq_crc_init();
+    crc_ready = 1;
+  }
+  mq->nreqs = max_requests;
+  mq->seed = (unsigned int)getpid() ^ (unsigned int)mq_now();
+  return mq;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		mesgq_fetch
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int mesgq_fetch(struct mesgq *mq, const struct mesgq_fetch *req)
+  --                 struct mesgq *mq:      from mesgq_open
+  --  const struct mesgq_fetch *req:      the file and the callbacks
+  --
+  --	RETURNS:
+  --					id    of the request, for mesgq_cancel
+  --          -1    on failure, errno EAGAIN if max_requests are in flight, EINVAL
+  --                for a bad request
+  --	NOTES:
+  --		Starts a fetch and returns without waiting. Its callbacks run from
+  --    mesgq_poll; on_done runs exactly once unless the request is cancelled. The
+  --    path is copied, req need not outlive the call. If the server's queue is full
+  --    the request is sent by a later mesgq_poll.
+------------------------------------------------------------------------------------*/
+int mesgq_fetch(struct mesgq *mq, const struct mesgq_fetch *req)
+{
+  struct mesgq_req *r = NULL;
+  int len;
+  int i;
+  if (mq == NULL || req == NULL || req->path == NULL || req->priority < 1 ||
+      req->window < 0 || req->window > CREDIT_WINDOW_MAX || req->count < -1 ||
+      (req->count >= 0 && req->offset < 0) || (len = strlen(req->path)) == 0 ||
+      len >= MAXMESSAGEDATA)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  if (mq->active >= mq->nreqs)
+  {
+    errno = EAGAIN;
+    return -1;
+  }
+  // Round robin over the slots, so a tag is not reused right after it was freed
+  for (i = 0; i < mq->nreqs; ++i)
+  {
+    r = &mq->reqs[(mq->next + i) % mq->nreqs];
+    if (r->state == REQ_FREE)
+    {
+      break;
+    }
+  }
+  i = r - mq->reqs;
+  mq->next = (i + 1) % mq->nreqs;
+  memset(r, 0, sizeof(*r));
+  r->id = ((i + 1) << MESG_PID_BITS) | getpid();
+  // Anything left for the tag by an earlier request that timed out
+  while (msgrcv(mq->qid, &mq->msg, sizeof(Mesg) - sizeof(long), r->id, IPC_NOWAIT) != -1)
+  {
+  }
+  r->omsg.mtype = LISTEN_MSG;
+  r->omsg.pid = r->id;
+  r->omsg.mesg_priority = req->priority;
+  r->omsg.mesg_cmd = CMD_FETCH;
+  r->omsg.mesg_flags = req->count >= 0 ? MESG_F_RANGE : 0;
+  r->omsg.mesg_offset = req->count >= 0 ? req->offset : 0;
+  r->omsg.mesg_count = req->count;
+  r->omsg.mesg_len = len;
+  memcpy(r->omsg.mesg_data, req->path, len + 1);
+  r->f = *req;
+  r->f.path = r->omsg.mesg_data;
+  r->window = req->window;
+  r->start = r->omsg.mesg_offset;
+  r->data_qid = -1;
+  r->heard_ns = mq_now();
+  if (msgsnd(mq->qid, &r->omsg, MESGHDRSIZE + len, IPC_NOWAIT) == 0)
+  {
+    r->state = REQ_INFO;
+  }
+  else if (errno == EAGAIN || errno == EINTR)
+  {
+    r->state = REQ_SEND;
+    r->due_ns = r->heard_ns;
+  }
+  else
+  {
+    return -1;
+  }
+  ++mq->active;
+  ++mq->pending;
+  return r->id;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		mesgq_poll
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int mesgq_poll(struct mesgq *mq, int timeout_ms)
+  --                 struct mesgq *mq:      from mesgq_open
+  --                   int timeout_ms:      0 look once, > 0 wait at most this long,
+  --                                        < 0 wait until a callback ran
+  --
+  --	RETURNS:		the number of callbacks run, 0 if nothing happened in time
+  --	NOTES:
+  --		Moves every request along: sends queued ones, takes replies and packets,
+  --    tops up credit and gives up on transfers silent for RECV_TIMEOUT_MS. It
+  --    returns as soon as a pass ran a callback. SysV queues have nothing to block
+  --    on for several at once, so between passes that found nothing it sleeps,
+  --    from MESGQ_BACKOFF_MIN_US doubling up to MESGQ_BACKOFF_MAX_US; a pass that
+  --    moved anything starts the backoff again. With nothing in flight it returns
+  --    at once.
+------------------------------------------------------------------------------------*/
+int mesgq_poll(struct mesgq *mq, int timeout_ms)
+{
+  struct mesgq_req *r;
+  long long now = mq_now();
+  long long deadline = now + timeout_ms * 1000000LL;
+  int backoff = MESGQ_BACKOFF_MIN_US;
+  int moved;
+  int i;
+  mq->events = 0;
+  for (;;)
+  {
+    moved = 0;
+    for (i = 0; i < mq->nreqs; ++i)
+    {
+      r = &mq->reqs[i];
+      switch (r->state)
+      {
+      case REQ_SEND:
+        if (now >= r->due_ns)
+        {
+          moved += req_send(mq, r, now);
+        }
+        break;
+      case REQ_INFO:
+      case REQ_CANCELLED:
+        moved += req_info(mq, r, now);
+        break;
+      case REQ_DATA:
+        moved += req_data(mq, r, now);
+        break;
+      }
+      if (r->state != REQ_FREE &&
+          now - r->heard_ns > (r->state == REQ_CANCELLED ? MESGQ_LINGER_MS : RECV_TIMEOUT_MS) *
+                                  1000000LL &&
+          (r->state != REQ_SEND || now >= r->due_ns))
+      {
+        req_expire(mq, r, now);
+      }
+    }
+    if (mq->events > 0 || timeout_ms == 0 || mq->active == 0 ||
+        (timeout_ms > 0 && now >= deadline))
+    {
+      return mq->events;
+    }
+    if (moved > 0)
+    {
+      backoff = MESGQ_BACKOFF_MIN_US;
+    }
+    else
+    {
+      usleep(backoff);
+      backoff = backoff * 2 < MESGQ_BACKOFF_MAX_US ? backoff * 2 : MESGQ_BACKOFF_MAX_US;
+    }
+    now = mq_now();
+  }
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		mesgq_cancel
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int mesgq_cancel(struct mesgq *mq, int id)
+  --                 struct mesgq *mq:      from mesgq_open
+  --                           int id:      from mesgq_fetch
+  --
+  --	RETURNS:
+  --					0     on success
+  --          -1    errno ENOENT if id is not a request still in flight
+  --	NOTES:
+  --		Drops a request; none of its callbacks run after this, on_done included. A
+  --    transfer under way has its data queue removed, which stops the worker. One
+  --    still waiting for its file info holds its slot until the reply comes (or
+  --    MESGQ_LINGER_MS passes), to remove the data queue the reply names.
+------------------------------------------------------------------------------------*/
+int mesgq_cancel(struct mesgq *mq, int id)
+{
+  int slot = (id >> MESG_PID_BITS) - 1;
+  struct mesgq_req *r;
+  if (slot < 0 || slot >= mq->nreqs || mq->reqs[slot].id != id ||
+      mq->reqs[slot].state == REQ_FREE || mq->reqs[slot].state == REQ_CANCELLED)
+  {
+    errno = ENOENT;
+    return -1;
+  }
+  r = &mq->reqs[slot];
+  --mq->pending;
+  if (r->state == REQ_INFO)
+  {
+    r->state = REQ_CANCELLED;
+    r->heard_ns = mq_now();
+    return 0;
+  }
+  r->state = REQ_CANCELLED;
+  req_finish(mq, r, ECANCELED, NULL);
+  return 0;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		mesgq_pending
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int mesgq_pending(struct mesgq *mq)
+  --                 struct mesgq *mq:      from mesgq_open
+  --
+  --	RETURNS:		the number of requests whose on_done has yet to run
+------------------------------------------------------------------------------------*/
+int mesgq_pending(struct mesgq *mq)
+{
+  return mq->pending;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		mesgq_close
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		void mesgq_close(struct mesgq *mq)
+  --                 struct mesgq *mq:      from mesgq_open, NULL is ignored
+  --
+  --	RETURNS:		void
+  --	NOTES:
+  --		Cancels whatever is still in flight and frees the handle. Requests the
+  --    server has not answered yet are waited for, at most RECV_TIMEOUT_MS, so
+  --    their data queues are removed and no worker is left waiting on them.
+------------------------------------------------------------------------------------*/
+void mesgq_close(struct mesgq *mq)
+{
+  long long deadline;
+  int i;
+  if (mq == NULL)
+  {
+    return;
+  }
+  for (i = 0; i < mq->nreqs; ++i)
+  {
+    if (mq->reqs[i].state != REQ_FREE && mq->reqs[i].state != REQ_CANCELLED)
+    {
+      mesgq_cancel(mq, mq->reqs[i].id);
+    }
+  }
+  deadline = mq_now() + RECV_TIMEOUT_MS * 1000000LL;
+  while (mq->active > 0 && mq_now() < deadline && (watched == NULL || *watched))
+  {
+    mesgq_poll(mq, 100);
+  }
+  free(mq->reqs);
+  free(mq);
+}
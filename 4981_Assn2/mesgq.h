@@ -0,0 +1,54 @@
+// Message queue transport shared by the server and its clients, and an
+// asynchronous client for programs that fetch files from the server themselves.
+// See mesgq.c.
+#ifndef MESGQ_H
+#define MESGQ_H
+
+#include <signal.h>
+#include <sys/types.h>
+#include "mesg.h"
+
+#define MESGQ_MAX_REQUESTS 511 /* tags fit above the pid in a positive int */
+
+// Queue primitives
+int mesgq_open_queue(key_t keyval);
+void mesgq_watch(volatile sig_atomic_t *running);
+int mesgq_read(int qid, long mtype, struct Mesg *imsg, int timeout_ms);
+int mesgq_send(int qid, Mesg *omsg);
+
+// CRC32C of packets and files
+void mesgq_crc_init(void);
+unsigned int mesgq_crc32c(unsigned int crc, const char *buf, int len);
+unsigned int mesgq_crc32c_raw(unsigned int reg, const char *buf, int len);
+unsigned int mesgq_crc32c_pad(long long n);
+unsigned int mesgq_crc32c_zeros(long long n);
+unsigned int mesgq_crc32c_shift(unsigned int reg, unsigned int zeros);
+unsigned int mesgq_crc32c_combine(unsigned int crc1, unsigned int crc2, long long len2);
+
+// A file to fetch with mesgq_fetch. The callbacks run inside mesgq_poll.
+struct mesgq_fetch
+{
+  const char *path;    /* file on the server */
+  int priority;        /* 1 or more, the request's bandwidth share and place in
+                          the server's backlog */
+  int window;          /* packets in flight, 0 for what the server suggests */
+  long long offset;    /* with count >= 0, only count bytes from here */
+  long long count;     /* -1 for the whole file */
+  // Each packet's payload, in order, with its offset in the file
+  void (*on_data)(void *arg, const char *data, int len, long long offset);
+  // Once, at the end: status 0, or an errno (ETIMEDOUT, EBUSY, EIDRM: transfer
+  // aborted, EREMOTEIO: the server's error text in why, EBADMSG: failed a check)
+  void (*on_done)(void *arg, int status, long long bytes, const char *why);
+  void *arg;
+};
+
+struct mesgq;
+
+struct mesgq *mesgq_open(key_t keyval, int max_requests);
+int mesgq_fetch(struct mesgq *mq, const struct mesgq_fetch *req);
+int mesgq_poll(struct mesgq *mq, int timeout_ms);
+int mesgq_cancel(struct mesgq *mq, int id);
+int mesgq_pending(struct mesgq *mq);
+void mesgq_close(struct mesgq *mq);
+
+#endif
@@ -5,13 +5,50 @@
   --	PROGRAM:		server.exe
   --
   --	FUNCTIONS:		
-  --      int open_queue(key_t keyval);
-  --      int read_message(int qid, long mtype, struct Mesg *imsg);
-  --      int send_message(int qid, Mesg *omsg);
-  --      void *clientThread(void *msg_qid);
-  --      int client(int msg_qid, char *fname, int priority);
+  --      void on_signal(int sig);
+  --      int install_signals(void);
+  --      void *clientThread(void *arg);
+  --      int sink_open(struct sink *sink, const char *path, int direct, long long offset);
+  --      void sink_prealloc(struct sink *sink, long long size);
+  --      int sink_put(struct sink *sink, const char *data, int len);
+  --      int sink_close(struct sink *sink);
+  --      struct shm_ring *ring_create(pid_t client_pid);
+  --      struct shm_ring *ring_attach(pid_t client_pid);
+  --      Mesg *ring_reserve(struct shm_ring *ring, pid_t client_pid);
+  --      int ring_recv(int msg_qid, struct shm_ring *ring, Mesg *imsg, Mesg **pkt,
+  --                    int timeout_ms);
+  --      int client(int msg_qid, struct client_opts *opts);
+  --      int client_ranged(int msg_qid, struct client_opts *opts);
+  --      int client_spliced(int msg_qid, struct client_opts *opts);
+  --      int read_full(int fd, char *buf, int len);
+  --      int write_full(int fd, const char *buf, int len);
+  --      int cache_init(size_t capacity);
+  --      struct cache_entry *cache_lookup(const char *path, struct stat *st, int *fill);
+  --      void cache_release(struct cache_entry *entry, int loaded);
+  --      void cache_report(void);
+  --      int src_open(struct xfer_src *src, const char *path);
+  --      int src_readahead(struct xfer_src *src);
   --      int server_transfer_proc(int msg_qid, Mesg imsg);
-  --      int server(int msg_qid);
+  --      int sched_init(void);
+  --      void sched_join(int priority);
+  --      void sched_leave(struct worker_slot *slot);
+  --      void sched_acquire(int bytes);
+  --      void sched_idle(int idle);
+  --      void dump_shares(void);
+  --      int serve_stats(int msg_qid, pid_t client_pid, struct worker_stats *table, int n,
+  --                      struct backlog *bl);
+  --      int spawn_worker(int msg_qid, int slot);
+  --      void worker_loop(int msg_qid, int slot);
+  --      void reap_workers(int msg_qid);
+  --      int uring_setup(struct uring *ur, unsigned entries);
+  --      int uring_server(int msg_qid, int max_xfers);
+  --      int admit_request(int msg_qid, struct backlog *bl, Mesg *imsg);
+  --      int backlog_pump(int msg_qid, struct backlog *bl, int drain);
+  --      int server(int msg_qid, int pool_size, int engine, size_t cache_bytes,
+  --                 int backlog);
+  --      int request_shutdown(int msg_qid);
+  --      int request_stats(int msg_qid);
+  --      int client_async(struct client_opts *opts, int copies);
   --      int main(int argc, char *argv[]);
   --
   --	DATE:			    Mar 27, 2019
@@ -26,9 +63,35 @@
   --     This simple program is composed of two parts: Server mode and Client mode
   --     Server Mode:
   --         (1) Open/Create a message queue on the OS (shared config on both Srv + Client)
-  --         (2) Continuously waits for message queue to have mtype MAXPID + 500
-  --              - Forks child process to send data to destination specified in message
+  --         (2) Pre-forks a pool of transfer workers
+  --         (3) Continuously waits for message queue to have mtype MAXPID + 500
+  --              - Forwards the request to the workers' dispatch mtype; an idle worker
+  --                sends data to destination specified in message
   --              - Once file to be read is finished reading, signals to client
+  --              - Reaps workers that exit and respawns them
+  --              - Queue transfers share the queue by deficit round robin, weighted
+  --                by the client's priority; SIGUSR1 prints each client's share
+  --              - Small hot files are kept in a cache shared by all workers
+  --              - A client may ask for its transfer to be striped over several
+  --                data queues, each fed by its own sender thread in the worker
+  --              - A client may ask for a batch of files in one request; they
+  --                are sent back to back, each with its own header and status
+  --              - A client may fetch a file as byte ranges, each served by a
+  --                different worker, and resume an interrupted fetch
+  --              - Every worker keeps live counters in shared memory; -t stats
+  --                asks the server for a snapshot of them
+  --              - Each data queue is sized from the kernel's queue limits when
+  --                it is made, and the client told how many packets to keep in it
+  --              - A client may let the small packets of a high priority number
+  --                be packed several to a queue message, each behind a short
+  --                sub-header, to save a send per packet
+  --              - No more requests are dispatched than there are workers; the
+  --                rest wait in a backlog ordered by priority, then arrival, and
+  --                when it is full (or they waited too long) the client is told
+  --                CMD_BUSY with a time to come back, rather than left hanging
+  --         With -e uring a single process serves every transfer instead: file reads
+  --         go through io_uring and queue sends / ring publishes are interleaved
+  --         across the active transfers.
   --     Client Mode:
   --         (1) CMD line will specify filename and priority to be sent to server
   --         (2) Client will send message into message queue 
@@ -38,433 +101,6489 @@
   --         (3) Waits for server to put messages into queue
   --         (4) Reads queue for messsage mtype = to its own PID
   --         (5) Keeps reading until server sends end message
+  --         (6) With -o the data is handed to a sink thread in large buffers and
+  --             written to a file or stdout while the next packets are received
+  --     With -m shm the handshake still goes over the queue, but the file data comes
+  --     back through a per-transfer POSIX shared memory ring of Mesg slots, so each
+  --     packet is copied once (file -> ring) instead of into and out of the kernel.
+  --     With -m pipe the file data is spliced from the page cache into a FIFO the
+  --     client made and from there into its output, never entering user space.
+  --     Both modes block in msgrcv rather than polling the queue. SIGINT/SIGTERM (or a
+  --     CMD_SHUTDOWN control message) wake a blocked server so it can exit cleanly, and
+  --     receive timeouts are driven by SIGALRM, so only the thread doing the receive
+  --     may leave SIGALRM unblocked.
+  --     With -t fetch one process fetches every -f file -n times at once through
+  --     the asynchronous client of mesgq.c, polling them all from a single loop,
+  --     for comparison with as many client processes.
+  --     bench.c drives a server with rounds of concurrent clients and reports
+  --     throughput, latency percentiles and CPU cost, to compare builds with.
 ---------------------------------------------------------------------------------------*/
-#define MAX_PID 32768
-#define LISTEN_MSG MAX_PID + 500
 #define INC_MSG_SIZE 512
 #define FILENAME_SIZE 128
 #define ERR_FORK_INIT_LISTEN 403
 #define PRIORITY_MAX 1
 #define MSG_KEY 1337
-#define OPTIONS "?t:f:p:"
+#define DISPATCH_MSG (LISTEN_MSG + 1) /* requests handed from server to pool workers */
+#define POOL_SIZE_DEFAULT 8
+#define POOL_SIZE_MAX 256
+#define REAP_INTERVAL_MS 1000 /* upper bound on how long a dead worker goes unnoticed */
+#define BACKLOG_DEFAULT 256   /* requests held while every pool worker is busy */
+#define BACKLOG_MAX 65536
+#define BACKLOG_MAX_WAIT_MS (RECV_TIMEOUT_MS / 2) /* held this long: turned away busy,
+                                                     well before the client gives up */
+#define BACKLOG_SCAN_MS 100   /* how often the backlog is searched for those */
+#define BACKLOG_WAIT_SAMPLES 1024 /* admission waits kept for the CMD_STATS percentiles */
+#define BUSY_RETRY_MIN_MS 20  /* shortest wait a CMD_BUSY asks for */
+#define SHM_NAME_FMT "/mqxfer.%d" /* per-transfer ring, named after the client pid */
+#define FIFO_DIR_TEMPLATE "/tmp/mqxfer.XXXXXX" /* private directory of a client's FIFO */
+#define FIFO_NAME "fifo"                       /* the FIFO in it */
+#define PIPE_CHUNK (1024 * 1024) /* bytes per splice() of a pipe transfer */
+#define PIPE_SIZE (1024 * 1024)  /* FIFO capacity asked for (pipe-max-size by default) */
+#define SHM_RING_SLOTS 64         /* power of two, so slot = counter % slots survives wrap */
+#define RING_WAIT_MS 100          /* futex sleep slice between liveness checks */
+#define SCHED_QUANTUM MAXMESSAGEDATA /* bytes per unit of weight per DRR round */
+#define SCHED_WEIGHT_MAX 64           /* priorities above this get the same share */
+#define SCHED_DEFICIT_CAP 4           /* rounds of quantum a flow may bank */
+#define SCHED_MAX_WAIT_MS 50          /* starvation guard: force a round after this */
+#define STATS_LINE 64 /* cache line each worker's live counters are padded to */
+#define CACHE_MB_DEFAULT 64    /* hot-file cache size, -c 0 turns it off */
+#define CACHE_MB_MAX 4096
+#define CACHE_ENTRIES 256      /* files the cache can hold at once */
+#define CACHE_FILE_FRACTION 4  /* files over capacity / this are never cached */
+#define URING_ENTRIES 1024   /* submission queue depth */
+#define URING_MAX_XFERS 1024 /* default cap on concurrent transfers for -e uring */
+#define URING_XFER_BUFS 4    /* packets read ahead per transfer */
+#define URING_BACKOFF_US 200 /* sleep when every transfer is blocked on its consumer */
+#define URING_STALL_MS 1000  /* blocked this long: check the client is still alive */
+#define OPTIONS "?t:f:F:p:n:m:e:c:o:dk:s:r:zgab:"
+#define SINK_BUFS 4                /* buffers between the client's receive and sink threads */
+#define SINK_BUF_SIZE (1024 * 1024) /* bytes per write() of received data */
+#define SINK_ALIGN 4096            /* O_DIRECT buffer, offset and length alignment */
+#define READAHEAD_BUFS 4                  /* buffers a transfer's reader fills ahead */
+#define READAHEAD_BUF_SIZE (256 * 1024)   /* bytes per read() of the file */
+#define READAHEAD_MIN (2 * READAHEAD_BUF_SIZE) /* smaller transfers read inline */
+#define TUNE_QUEUE_BUDGET (32 * 1024 * 1024) /* bytes all data queues may hold together */
+#define TUNE_MIN_WINDOW 4   /* -a: packets shrink until this many fit a data queue */
+#define TUNE_MIN_PACKET 512 /* -a: but no further than this */
+#define RANGE_CLIENTS_MAX 16        /* -r: child clients fetching segments at once */
+#define RANGE_SEGMENTS_PER_CLIENT 4 /* segments per child, for balance and resume granularity */
+#define RANGE_PART_SUFFIX ".part"   /* progress of a ranged fetch, next to the output */
+#define COMPRESS_SPAN_MAX 65536 /* raw bytes one compressed packet may carry */
+#define COMPRESS_WINDOW 65535   /* how far back a match may reach (16 bit offsets) */
+#define COMPRESS_BUF_SIZE (4 * COMPRESS_SPAN_MAX) /* window + data, slid down when full */
+#define COMPRESS_MIN_GAIN 8     /* a packet must shrink by 1/8 to go out compressed */
+#define COMPRESS_BACKOFF 64     /* packets sent raw after a poor ratio before trying again */
+#define LZ_HASH_BITS 12         /* match finder table of 4096 positions */
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5      /* the block always ends with literals */
 
+#define _GNU_SOURCE /* O_DIRECT, fallocate */
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <signal.h>
 #include <sys/ipc.h>
 #include <sys/msg.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <pthread.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/io_uring.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <limits.h>
+#include <stdint.h>
 #include "mesg.h"
+#include "mesgq.h"
+
+// One entry per pool worker, kept in memory shared between the server and workers.
+// The worker owns busy/client_pid/taken/jobs, the server owns pid. The scheduler
+// fields are only touched under srv_shared.lock.
+struct worker_slot
+{
+  pid_t pid;
+  int busy;
+  int client_pid;
+  unsigned long taken;           /* requests received from the dispatch queue */
+  unsigned long jobs;            /* of them, finished (or lost with a dead worker) */
+  int weight;                    /* DRR weight, 0 when not scheduled */
+  int waiting;                   /* threads blocked in sched_acquire */
+  int idle;                      /* threads waiting for client credit, out of the round */
+  int data_qids[STRIPES_MAX];    /* private queues of the current transfer */
+  int ndata_qids;                /* 0 for none (shm, or not created yet) */
+  int replied;                   /* file info sent, the client has left the shared queue */
+  long deficit;                  /* bytes it may still send this round */
+  unsigned long bytes_sent;      /* scheduled bytes, whole transfer */
+  unsigned long bytes_reported;  /* bytes_sent at the last dump_shares */
+};
+
+struct srv_shared
+{
+  int nworkers;
+  pthread_mutex_t lock;  /* process shared and robust, guards the scheduler */
+  pthread_cond_t refill; /* broadcast whenever a round hands out new quanta */
+  unsigned long rounds;
+  unsigned long forced_rounds;
+  struct worker_slot slots[POOL_SIZE_MAX];
+};
+
+// A request the listener holds until a pool worker is free
+struct backlog_entry
+{
+  Mesg *msg;           /* header and mesg_len bytes only */
+  unsigned long seq;   /* arrival order, between requests of one priority */
+  long long queued_ns; /* CLOCK_MONOTONIC arrival */
+};
+
+// Admission control of the pool: no more requests are dispatched than there are
+// workers, the rest wait here in a binary heap, highest mesg_priority first and
+// then in arrival order. Only the listener touches it.
+struct backlog
+{
+  struct backlog_entry *heap;
+  int len;
+  int cap;                     /* 0: turn away whatever finds every worker busy */
+  int nworkers;
+  unsigned long arrivals;
+  unsigned long dispatched;    /* requests handed to the workers */
+  unsigned long queued;        /* of them, ones that waited here */
+  unsigned long rejected;      /* turned away on arrival, or bumped */
+  unsigned long shed;          /* turned away after BACKLOG_MAX_WAIT_MS */
+  unsigned long abandoned;     /* dropped, their client had gone */
+  long long scanned_ns;        /* last search for entries held too long */
+  long long waits[BACKLOG_WAIT_SAMPLES]; /* us from arrival to dispatch, latest ones */
+  long long wait_max_us;
+};
+
+// Live counters of one pool worker (or uring engine transfer slot), padded to a
+// cache line of their own so bumping them never contends with another worker.
+// Only the owner and its stripe threads write them, with relaxed atomics; a
+// CMD_STATS snapshot reads them as they stand.
+struct worker_stats
+{
+  unsigned long long bytes;         /* payload bytes of the data packets sent */
+  unsigned long long packets;
+  unsigned long long send_failures;
+  unsigned long long stalls;        /* sends that found the queue or ring full */
+  unsigned long long transfers;     /* requests served to the end */
+  unsigned long long busy_ns;       /* time spent on them */
+  long long started_ns;             /* CLOCK_MONOTONIC start of the current
+                                       request, 0 while idle */
+  unsigned long long start_bytes;   /* bytes and packets when it started */
+  unsigned long long start_packets;
+  int pid;
+  int client_pid;
+  int priority;
+} __attribute__((aligned(STATS_LINE)));
+
+// Single producer (transfer worker), single consumer (client) ring of packets in
+// POSIX shared memory. head/tail are free-running counters and double as futex
+// words; the waiter counts let the other side skip FUTEX_WAKE when nobody sleeps.
+struct shm_ring
+{
+  unsigned int head; /* packets published by the server */
+  unsigned int tail; /* packets consumed by the client */
+  int head_waiters;  /* client sleeping until head moves */
+  int tail_waiters;  /* server sleeping until tail moves */
+  Mesg slots[SHM_RING_SLOTS];
+};
+
+// A cached file, its contents at offset in the arena. refs pins it while
+// transfers copy from it, so eviction only ever takes unpinned entries.
+#define CACHE_FREE 0
+#define CACHE_LOADING 1 /* a worker is reading the file in, others bypass it */
+#define CACHE_READY 2
+struct cache_entry
+{
+  int state;
+  int refs;
+  char path[FILENAME_SIZE]; /* empty once invalidated */
+  off_t size;
+  struct timespec mtime;
+  size_t offset;
+  unsigned long last_used; /* LRU clock value of the last hit */
+};
+
+// Hot-file cache shared by the pool: this header then capacity bytes of arena,
+// in one shared mapping created before the workers are forked
+struct file_cache
+{
+  pthread_mutex_t lock; /* process shared and robust */
+  size_t capacity;
+  size_t used;
+  unsigned long clock;
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+  unsigned long invalidations;
+  struct cache_entry entries[CACHE_ENTRIES];
+  char arena[];
+};
+
+// Read-ahead of a streamed file. The reader thread fills buffer filled %
+// READAHEAD_BUFS with one large read, the sender copies packets out of buffer
+// taken % READAHEAD_BUFS. Counters only grow, like the client's sink.
+struct readahead
+{
+  int fd;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  char *mem; /* READAHEAD_BUFS buffers of READAHEAD_BUF_SIZE */
+  int len[READAHEAD_BUFS];
+  unsigned int filled; /* buffers read in */
+  unsigned int taken;  /* buffers the sender is done with */
+  int holding;         /* the sender is copying out of buffer taken */
+  int off;             /* bytes of it already copied */
+  long long remaining; /* bytes the reader still fetches, -1 for up to end of file */
+  int eof;             /* the reader has stopped: end of file, range or error */
+  int error;           /* errno of a failed read */
+  int closing;
+};
+
+// Where a transfer's file bytes come from: a pinned cache entry or the open file
+struct xfer_src
+{
+  int fd;           /* -1 when serving from the cache */
+  const char *mem;  /* cached contents */
+  off_t size;
+  off_t pos;
+  off_t limit;      /* end of a range request, -1 for the whole file */
+  long long mtime;  /* ns */
+  struct cache_entry *entry;
+  struct readahead *ra; /* reader thread ahead of pos, NULL when reading inline */
+};
+
+// Client output. The receiving thread copies packets into buffer filled % SINK_BUFS
+// and hands it over when full; clientThread writes buffer written % SINK_BUFS.
+// Counters only grow, so filled - written is the number of buffers in flight.
+struct sink
+{
+  int fd;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  char *mem; /* SINK_BUFS buffers of SINK_BUF_SIZE */
+  int len[SINK_BUFS];
+  unsigned int filled;  /* buffers handed to clientThread */
+  unsigned int written; /* buffers it has written out */
+  int closing;
+  int error; /* errno of the first failed write */
+  unsigned long bytes;
+  int regular; /* named regular file: preallocated, trimmed and fsynced */
+  int direct;  /* opened with O_DIRECT */
+  long long base; /* -1, or where the range it writes starts in a shared output */
+  struct timespec started; /* first write */
+};
+
+// Client command line settings
+struct client_opts
+{
+  char fname[FILENAME_SIZE];   /* the file, or with -F the manifest on the server */
+  char names[MAXMESSAGEDATA];  /* every -f, NUL separated, for a batch */
+  int names_len;
+  int nfiles;                  /* -f count, -1 if the names did not fit */
+  int batch;                   /* 0, MESG_F_BATCH or MESG_F_MANIFEST */
+  int priority;
+  int transport;               /* 0 for the queue, MESG_F_SHM for the ring, MESG_F_PIPE
+                                  for a FIFO */
+  char outname[FILENAME_SIZE]; /* -o file, "-" for stdout, empty to only count */
+  int direct;                  /* O_DIRECT output */
+  int window;                  /* credit window in packets, queue transport */
+  int stripes;                 /* data queues to stripe over, queue transport */
+  int ranges;                  /* -r: child clients fetching segments, 0 for one transfer */
+  long long offset;            /* byte range of a segment child, count -1 for the */
+  long long count;             /* whole file */
+  int compress;                /* 0 or MESG_F_COMPRESS */
+  int coalesce;                /* 0 or MESG_F_COALESCE */
+};
+
+// Client side of one data queue of a queue transfer (several when striped)
+struct stripe_rx
+{
+  int qid;
+  long long packets;  /* packets the server sends through it */
+  long long received;
+  long long granted;
+  int owed;           /* credits earned but not delivered yet (queue full) */
+  int consumed;       /* packets drained since the last grant */
+};
+
+// One request of client_async
+struct async_rx
+{
+  const char *path;
+  struct timespec *start; /* when the requests went out */
+  long long bytes;        /* handed to on_data */
+  int status;             /* -1 until on_done ran */
+  long long us;           /* from the start to on_done */
+};
+
+// The files of one request, in the order they are sent
+struct batch
+{
+  char *buf;    /* manifest contents, NULL otherwise */
+  char **paths; /* into buf or the request's mesg_data */
+  int count;
+  int multi;    /* a batch: per-file status in the file info, no error end message */
+};
+
+// A striped queue transfer on the worker side: one sender thread per data queue,
+// the one with index i sending packets i, i + stripes, ... straight from the source
+struct stripe_set
+{
+  struct xfer_src *src;
+  pid_t client_pid;
+  int priority;
+  int packet_size;
+  long long packets; /* every full packet plus the short last one */
+  off_t base;        /* file offset of packet 0 */
+  int stripes;
+  int qids[STRIPES_MAX];
+  int credits[STRIPES_MAX]; /* grants carried from one file of a batch to the next */
+  unsigned int sums[STRIPES_MAX]; /* raw CRC of each thread's packets, as if the bytes */
+  long long sum_ends[STRIPES_MAX]; /* between them were zero, up to its last one's end */
+  unsigned int crc_stride;  /* x^(8 * stripes * packet_size): from one packet of a */
+  unsigned int crc_full;    /* thread to its next; mesgq_crc32c_pad of a full packet */
+  pthread_t threads[STRIPES_MAX];
+  int started;       /* hands each thread its index */
+  int running;       /* sender threads not finished yet */
+  int failed;
+  int unread;        /* a read failed, and the client was sent the error */
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+};
+
+// Compression state of a transfer that asked for MESG_F_COMPRESS. File data is
+// staged here so a compressed packet can carry more than a packet's worth of it:
+// span follows the ratio seen so far, so the output just about fills a packet.
+// The bytes before off were sent already and stay as the window matches may
+// refer back to, as the client keeps the same bytes of its output.
+struct packer
+{
+  char stage[COMPRESS_BUF_SIZE];
+  int off;  /* next staged byte to send */
+  int have; /* staged bytes from off */
+  int eof;  /* the source has nothing past the staged bytes */
+  int span; /* raw bytes to try per packet */
+  int skip; /* packets still to send raw after a poor ratio */
+  int table[1 << LZ_HASH_BITS]; /* match finder, positions in stage */
+  unsigned long long raw_bytes;  /* file bytes sent in compressed packets */
+  unsigned long long wire_bytes; /* their compressed size */
+  unsigned long packed;          /* packets sent compressed */
+  unsigned long plain;           /* packets sent raw */
+};
+
+// Raw io_uring rings (no liburing): mmapped submission/completion rings
+struct uring
+{
+  int fd;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  unsigned sq_entries;
+  unsigned pending; /* sqes queued since the last io_uring_enter */
+};
+
+// One transfer driven by the io_uring engine. Packet seq lives in buffer
+// seq % URING_XFER_BUFS (or ring slot seq % SHM_RING_SLOTS for shm), reads may
+// complete out of order but packets go out strictly in seq order.
+struct uring_xfer
+{
+  int active;
+  pid_t client_pid;
+  int priority;
+  int weight; /* packets it may send per pass */
+  int fd;
+  int packet_size;
+  struct shm_ring *ring;
+  unsigned read_seq;  /* next packet to read */
+  unsigned send_seq;  /* next packet to send */
+  int reading;        /* reads in flight */
+  int eof_seen;       /* a short read came back, no more reads */
+  int done;           /* end marker sent, or client gone */
+  int state[URING_XFER_BUFS];
+  int len[URING_XFER_BUFS];
+  Mesg *bufs;         /* URING_XFER_BUFS staging packets for the queue */
+  unsigned long bytes;
+  struct timespec started;
+  struct timespec blocked_since;
+  int blocked;
+  int credits; /* packets the client still lets us queue, queue transport */
+  unsigned int sum; /* CRC32C of the packets sent so far */
+  int data_qid; /* private queue the packets go through, -1 for shm */
+  int gone;     /* client died, nobody will remove data_qid */
+};
 
 // Function prototypes
-int open_queue(key_t keyval);
-int read_message(int qid, long mtype, struct Mesg *imsg);
-int send_message(int qid, Mesg *omsg);
-void *clientThread(void *msg_qid);
-int client(int msg_qid, char *fname, int priority);
+void on_signal(int sig);
+int install_signals(void);
+void *clientThread(void *arg);
+int sink_open(struct sink *sink, const char *path, int direct, long long offset);
+void sink_prealloc(struct sink *sink, long long size);
+int sink_put(struct sink *sink, const char *data, int len);
+int sink_close(struct sink *sink);
+struct shm_ring *ring_create(pid_t client_pid);
+struct shm_ring *ring_attach(pid_t client_pid);
+Mesg *ring_reserve(struct shm_ring *ring, pid_t client_pid);
+int ring_recv(int msg_qid, struct shm_ring *ring, Mesg *imsg, Mesg **pkt, int timeout_ms);
+int client(int msg_qid, struct client_opts *opts);
+int client_ranged(int msg_qid, struct client_opts *opts);
+int client_spliced(int msg_qid, struct client_opts *opts);
+int read_full(int fd, char *buf, int len);
+int write_full(int fd, const char *buf, int len);
+int cache_init(size_t capacity);
+struct cache_entry *cache_lookup(const char *path, struct stat *st, int *fill);
+void cache_release(struct cache_entry *entry, int loaded);
+void cache_report(void);
+int src_open(struct xfer_src *src, const char *path);
+int src_readahead(struct xfer_src *src);
 int server_transfer_proc(int msg_qid, Mesg imsg);
-int server(int msg_qid);
+int sched_init(void);
+void sched_join(int priority);
+void sched_leave(struct worker_slot *slot);
+void sched_acquire(int bytes);
+void sched_idle(int idle);
+void dump_shares(void);
+int serve_stats(int msg_qid, pid_t client_pid, struct worker_stats *table, int n,
+                struct backlog *bl);
+int spawn_worker(int msg_qid, int slot);
+void worker_loop(int msg_qid, int slot);
+void reap_workers(int msg_qid);
+int uring_setup(struct uring *ur, unsigned entries);
+int uring_server(int msg_qid, int max_xfers);
+int admit_request(int msg_qid, struct backlog *bl, Mesg *imsg);
+int backlog_pump(int msg_qid, struct backlog *bl, int drain);
+int server(int msg_qid, int pool_size, int engine, size_t cache_bytes, int backlog);
+int request_shutdown(int msg_qid);
+int request_stats(int msg_qid);
+int client_async(struct client_opts *opts, int copies);
 int main(int argc, char *argv[]);
 
+// Cleared by SIGINT/SIGTERM, checked whenever a blocking receive is interrupted
+static volatile sig_atomic_t running = 1;
+// Set by SIGCHLD, tells the server to reap and respawn workers
+static volatile sig_atomic_t child_exited = 0;
+// Set by SIGUSR1, tells the server to print the per-client bandwidth shares
+static volatile sig_atomic_t dump_requested = 0;
+// Server/worker shared state, mapped before the pool is forked
+static struct srv_shared *shared = NULL;
+// This worker's own slot in shared, NULL outside pool workers
+static struct worker_slot *self = NULL;
+// Live counters of every pool worker, mapped before the pool is forked
+static struct worker_stats *stats_table = NULL;
+// This worker's own counters, NULL outside pool workers
+static struct worker_stats *my_stats = NULL;
+// When the server started, CMD_STATS uptime counts from here
+static struct timespec stats_epoch;
+// Hot-file cache shared by the pool, NULL when disabled
+static struct file_cache *cache = NULL;
+// Server -a: packets sized from the queue limits rather than the priority
+static int packet_autotune = 0;
+
+// Microseconds elapsed from a to b
+static long elapsed_us(struct timespec *a, struct timespec *b)
+{
+  return (b->tv_sec - a->tv_sec) * 1000000L + (b->tv_nsec - a->tv_nsec) / 1000L;
+}
+
 /*------------------------------------------------------------------------------------
-  --	FUNCTION:		open_queue
+  --	FUNCTION:		on_signal
   --
-  --	DATE:			    Mar 27, 2019
+  --	DATE:			    Oct 16, 2026
   --
-  --	REVISIONS:		Mar 27, 2019
+  --	REVISIONS:		Oct 16, 2026
+  --                Oct 16, 2026 - no timeout flag, mesgq_read moved to mesgq.c
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		void on_signal(int sig)
+  --                  int sig:      signal number delivered
+  --
+  --	RETURNS:		
+  --     
+  --	NOTES:
+  --		Signal handler shared by all modes. SIGALRM only has to interrupt a receive
+  --    (mesgq_read tells the timeout by the clock), SIGCHLD marks a worker exit,
+  --    SIGUSR1 asks for a share dump, anything else requests shutdown. The handler
+  --    only sets flags; the interrupted msgrcv returns EINTR and the caller decides
+  --    what to do.
+------------------------------------------------------------------------------------*/
+void on_signal(int sig)
+{
+  if (sig == SIGALRM)
+  {
+    return;
+  }
+  else if (sig == SIGCHLD)
+  {
+    child_exited = 1;
+  }
+  else if (sig == SIGUSR1)
+  {
+    dump_requested = 1;
+  }
+  else
+  {
+    running = 0;
+  }
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		install_signals
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
   --
   --	DESIGNERS:		Jacky Li
   --
   --	PROGRAMMER:		Jacky Li
   --
-  --	INTERFACE:		int open_queue(key_t keyval)
+  --	INTERFACE:		int install_signals(void)
   --
   --	RETURNS:		
-  --					qid   on successful creation of IPC message queue
+  --					 0    on success
   --          -1    on failure       
   --	NOTES:
-  --		Wrapper function for creating a system message queue
+  --		Installs on_signal for SIGINT, SIGTERM, SIGALRM, SIGUSR1 and SIGCHLD without
+  --    SA_RESTART, so a blocking msgrcv is woken up instead of being transparently
+  --    restarted.
 ------------------------------------------------------------------------------------*/
-int open_queue(key_t keyval)
+int install_signals(void)
 {
-  int qid;
-  if ((qid = msgget(keyval, IPC_CREAT | 0660)) == -1)
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = 0;
+  if (sigaction(SIGINT, &sa, NULL) == -1 ||
+      sigaction(SIGTERM, &sa, NULL) == -1 ||
+      sigaction(SIGALRM, &sa, NULL) == -1 ||
+      sigaction(SIGUSR1, &sa, NULL) == -1)
+  {
+    return -1;
+  }
+  sa.sa_flags = SA_NOCLDSTOP;
+  if (sigaction(SIGCHLD, &sa, NULL) == -1)
+  {
+    return -1;
+  }
+  return 0;
+}
+
+// Appends one LZ sequence to out at op: nlit literals, then a match of mlen bytes
+// offset back (mlen 0 for the closing literals-only sequence). The token holds
+// both lengths in a nibble each, 15 meaning more follow in 255 steps. Returns the
+// new end of the output, or -1 if it would not fit in cap.
+static int lz_sequence(unsigned char *out, int op, int cap, const unsigned char *lit,
+                       int nlit, int offset, int mlen)
+{
+  int ml = mlen - LZ_MIN_MATCH;
+  int token;
+  int n;
+  if (op + 1 + nlit / 255 + 1 + nlit + 2 + (ml > 0 ? ml : 0) / 255 + 1 > cap)
+  {
+    return -1;
+  }
+  token = op++;
+  out[token] = (nlit < 15 ? nlit : 15) << 4;
+  if (nlit >= 15)
+  {
+    for (n = nlit - 15; n >= 255; n -= 255)
+    {
+      out[op++] = 255;
+    }
+    out[op++] = n;
+  }
+  memcpy(out + op, lit, nlit);
+  op += nlit;
+  if (mlen == 0)
+  {
+    return op;
+  }
+  out[op++] = offset & 0xff;
+  out[op++] = offset >> 8;
+  out[token] |= ml < 15 ? ml : 15;
+  if (ml >= 15)
+  {
+    for (n = ml - 15; n >= 255; n -= 255)
+    {
+      out[op++] = 255;
+    }
+    out[op++] = n;
+  }
+  return op;
+}
+
+// LZ77 block compression in the LZ4 style: greedy matches found through a hash
+// of the next 4 bytes, no entropy stage, so it runs at memory speed. Compresses
+// src[start, end); matches may also reach back into the COMPRESS_WINDOW bytes
+// before start, which the decompressor must have just in front of its output.
+// Stale table entries are harmless, every candidate is checked against the
+// data, so the table is not cleared between calls. The step grows over runs
+// without a match, so incompressible data is skipped through quickly. Returns
+// the compressed length, or -1 if it does not fit in cap.
+static int lz_compress(const char *src, int start, int end, char *dst, int cap, int *table)
+{
+  const unsigned char *in = (const unsigned char *)src;
+  unsigned char *out = (unsigned char *)dst;
+  int limit = end - LZ_LAST_LITERALS - LZ_MIN_MATCH;
+  int ip = start;
+  int anchor = start;
+  int op = 0;
+  int ref;
+  int mlen;
+  unsigned int seq;
+  unsigned int hash;
+  while (ip < limit)
+  {
+    memcpy(&seq, in + ip, sizeof(seq));
+    hash = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+    ref = table[hash];
+    table[hash] = ip;
+    if (ref < 0 || ref >= ip || ip - ref > COMPRESS_WINDOW ||
+        memcmp(in + ref, in + ip, LZ_MIN_MATCH) != 0)
+    {
+      ip += 1 + ((ip - anchor) >> 6);
+      continue;
+    }
+    mlen = LZ_MIN_MATCH;
+    while (ip + mlen < end - LZ_LAST_LITERALS && in[ref + mlen] == in[ip + mlen])
+    {
+      ++mlen;
+    }
+    if ((op = lz_sequence(out, op, cap, in + anchor, ip - anchor, ip - ref, mlen)) == -1)
+    {
+      return -1;
+    }
+    ip += mlen;
+    anchor = ip;
+  }
+  return lz_sequence(out, op, cap, in + anchor, end - anchor, 0, 0);
+}
+
+// Reads a nibble length's continuation bytes. Returns -1 if they run off the end.
+static int lz_length(const unsigned char *in, int len, int *ip, int n)
+{
+  int b;
+  if (n < 15)
+  {
+    return n;
+  }
+  do
+  {
+    if (*ip >= len)
+    {
+      return -1;
+    }
+    b = in[(*ip)++];
+    n += b;
+  } while (b == 255);
+  return n;
+}
+
+// Undoes lz_compress, writing from dst[start] on; the bytes before it are the
+// window matches refer back to. Every length and offset is checked against both
+// buffers, so a damaged packet fails instead of reading or writing out of
+// bounds. Returns the raw length, or -1 if the block is malformed or does not
+// fit in cap (counted from dst).
+static int lz_decompress(const char *src, int len, char *dst, int start, int cap)
+{
+  const unsigned char *in = (const unsigned char *)src;
+  unsigned char *out = (unsigned char *)dst;
+  int ip = 0;
+  int op = start;
+  int token;
+  int offset;
+  int n;
+  while (ip < len)
+  {
+    token = in[ip++];
+    if ((n = lz_length(in, len, &ip, token >> 4)) == -1 || n > len - ip || n > cap - op)
+    {
+      return -1;
+    }
+    memcpy(out + op, in + ip, n);
+    ip += n;
+    op += n;
+    if (ip == len)
+    {
+      break; /* the closing literals */
+    }
+    if (len - ip < 2)
+    {
+      return -1;
+    }
+    offset = in[ip] | in[ip + 1] << 8;
+    ip += 2;
+    if ((n = lz_length(in, len, &ip, token & 15)) == -1)
+    {
+      return -1;
+    }
+    n += LZ_MIN_MATCH;
+    if (offset == 0 || offset > op || n > cap - op)
+    {
+      return -1;
+    }
+    if (offset >= n)
+    {
+      memcpy(out + op, out + op - offset, n);
+      op += n;
+    }
+    else
+    {
+      // Overlapping match: a repeat of the last offset bytes
+      for (; n > 0; --n, ++op)
+      {
+        out[op] = out[op - offset];
+      }
+    }
+  }
+  return op - start;
+}
+
+// Sleeps until *word moves away from seen, a signal arrives or timeout_ms passes
+static int ring_sleep(unsigned int *word, unsigned int seen, int *waiters, int timeout_ms)
+{
+  struct timespec ts;
+  int result = 0;
+  ts.tv_sec = timeout_ms / 1000;
+  ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+  __atomic_add_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(word, __ATOMIC_SEQ_CST) == seen)
+  {
+    result = syscall(SYS_futex, word, FUTEX_WAIT, seen, &ts, NULL, 0);
+  }
+  __atomic_sub_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+  return result;
+}
+
+// Moves a ring counter forward and wakes the other side only if it is asleep
+static void ring_advance(unsigned int *word, int *waiters)
+{
+  __atomic_add_fetch(word, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(waiters, __ATOMIC_SEQ_CST) > 0)
+  {
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+  }
+}
+
+// Unmaps a ring, and removes its name too when called by the client
+static void ring_close(struct shm_ring *ring, pid_t client_pid)
+{
+  char name[FILENAME_SIZE];
+  munmap(ring, sizeof(struct shm_ring));
+  if (client_pid == getpid())
+  {
+    snprintf(name, sizeof(name), SHM_NAME_FMT, client_pid);
+    shm_unlink(name);
+  }
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		ring_create
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		struct shm_ring *ring_create(pid_t client_pid)
+  --                 pid_t client_pid:      pid the ring is named after (the caller)
+  --
+  --	RETURNS:		
+  --					ring  mapped and empty, ready before the handshake is sent
+  --          NULL  on failure
+  --	NOTES:
+  --		Client side of the shared memory transport. A leftover segment from a dead
+  --    process that had the same pid is replaced.
+------------------------------------------------------------------------------------*/
+struct shm_ring *ring_create(pid_t client_pid)
+{
+  char name[FILENAME_SIZE];
+  struct shm_ring *ring;
+  int fd;
+  snprintf(name, sizeof(name), SHM_NAME_FMT, client_pid);
+  if ((fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0660)) == -1 && errno == EEXIST)
+  {
+    shm_unlink(name);
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0660);
+  }
+  if (fd == -1)
+  {
+    perror("shm_open");
+    return NULL;
+  }
+  if (ftruncate(fd, sizeof(struct shm_ring)) == -1)
+  {
+    perror("ftruncate");
+    close(fd);
+    shm_unlink(name);
+    return NULL;
+  }
+  ring = mmap(NULL, sizeof(struct shm_ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (ring == MAP_FAILED)
+  {
+    perror("mmap");
+    shm_unlink(name);
+    return NULL;
+  }
+  return ring;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		ring_attach
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		struct shm_ring *ring_attach(pid_t client_pid)
+  --                 pid_t client_pid:      pid of the requesting client
+  --
+  --	RETURNS:		
+  --					ring  mapped into this transfer worker
+  --          NULL  on failure
+  --	NOTES:
+  --		Server side of the shared memory transport. The name is unlinked as soon as
+  --    it is mapped, so the segment goes away with the last mapping even if the
+  --    client dies before cleaning up.
+------------------------------------------------------------------------------------*/
+struct shm_ring *ring_attach(pid_t client_pid)
+{
+  char name[FILENAME_SIZE];
+  struct shm_ring *ring;
+  int fd;
+  snprintf(name, sizeof(name), SHM_NAME_FMT, client_pid);
+  if ((fd = shm_open(name, O_RDWR, 0)) == -1)
+  {
+    perror("shm_open");
+    return NULL;
+  }
+  ring = mmap(NULL, sizeof(struct shm_ring), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  shm_unlink(name);
+  if (ring == MAP_FAILED)
+  {
+    perror("mmap");
+    return NULL;
+  }
+  return ring;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		ring_reserve
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		Mesg *ring_reserve(struct shm_ring *ring, pid_t client_pid)
+  --          struct shm_ring *ring:      ring to produce into
+  --               pid_t client_pid:      consumer, checked while the ring is full
+  --
+  --	RETURNS:		
+  --					slot  the next free slot, to be filled in place and then published
+  --                with ring_advance(&ring->head, &ring->head_waiters)
+  --          NULL  if the client went away while the ring was full
+  --	NOTES:
+  --		Sleeps on the tail futex while every slot is still unread.
+------------------------------------------------------------------------------------*/
+Mesg *ring_reserve(struct shm_ring *ring, pid_t client_pid)
+{
+  unsigned int head = ring->head;
+  unsigned int tail;
+  while (head - (tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) >= SHM_RING_SLOTS)
+  {
+    if (ring_sleep(&ring->tail, tail, &ring->tail_waiters, RING_WAIT_MS) == -1 &&
+        errno == ETIMEDOUT && kill(MESG_PID(client_pid), 0) == -1 && errno == ESRCH)
+    {
+      return NULL;
+    }
+  }
+  return &ring->slots[head % SHM_RING_SLOTS];
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		ring_recv
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int ring_recv(int msg_qid, struct shm_ring *ring, Mesg *imsg,
+  --                            Mesg **pkt, int timeout_ms)
+  --                     int msg_qid:      message queue id
+  --           struct shm_ring *ring:      ring to consume from
+  --                      Mesg *imsg:      buffer for a message arriving on the queue
+  --                      Mesg **pkt:      set to the packet to process
+  --                  int timeout_ms:      how long the ring may stay empty
+  --
+  --	RETURNS:		
+  --					 0    on success, *pkt is a ring slot (release it with
+  --                ring_advance(&ring->tail, &ring->tail_waiters)) or imsg
+  --          -1    on failure, errno ETIMEDOUT or EINTR like mesgq_read
+  --	NOTES:
+  --		Client side receive for the shared memory transport. Errors raised outside
+  --    the ring (worker could not attach it, worker crashed) still come back over
+  --    the queue, so the queue is polled each time a futex sleep times out.
+------------------------------------------------------------------------------------*/
+int ring_recv(int msg_qid, struct shm_ring *ring, Mesg *imsg, Mesg **pkt, int timeout_ms)
+{
+  unsigned int tail = ring->tail;
+  int waited = 0;
+  while (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail)
   {
-    return (-1);
+    if (ring_sleep(&ring->head, tail, &ring->head_waiters, RING_WAIT_MS) == -1)
+    {
+      if (errno == EINTR && !running)
+      {
+        return -1;
+      }
+      if (errno == ETIMEDOUT)
+      {
+        if (mesgq_read(msg_qid, getpid(), imsg, 0) != -1)
+        {
+          *pkt = imsg;
+          return 0;
+        }
+        if ((waited += RING_WAIT_MS) >= timeout_ms)
+        {
+          errno = ETIMEDOUT;
+          return -1;
+        }
+      }
+    }
+  }
+  *pkt = &ring->slots[tail % SHM_RING_SLOTS];
+  return 0;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		clientThread
+  --
+  --	DATE:			    Mar 27, 2019
+  --
+  --	REVISIONS:		Mar 27, 2019
+  --                Oct 16, 2026 - writes the received data out (sink thread)
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		void *clientThread(void *arg)
+  --                      void *arg:      the client's struct sink
+  --
+  --	RETURNS:		
+  --     
+  --	NOTES:
+  --		Client thread function
+  --    Blocks every signal so SIGALRM timeouts always land on the receiving thread.
+  --    Sleeps until the receiver hands over a full buffer, writes it with one
+  --    write_full and gives the buffer back, until sink_close says the transfer is
+  --    over. After a failed write it keeps releasing buffers without writing so the
+  --    receiver never stalls; the error is reported by sink_put/sink_close.
+  --    Full buffers go out at multiples of SINK_BUF_SIZE, so with O_DIRECT only the
+  --    final short buffer has to fall back to a buffered write.
+------------------------------------------------------------------------------------*/
+void *clientThread(void *arg)
+{
+  struct sink *sink = arg;
+  sigset_t all;
+  char *buf;
+  int len;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, NULL);
+  pthread_mutex_lock(&sink->lock);
+  while (1)
+  {
+    while (sink->written == sink->filled && !sink->closing)
+    {
+      pthread_cond_wait(&sink->cond, &sink->lock);
+    }
+    if (sink->written == sink->filled)
+    {
+      break;
+    }
+    buf = sink->mem + (size_t)(sink->written % SINK_BUFS) * SINK_BUF_SIZE;
+    len = sink->len[sink->written % SINK_BUFS];
+    pthread_mutex_unlock(&sink->lock);
+    if (sink->written == 0)
+    {
+      clock_gettime(CLOCK_MONOTONIC, &sink->started);
+    }
+    // Only the last buffer can be short; O_DIRECT cannot write its odd length
+    if (sink->direct && len % SINK_ALIGN != 0)
+    {
+      fcntl(sink->fd, F_SETFL, fcntl(sink->fd, F_GETFL) & ~O_DIRECT);
+    }
+    if (sink->error == 0 && write_full(sink->fd, buf, len) == -1)
+    {
+      sink->error = errno;
+    }
+    pthread_mutex_lock(&sink->lock);
+    sink->bytes += len;
+    ++sink->written;
+    pthread_cond_signal(&sink->cond);
+  }
+  pthread_mutex_unlock(&sink->lock);
+  return 0;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		sink_open
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int sink_open(struct sink *sink, const char *path, int direct,
+  --                              long long offset)
+  --              struct sink *sink:      sink to set up
+  --               const char *path:      output file, or "-" for stdout
+  --                     int direct:      try O_DIRECT for a file output
+  --               long long offset:      -1 to replace the file, or where in it
+  --                                       to write one range of a ranged fetch
+  --
+  --	RETURNS:		
+  --					 0    on success
+  --          -1    on failure to open the output or start clientThread
+  --	NOTES:
+  --		For "-" the original stdout becomes the data stream and stdout is pointed at
+  --    stderr, so the client's progress messages stay out of the data.
+  --    Buffers are SINK_ALIGN aligned and SINK_BUF_SIZE is a multiple of it, so
+  --    every full buffer is a legal O_DIRECT write at an aligned offset. A file
+  --    system that refuses O_DIRECT gets buffered writes instead.
+  --    A range sink leaves the rest of the file alone: it is neither truncated,
+  --    preallocated nor trimmed, since other clients write the other ranges.
+------------------------------------------------------------------------------------*/
+int sink_open(struct sink *sink, const char *path, int direct, long long offset)
+{
+  struct stat st;
+  int flags = O_WRONLY | O_CREAT | (offset < 0 ? O_TRUNC : 0);
+  memset(sink, 0, sizeof(struct sink));
+  sink->base = offset;
+  if (strcmp(path, "-") == 0)
+  {
+    if ((sink->fd = dup(STDOUT_FILENO)) == -1 || dup2(STDERR_FILENO, STDOUT_FILENO) == -1)
+    {
+      perror("stdout");
+      return -1;
+    }
+  }
+  else
+  {
+    sink->fd = -1;
+    if (direct && (sink->fd = open(path, flags | O_DIRECT, 0644)) == -1)
+    {
+      printf("O_DIRECT open of %s failed (%s), using buffered writes\n", path, strerror(errno));
+    }
+    if (sink->fd == -1 && (sink->fd = open(path, flags, 0644)) == -1)
+    {
+      perror(path);
+      return -1;
+    }
+    if (offset > 0 && lseek(sink->fd, offset, SEEK_SET) == -1)
+    {
+      perror(path);
+      close(sink->fd);
+      return -1;
+    }
+    sink->direct = (fcntl(sink->fd, F_GETFL) & O_DIRECT) != 0;
+    sink->regular = fstat(sink->fd, &st) == 0 && S_ISREG(st.st_mode);
+  }
+  if (posix_memalign((void **)&sink->mem, SINK_ALIGN, (size_t)SINK_BUFS * SINK_BUF_SIZE) != 0)
+  {
+    close(sink->fd);
+    return -1;
+  }
+  pthread_mutex_init(&sink->lock, NULL);
+  pthread_cond_init(&sink->cond, NULL);
+  if (pthread_create(&sink->thread, NULL, clientThread, sink) != 0)
+  {
+    perror("thread creation error");
+    free(sink->mem);
+    close(sink->fd);
+    return -1;
+  }
+  return 0;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		sink_prealloc
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		void sink_prealloc(struct sink *sink, long long size)
+  --              struct sink *sink:      open sink
+  --                 long long size:      file size from the server's CMD_FILEINFO
+  --
+  --	RETURNS:		
+  --     
+  --	NOTES:
+  --		Reserves the whole file up front so the writes never extend it block by
+  --    block and the data lands contiguously. Best effort: a file system without
+  --    fallocate just grows the file as it is written.
+------------------------------------------------------------------------------------*/
+void sink_prealloc(struct sink *sink, long long size)
+{
+  if (sink->regular && sink->base < 0 && size > 0 && fallocate(sink->fd, 0, 0, size) == -1)
+  {
+    perror("fallocate");
+  }
+}
+
+// Hands the buffer being filled to clientThread and waits until the next one is
+// free. Returns -1 once a write has failed.
+static int sink_handoff(struct sink *sink)
+{
+  pthread_mutex_lock(&sink->lock);
+  ++sink->filled;
+  pthread_cond_signal(&sink->cond);
+  while (sink->filled - sink->written == SINK_BUFS && sink->error == 0)
+  {
+    pthread_cond_wait(&sink->cond, &sink->lock);
+  }
+  pthread_mutex_unlock(&sink->lock);
+  sink->len[sink->filled % SINK_BUFS] = 0;
+  return sink->error != 0 ? -1 : 0;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		sink_put
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int sink_put(struct sink *sink, const char *data, int len)
+  --              struct sink *sink:      open sink
+  --               const char *data:      received payload
+  --                        int len:      its length
+  --
+  --	RETURNS:		
+  --					 0    on success
+  --          -1    if writing the output has failed
+  --	NOTES:
+  --		Called by the receiving thread for every packet. Only copies; the write()
+  --    happens on clientThread once a whole SINK_BUF_SIZE buffer is full, so the
+  --    receiver goes straight back to the queue.
+------------------------------------------------------------------------------------*/
+int sink_put(struct sink *sink, const char *data, int len)
+{
+  char *buf;
+  int *fill;
+  int n;
+  while (len > 0)
+  {
+    buf = sink->mem + (size_t)(sink->filled % SINK_BUFS) * SINK_BUF_SIZE;
+    fill = &sink->len[sink->filled % SINK_BUFS];
+    n = SINK_BUF_SIZE - *fill < len ? SINK_BUF_SIZE - *fill : len;
+    memcpy(buf + *fill, data, n);
+    *fill += n;
+    data += n;
+    len -= n;
+    if (*fill == SINK_BUF_SIZE && sink_handoff(sink) == -1)
+    {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		sink_close
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int sink_close(struct sink *sink)
+  --              struct sink *sink:      open sink
+  --
+  --	RETURNS:		
+  --					 0    on success, everything received has been written
+  --          -1    if a write failed
+  --	NOTES:
+  --		Hands over the partly filled buffer, waits for clientThread to drain and
+  --    exit, and closes the output. A file is trimmed to what was received (the
+  --    preallocation may be larger if the transfer was cut short) and fsynced
+  --    once, here, instead of per write. The sustained write rate reported runs
+  --    from the first write to the end of that fsync.
+------------------------------------------------------------------------------------*/
+int sink_close(struct sink *sink)
+{
+  struct timespec t_sync, t_done;
+  long total_us;
+  if (sink->len[sink->filled % SINK_BUFS] > 0)
+  {
+    sink_handoff(sink);
+  }
+  pthread_mutex_lock(&sink->lock);
+  sink->closing = 1;
+  pthread_cond_signal(&sink->cond);
+  pthread_mutex_unlock(&sink->lock);
+  pthread_join(sink->thread, NULL);
+  free(sink->mem);
+  clock_gettime(CLOCK_MONOTONIC, &t_sync);
+  if (sink->regular && sink->error == 0 &&
+      ((sink->base < 0 && ftruncate(sink->fd, sink->bytes) == -1) || fsync(sink->fd) == -1))
+  {
+    sink->error = errno;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t_done);
+  if (close(sink->fd) == -1 && sink->error == 0)
+  {
+    sink->error = errno;
+  }
+  if (sink->error != 0)
+  {
+    errno = sink->error;
+    perror("output");
+    return -1;
+  }
+  if (sink->bytes > 0)
+  {
+    total_us = elapsed_us(&sink->started, &t_done);
+    printf("output: %lu bytes in %ld ms, %.2f MB/s sustained (fsync %ld ms%s)\n", sink->bytes,
+           total_us / 1000, total_us > 0 ? sink->bytes / (double)total_us : 0.0,
+           elapsed_us(&t_sync, &t_done) / 1000, sink->direct ? ", O_DIRECT" : "");
+  }
+  return 0;
+}
+
+// Removes the private data queues of a transfer
+static void remove_queues(const int *qids, int n)
+{
+  int i;
+  for (i = 0; i < n; ++i)
+  {
+    msgctl(qids[i], IPC_RMID, NULL);
+  }
+}
+
+// Releases what client() set up. Returns -1 if the output could not be completed.
+static int client_finish(struct shm_ring *ring, struct sink *out, struct stripe_rx *rx,
+                         int nstripes)
+{
+  int i;
+  if (ring != NULL)
+  {
+    ring_close(ring, getpid());
+  }
+  for (i = 0; i < nstripes; ++i)
+  {
+    msgctl(rx[i].qid, IPC_RMID, NULL);
+  }
+  return out != NULL ? sink_close(out) : 0;
+}
+
+// Explains why a client receive gave up
+static void client_recv_failed(void)
+{
+  if (errno == ETIMEDOUT)
+  {
+    printf("no message from server in %d ms, giving up\n", RECV_TIMEOUT_MS);
+  }
+  else if (errno == EIDRM || errno == EINVAL)
+  {
+    printf("transfer aborted by the server\n");
+  }
+  else if (errno != EINTR)
+  {
+    perror("msgrcv");
+  }
+}
+
+// Sends a request to the listen mtype and waits for the first reply to it. A
+// CMD_BUSY is taken as a cue to ask again after the time it names (plus up to
+// half as much again, so clients turned away together do not all come back
+// together), BUSY_RETRIES times. Returns 0 with the reply in imsg (the last
+// CMD_BUSY if the server stayed busy), -2 if the request could not be sent, -3
+// if no reply came.
+static int client_request(int msg_qid, Mesg *omsg, Mesg *imsg)
+{
+  struct timespec delay;
+  unsigned int seed = getpid();
+  int tries = 0;
+  long ms;
+  while (1)
+  {
+    if (mesgq_send(msg_qid, omsg) == -1)
+    {
+      perror("msgsnd");
+      return -2;
+    }
+    while (mesgq_read(msg_qid, getpid(), imsg, RECV_TIMEOUT_MS) == -1)
+    {
+      if (errno != EINTR || !running)
+      {
+        client_recv_failed();
+        return -3;
+      }
+    }
+    if (imsg->mesg_cmd != CMD_BUSY || tries++ == BUSY_RETRIES || !running)
+    {
+      return 0;
+    }
+    ms = imsg->mesg_count + rand_r(&seed) % (imsg->mesg_count / 2 + 1);
+    printf("server busy, asking again in %ld ms\n", ms);
+    delay.tv_sec = ms / 1000;
+    delay.tv_nsec = (ms % 1000) * 1000000;
+    nanosleep(&delay, NULL);
+  }
+}
+
+// Lets the worker behind a queue transfer send n more packets. Never blocks: with
+// the queue full the grant fails with EAGAIN and is retried, as this client has
+// to keep draining its own packets for space to appear.
+static int client_grant(int msg_qid, pid_t worker_pid, int n)
+{
+  Mesg cmsg;
+  cmsg.mtype = worker_pid;
+  cmsg.pid = getpid();
+  cmsg.mesg_cmd = CMD_CREDIT;
+  cmsg.mesg_flags = 0;
+  cmsg.mesg_seq = 0;
+  cmsg.mesg_crc = 0;
+  cmsg.mesg_sum = 0;
+  cmsg.mesg_offset = 0;
+  cmsg.mesg_count = 0;
+  cmsg.mesg_priority = 0;
+  cmsg.mesg_len = sizeof(int);
+  memcpy(cmsg.mesg_data, &n, sizeof(int));
+  while (msgsnd(msg_qid, &cmsg, MESGHDRSIZE + cmsg.mesg_len, IPC_NOWAIT) == -1)
+  {
+    if (errno != EINTR)
+    {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Takes in the CMD_FILEINFO that starts each file of a transfer, done bytes into
+// the output. Returns 1 if the file's packets follow, 0 if the server could not
+// send it (a batch then goes on with the next file).
+static int client_file_info(Mesg *msg, struct file_info *info, struct sink *out,
+                            unsigned long done)
+{
+  const char *path = msg->mesg_data + sizeof(*info);
+  memcpy(info, msg->mesg_data, sizeof(*info));
+  if (info->files > 1 && info->status != 0)
+  {
+    printf("file %d/%d %s: %s\n", info->index + 1, info->files, path, strerror(info->status));
+    return 0;
+  }
+  if (info->files > 1)
+  {
+    printf("file %d/%d %s: %lld bytes\n", info->index + 1, info->files, path, info->size);
+  }
+  else
+  {
+    printf("file size: %lld bytes, packet %d, %d data queues, window %d\n", info->size,
+           info->packet_size, info->stripes, info->window);
+  }
+  // Growing the reservation file by file costs more than it saves
+  if (out != NULL && info->files == 1)
+  {
+    sink_prealloc(out, done + info->size);
+  }
+  return 1;
+}
+
+// Next packet of a message: the whole payload, or with MESG_F_PACKED the record
+// at *off, which is moved past it. Returns 1 with the packet's data, length and
+// checksum, 0 when the message has no more, -1 if a record overruns it.
+static int client_record(Mesg *pkt, int *off, const char **data, int *len, unsigned int *crc)
+{
+  struct packet_rec rec;
+  if (!(pkt->mesg_flags & MESG_F_PACKED))
+  {
+    if (*off == -1)
+    {
+      return 0;
+    }
+    // mesg_len, not strlen: payloads are binary and not NUL terminated
+    *data = pkt->mesg_data;
+    *len = pkt->mesg_len;
+    *crc = pkt->mesg_crc;
+    *off = -1;
+    return 1;
+  }
+  if (*off == pkt->mesg_len)
+  {
+    return 0;
+  }
+  if (pkt->mesg_len - *off < (int)sizeof(rec))
+  {
+    return -1;
+  }
+  memcpy(&rec, pkt->mesg_data + *off, sizeof(rec));
+  *off += sizeof(rec);
+  if (rec.len < 0 || rec.len > pkt->mesg_len - *off)
+  {
+    return -1;
+  }
+  *data = pkt->mesg_data + *off;
+  *len = rec.len;
+  *crc = rec.crc;
+  *off += rec.len;
+  return 1;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		client
+  --
+  --	DATE:			    Mar 27, 2019
+  --
+  --	REVISIONS:		Mar 27, 2019
+  --                Oct 16, 2026 - optional shared memory ring transport
+  --                Oct 16, 2026 - output through the sink thread
+  --                Oct 16, 2026 - file size reply, preallocated output
+  --                Oct 16, 2026 - credit window for queue transfers
+  --                Oct 16, 2026 - striped queue transfers
+  --                Oct 16, 2026 - batched multi-file requests
+  --                Oct 16, 2026 - byte range requests
+  --                Oct 16, 2026 - compressed packets
+  --                Oct 16, 2026 - CRC32C checks
+  --                Oct 16, 2026 - credit window suggested by the server
+  --                Oct 16, 2026 - retry after a busy reply
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int client(int msg_qid, struct client_opts *opts)
+  --                     int msg_qid:      message queue id
+  --     struct client_opts *opts:      file to query from server, priority of
+  --                                       the request, transport (0 for the
+  --                                       message queue, MESG_F_SHM for the shared
+  --                                       memory ring), output file ("-" for
+  --                                       stdout, empty to only count it), O_DIRECT
+  --                                       output, credit window, stripes and
+  --                                       compression
+  --
+  --	RETURNS:		
+  --					 0    on success
+  --          -1    on failure of thread creation or to open the output
+  --          -2    on failure to send over initial connect message to server       
+  --          -3    on receive failure, server timeout or shutdown signal
+  --          -4    on failure to write the output
+  --          -5    if the server reported an error instead of the file, or
+  --                stayed busy
+  --          -6    if some files of a batch could not be sent
+  --          -7    if a packet or a file failed its CRC32C check, or a file
+  --                came short of its announced size
+  --	NOTES:
+  --		Client function to be run by this program when specified to be in client mode
+  --      (1) Will send to a server process with pre-defined IPC channel
+  --          - Init message, with 
+  --              (1) this process ID
+  --              (2) Priority for the server to allocate resources to this request
+  --              (3) a filename that the server will send over
+  --      (2) Wait for the server's CMD_FILEINFO reply (or an error) on the queue and
+  --          preallocate the output to the announced size. A CMD_BUSY reply means
+  --          the server had no room for the request: it is sent again after the
+  --          time the reply names, up to BUSY_RETRIES times
+  --      (3) Wait for the message queue to be populated with mtype = this process ID
+  --          (or for the shared memory ring, created before the request, to fill)
+  --          Queue transfers read a private queue named in the file info reply and
+  --          remove it when done; the shared queue is only used for the handshake
+  --          With opts->stripes the reply names several queues: packet seq is
+  --          read from queue seq % stripes, each with its own credit window, and
+  --          every packet's mesg_seq is checked against the count so far
+  --          A batch request (opts->batch) names several files, or a manifest on
+  --          the server. Each file starts with its own CMD_FILEINFO (the first over
+  --          the shared queue, the rest on the data path after the previous end
+  --          marker) carrying its path and status, and ends with its own end
+  --          marker; the files are written to the output back to back. A file the
+  --          server could not open is reported and skipped. Credit then runs a
+  --          window ahead of what has been read, across file boundaries, so the
+  --          server can move on to the next file without waiting for a reply.
+  --          With opts->count >= 0 only that many bytes from opts->offset are
+  --          asked for, and written at that offset of the output (this is how
+  --          client_ranged's children fetch their segments).
+  --          With opts->compress the server may send MESG_F_LZ packets; each is
+  --          decompressed as it comes, against the file's last COMPRESS_WINDOW
+  --          bytes, before it goes to the sink, and checked to come out at the
+  --          length it announces.
+  --          With opts->coalesce the server may pack small packets into
+  --          MESG_F_PACKED messages, info.records to a message; the packets are
+  --          taken out one by one, each checked and written as if it had come
+  --          alone, while seq and credit count the messages.
+  --          Every packet's payload is checked against its CRC32C, which ends
+  --          the transfer if it fails, and each file's data against the CRC32C
+  --          its end marker carries, which is reported and counted, as is a
+  --          file that ends short of the size its file info announced. A file
+  --          the server failed to read ends in an error message instead.
+  --      (4) Each packet is copied into the sink's current buffer; clientThread
+  --          writes full buffers out while this thread keeps receiving
+  --          Over the queue the server may only have opts->window packets
+  --          outstanding (0: the window the file info suggests); credits are
+  --          handed back to the worker (mtype = its pid, from the file info
+  --          reply) in half-window batches as packets are drained, and never
+  --          past the packets the file still has, so no grant is left behind in
+  --          the queue.
+  --      (5) Will keep reading for the same mtype until server sends message with 
+  --          Priority == -1, then this process will die. If the output fails the
+  --          rest of the transfer is still received (and dropped) so the server
+  --          is not left sending to a queue nobody reads.
+  --      Reports the wake-up latency seen by the blocking receive: time from the
+  --      request to the first packet, and the average/max wait per packet.
+------------------------------------------------------------------------------------*/
+int client(int msg_qid, struct client_opts *opts)
+{
+  // Req: Create thread
+  struct sink sink;
+  struct sink *out = NULL;
+  if (opts->outname[0] != '\0')
+  {
+    if (sink_open(&sink, opts->outname, opts->direct, opts->count >= 0 ? opts->offset : -1) == -1)
+    {
+      return -1;
+    }
+    out = &sink;
+  }
+
+  // The ring has to exist before the server hears about it
+  struct shm_ring *ring = NULL;
+  struct stripe_rx rx[STRIPES_MAX]; /* private queues of a queue transfer, from the file info reply */
+  int nstripes = 0;
+  if (opts->transport == MESG_F_SHM && (ring = ring_create(getpid())) == NULL)
+  {
+    client_finish(NULL, out, rx, nstripes);
+    return -1;
+  }
+
+  // Reads filename from stdin
+  Mesg omsg;
+  // Prep First init message to be sent
+  omsg.mtype = LISTEN_MSG;
+  if (opts->batch == MESG_F_BATCH)
+  {
+    // The last name's NUL is left to check_framing
+    memcpy(omsg.mesg_data, opts->names, opts->names_len);
+    omsg.mesg_len = opts->names_len - 1;
+  }
+  else
+  {
+    strcpy(omsg.mesg_data, opts->fname);
+    omsg.mesg_len = strlen(opts->fname);
+  }
+  omsg.mesg_priority = opts->priority;
+  omsg.pid = getpid();
+  omsg.mesg_cmd = CMD_FETCH;
+  omsg.mesg_flags = opts->transport | opts->batch | (opts->stripes << MESG_STRIPE_SHIFT) |
+                    (opts->count >= 0 ? MESG_F_RANGE : 0) | opts->compress | opts->coalesce;
+  omsg.mesg_seq = 0;
+  omsg.mesg_crc = 0;
+  omsg.mesg_sum = 0;
+  omsg.mesg_offset = opts->offset;
+  omsg.mesg_count = opts->count;
+
+  // Writes filename to IPC channel
+  printf("string to be sent to %d, length: %d\n", msg_qid, omsg.mesg_len);
+  struct timespec t_req, t_wait, t_recv;
+  Mesg imsg;
+  int result;
+  clock_gettime(CLOCK_MONOTONIC, &t_req);
+  printf("Client sending: pid:%d\n", omsg.pid);
+  // The first reply always comes over the queue, even for shm: the file size,
+  // or an error end message
+  if ((result = client_request(msg_qid, &omsg, &imsg)) != 0)
+  {
+    client_finish(ring, out, rx, nstripes);
+    return result;
+  }
+
+  // Starts reading from server
+  Mesg *pkt = &imsg;
+  unsigned long num_msg = 0;
+  unsigned long file_msg = 0; /* packets of the current file, its next seq */
+  unsigned long complete_msg = 0;
+  unsigned long total_bytes_recv = 0;
+  unsigned long file_bytes = 0; /* of the current file */
+  unsigned long curr_bytes_recv = 0;
+  int out_failed = 0;
+  long first_us = 0;
+  long wait_us = 0;
+  long total_wait_us = 0;
+  long max_wait_us = 0;
+  struct file_info info;
+  pid_t worker_pid;
+  struct stripe_rx *cur = NULL;
+  long long packets;
+  long long limit;
+  int i;
+  int expect_info;  /* next message is the file info of the next file in the batch */
+  int failed = 0;   /* files of the batch the server could not send */
+  int done;
+  int owing;        /* some stripe has credits it could not deliver yet */
+  int stalled = 0;  /* ms spent retrying them */
+  char window[COMPRESS_BUF_SIZE]; /* with opts->compress: the file's last bytes, then
+                                     the packet */
+  int window_len = 0;
+  const char *data;
+  int len;
+  unsigned long packed_msg = 0;
+  unsigned long num_pkt = 0; /* packets, several to a message when coalesced */
+  int rec_off;
+  int records;
+  unsigned int crc;
+  unsigned long long wire_bytes = 0; /* payload bytes received, compressed or not */
+  unsigned int sum = 0; /* CRC32C of the current file's data */
+  int corrupt = 0;      /* files whose checksum did not match */
+  if (imsg.mesg_cmd != CMD_FILEINFO || imsg.mesg_len < (int)sizeof(info))
+  {
+    printf("server error: %.*s\n", imsg.mesg_len, imsg.mesg_data);
+    client_finish(ring, out, rx, nstripes);
+    return -5;
+  }
+  worker_pid = imsg.pid;
+  memcpy(&info, imsg.mesg_data, sizeof(info));
+  nstripes = info.stripes < 0 ? 0 : (info.stripes > STRIPES_MAX ? STRIPES_MAX : info.stripes);
+  // Without -k, run as many packets ahead as the server sized the queue for
+  if (opts->window == 0)
+  {
+    opts->window = info.window > 0 && info.window <= CREDIT_WINDOW_MAX ? info.window
+                                                                       : CREDIT_WINDOW_DEFAULT;
+  }
+  // Every full packet plus the short (possibly empty) last one, dealt out round
+  // robin. A batch's credit just runs a window ahead of each queue's reader.
+  packets = info.size / (info.packet_size > 0 ? info.packet_size : 1) + 1;
+  if (info.records > 1)
+  {
+    packets = (packets + info.records - 1) / info.records;
+  }
+  for (i = 0; i < nstripes; ++i)
+  {
+    rx[i].qid = info.data_qids[i];
+    rx[i].packets = packets > i ? (packets - i + nstripes - 1) / nstripes : 0;
+    rx[i].received = 0;
+    rx[i].granted = 0;
+    rx[i].owed = rx[i].packets < opts->window && !opts->batch ? rx[i].packets : opts->window;
+    rx[i].consumed = 0;
+  }
+  if (ring == NULL && nstripes == 0)
+  {
+    printf("server error: no data queue\n");
+    client_finish(ring, out, rx, nstripes);
+    return -5;
+  }
+  expect_info = !client_file_info(&imsg, &info, out, 0);
+  failed += expect_info;
+  done = expect_info && info.index + 1 >= info.files;
+  while (!done)
+  {
+    owing = 0;
+    for (i = 0; i < nstripes; ++i)
+    {
+      if (rx[i].owed == 0)
+      {
+        continue;
+      }
+      if (client_grant(rx[i].qid, worker_pid, rx[i].owed) == 0)
+      {
+        rx[i].granted += rx[i].owed;
+        rx[i].owed = 0;
+        stalled = 0;
+      }
+      else if (errno == EAGAIN)
+      {
+        owing = 1;
+      }
+      else
+      {
+        perror("credit");
+        client_finish(ring, out, rx, nstripes);
+        return -2;
+      }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t_wait);
+    if (ring != NULL)
+    {
+      result = ring_recv(msg_qid, ring, &imsg, &pkt, RECV_TIMEOUT_MS);
+    }
+    else
+    {
+      // Stripes hold packets in seq order, so the next one is at the head of its
+      // queue; the file info of the next file of a batch follows on the first
+      cur = &rx[expect_info ? 0 : file_msg % nstripes];
+      result = mesgq_read(cur->qid, (long)getpid(), &imsg, owing ? RING_WAIT_MS : RECV_TIMEOUT_MS);
+    }
+    if (result == -1)
+    {
+      if (errno == EINTR && running)
+      {
+        continue;
+      }
+      if (errno == ETIMEDOUT && owing && (stalled += RING_WAIT_MS) < RECV_TIMEOUT_MS)
+      {
+        continue;
+      }
+      client_recv_failed();
+      client_finish(ring, out, rx, nstripes);
+      return -3;
+    }
+    else
+    {
+      clock_gettime(CLOCK_MONOTONIC, &t_recv);
+      wait_us = elapsed_us(&t_wait, &t_recv);
+      total_wait_us += wait_us;
+      if (wait_us > max_wait_us)
+      {
+        max_wait_us = wait_us;
+      }
+      if (num_msg == 0)
+      {
+        first_us = elapsed_us(&t_req, &t_recv);
+      }
+      if (pkt->mesg_flags & MESG_F_ERROR)
+      {
+        printf("server error: %.*s\n", pkt->mesg_len, pkt->mesg_data);
+        client_finish(ring, out, rx, nstripes);
+        return -5;
+      }
+      if (pkt->mesg_cmd == CMD_FILEINFO ? !expect_info || pkt->mesg_len < (int)sizeof(info)
+                                        : expect_info || pkt->mesg_seq != (unsigned int)file_msg)
+      {
+        printf("unexpected message from server: cmd %d, seq %u, expected %s %lu\n",
+               pkt->mesg_cmd, pkt->mesg_seq, expect_info ? "file info" : "packet", file_msg);
+        client_finish(ring, out, rx, nstripes);
+        return -3;
+      }
+      if (pkt->mesg_cmd == CMD_FILEINFO)
+      {
+        expect_info = !client_file_info(pkt, &info, out, total_bytes_recv);
+        failed += expect_info;
+        done = expect_info && info.index + 1 >= info.files;
+        file_msg = 0;
+        file_bytes = 0;
+        window_len = 0;
+      }
+      else
+      {
+        ++num_msg;
+        ++file_msg;
+        // A packed message holds several packets, each taken as if it had come
+        // alone; its mesg_seq and credit count it as one
+        rec_off = 0;
+        records = 0;
+        while ((result = client_record(pkt, &rec_off, &data, &len, &crc)) == 1)
+        {
+          ++records;
+          ++num_pkt;
+          wire_bytes += len;
+          if (mesgq_crc32c(0, data, len) != crc)
+          {
+            printf("packet %lu failed its checksum\n",
+                   (file_msg - 1) * (info.records > 1 ? info.records : 1) + records - 1);
+            client_finish(ring, out, rx, nstripes);
+            return -7;
+          }
+          if (opts->compress)
+          {
+            // Every packet, compressed or not, is part of the window
+            if (window_len > COMPRESS_BUF_SIZE - COMPRESS_SPAN_MAX)
+            {
+              memmove(window, window + window_len - COMPRESS_WINDOW, COMPRESS_WINDOW);
+              window_len = COMPRESS_WINDOW;
+            }
+            if (!(pkt->mesg_flags & MESG_F_LZ))
+            {
+              memcpy(window + window_len, data, len);
+            }
+            else if ((len = lz_decompress(data, len, window, window_len, sizeof(window))) == -1 ||
+                     len != pkt->mesg_count)
+            {
+              printf("corrupt compressed packet %lu\n", file_msg - 1);
+              client_finish(ring, out, rx, nstripes);
+              return -3;
+            }
+            else
+            {
+              ++packed_msg;
+            }
+            data = window + window_len;
+            window_len += len;
+          }
+          sum = pkt->mesg_flags & MESG_F_LZ ? mesgq_crc32c(sum, data, len)
+                                            : mesgq_crc32c_combine(sum, crc, len);
+          total_bytes_recv += len;
+          file_bytes += len;
+          if (out != NULL && !out_failed && len > 0 && sink_put(out, data, len) == -1)
+          {
+            out_failed = 1;
+          }
+          curr_bytes_recv += len;
+          if (curr_bytes_recv >= MAXMESSAGEDATA)
+          {
+            ++complete_msg;
+            printf("inc buffer filled: %lu\n", complete_msg);
+            curr_bytes_recv = curr_bytes_recv - MAXMESSAGEDATA;
+          }
+        }
+        if (result == -1 || ((pkt->mesg_flags & MESG_F_PACKED) && records != pkt->mesg_count))
+        {
+          printf("corrupt packed message %lu\n", file_msg - 1);
+          client_finish(ring, out, rx, nstripes);
+          return -3;
+        }
+        // The end marker closes the file; in a batch the next file info follows
+        if (pkt->mesg_priority < 0)
+        {
+          expect_info = 1;
+          done = info.index + 1 >= info.files;
+          if (sum != pkt->mesg_sum)
+          {
+            printf("checksum mismatch: crc32c %08x, server sent %08x\n", sum, pkt->mesg_sum);
+            ++corrupt;
+          }
+          else if ((long long)file_bytes < info.size)
+          {
+            // The file shrank while it was sent; the sum only covers what came
+            printf("transfer cut short: %lu of %lld bytes\n", file_bytes, info.size);
+            ++corrupt;
+          }
+          else if (info.files == 1)
+          {
+            printf("checksum ok: crc32c %08x\n", sum);
+          }
+          sum = 0;
+        }
+        if (ring == NULL)
+        {
+          ++cur->received;
+          if (++cur->consumed >= (opts->window + 1) / 2)
+          {
+            // A file that grew since the size was sent keeps getting credit (only
+            // unstriped: a striped transfer sends exactly the packets announced)
+            limit = opts->batch || (nstripes == 1 && cur->received >= cur->packets)
+                        ? cur->received + opts->window
+                        : cur->packets;
+            if (cur->granted + cur->owed < limit)
+            {
+              cur->owed += limit - cur->granted - cur->owed < cur->consumed
+                               ? limit - cur->granted - cur->owed
+                               : cur->consumed;
+            }
+            cur->consumed = 0;
+          }
+        }
+      }
+      if (pkt != &imsg)
+      {
+        ring_advance(&ring->tail, &ring->tail_waiters);
+      }
+    }
+  }
+  printf("Srv end msg, totalbrecv: %ld totalmsg: %ld\n", total_bytes_recv, num_msg);
+  if (num_pkt > num_msg)
+  {
+    printf("coalesced: %lu packets in %lu messages\n", num_pkt, num_msg);
+  }
+  printf("wake-up latency: first msg %ld us, avg wait %ld us, max wait %ld us\n",
+         first_us, num_msg > 0 ? total_wait_us / (long)num_msg : 0L, max_wait_us);
+  if (packed_msg > 0)
+  {
+    printf("compression: %llu bytes received for %lu (%llu%%), %lu packets compressed\n",
+           wire_bytes, total_bytes_recv,
+           total_bytes_recv > 0 ? wire_bytes * 100 / total_bytes_recv : 0ULL, packed_msg);
+  }
+  if (info.files > 1)
+  {
+    printf("batch: %d files, %d failed\n", info.files, failed);
+  }
+  if (client_finish(ring, out, rx, nstripes) == -1 || out_failed)
+  {
+    return -4;
+  }
+  if (corrupt > 0)
+  {
+    return -7;
+  }
+  return failed > 0 ? -6 : 0;
+}
+
+// Removes a client_spliced FIFO and its private directory
+static void fifo_remove(const char *dir, const char *name)
+{
+  unlink(name);
+  rmdir(dir);
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		client_spliced
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int client_spliced(int msg_qid, struct client_opts *opts)
+  --                     int msg_qid:      message queue id
+  --     struct client_opts *opts:      as for client, with transport MESG_F_PIPE
+  --                                       (a single file, not striped, not
+  --                                       compressed)
+  --
+  --	RETURNS:		
+  --					 0    on success
+  --          -1    on failure to set up the FIFO or open the output
+  --          -2    on failure to send over initial connect message to server
+  --          -3    on receive failure, server timeout, shutdown signal or a
+  --                transfer that came up short
+  --          -4    on failure to write the output
+  --          -5    if the server reported an error instead of the file
+  --	NOTES:
+  --		Bulk counterpart to the queue transports. Before asking, it makes a FIFO
+  --    in a directory of its own (mkdtemp of FIFO_DIR_TEMPLATE, so nobody else
+  --    can put anything at the name), opens the read end and asks for PIPE_SIZE
+  --    of capacity. The FIFO's path follows the filename in the request. The
+  --    request and the file info reply go over the queue as usual, the FIFO and
+  --    its directory are then removed, and the file's bytes are
+  --    spliced from the FIFO into the output (a file, "-" for stdout, or
+  --    /dev/null to only count), PIPE_CHUNK at a time, so they never enter user
+  --    space at either end. An output that takes no splice (a terminal) gets
+  --    read/write instead. End of file on the FIFO ends the data; the server's
+  --    end marker on the queue then has to account for every byte, or bring the
+  --    error that cut the transfer short. No CRC32C is kept on this path.
+  --    A file output is preallocated, trimmed and fsynced like the sink does.
+------------------------------------------------------------------------------------*/
+int client_spliced(int msg_qid, struct client_opts *opts)
+{
+  char dir[] = FIFO_DIR_TEMPLATE;
+  char name[sizeof(dir) + sizeof(FIFO_NAME)];
+  struct file_info info;
+  struct pollfd pfd;
+  struct stat st;
+  struct timespec t_start, t_wait, t_now;
+  Mesg omsg;
+  Mesg imsg;
+  char *buf = NULL; /* only for an output splice refuses */
+  long long total = 0;
+  long chunks = 0;
+  long first_us = -1;
+  long wait_us;
+  long total_wait_us = 0;
+  long max_wait_us = 0;
+  int regular = 0;
+  int result = 0;
+  int fifo;
+  int out;
+  ssize_t n;
+  if (mkdtemp(dir) == NULL)
+  {
+    perror(dir);
+    return -1;
+  }
+  snprintf(name, sizeof(name), "%s/" FIFO_NAME, dir);
+  if (mkfifo(name, 0600) == -1 || (fifo = open(name, O_RDONLY | O_NONBLOCK)) == -1)
+  {
+    perror(name);
+    fifo_remove(dir, name);
+    return -1;
+  }
+  if (fcntl(fifo, F_SETPIPE_SZ, PIPE_SIZE) == -1)
+  {
+    perror("F_SETPIPE_SZ");
+  }
+  if (opts->outname[0] == '\0')
+  {
+    out = open("/dev/null", O_WRONLY);
+  }
+  else if (strcmp(opts->outname, "-") == 0)
+  {
+    // Like the sink: stdout becomes the data, messages move to stderr
+    if ((out = dup(STDOUT_FILENO)) != -1 && dup2(STDERR_FILENO, STDOUT_FILENO) == -1)
+    {
+      close(out);
+      out = -1;
+    }
+  }
+  else if ((out = open(opts->outname, O_WRONLY | O_CREAT | O_TRUNC, 0644)) != -1)
+  {
+    regular = fstat(out, &st) == 0 && S_ISREG(st.st_mode);
+  }
+  if (out == -1)
+  {
+    perror(opts->outname);
+    close(fifo);
+    fifo_remove(dir, name);
+    return -1;
+  }
+
+  omsg.mtype = LISTEN_MSG;
+  // "<file>\0<fifo>", the FIFO's NUL left to check_framing
+  strcpy(omsg.mesg_data, opts->fname);
+  strcpy(omsg.mesg_data + strlen(opts->fname) + 1, name);
+  omsg.mesg_len = strlen(opts->fname) + 1 + strlen(name);
+  omsg.mesg_priority = opts->priority;
+  omsg.pid = getpid();
+  omsg.mesg_cmd = CMD_FETCH;
+  omsg.mesg_flags = MESG_F_PIPE | (opts->count >= 0 ? MESG_F_RANGE : 0);
+  omsg.mesg_seq = 0;
+  omsg.mesg_crc = 0;
+  omsg.mesg_sum = 0;
+  omsg.mesg_offset = opts->offset;
+  omsg.mesg_count = opts->count;
+  clock_gettime(CLOCK_MONOTONIC, &t_start);
+  result = client_request(msg_qid, &omsg, &imsg);
+  // Both ends are open once the reply is here (or nobody will open it now)
+  fifo_remove(dir, name);
+  if (result == 0 && (imsg.mesg_cmd != CMD_FILEINFO || imsg.mesg_len < (int)sizeof(info)))
+  {
+    printf("server error: %.*s\n", imsg.mesg_len, imsg.mesg_data);
+    result = -5;
+  }
+  if (result == 0)
+  {
+    memcpy(&info, imsg.mesg_data, sizeof(info));
+    printf("file size: %lld bytes, spliced through a %d byte FIFO\n", info.size,
+           fcntl(fifo, F_GETPIPE_SZ));
+    if (regular && info.size > 0 && fallocate(out, 0, 0, info.size) == -1)
+    {
+      perror("fallocate");
+    }
+  }
+
+  pfd.fd = fifo;
+  pfd.events = POLLIN;
+  while (result == 0)
+  {
+    clock_gettime(CLOCK_MONOTONIC, &t_wait);
+    if ((n = poll(&pfd, 1, RECV_TIMEOUT_MS)) <= 0)
+    {
+      if (n == 0)
+      {
+        printf("no data from server in %d ms, giving up\n", RECV_TIMEOUT_MS);
+        result = -3;
+      }
+      else if (errno != EINTR || !running)
+      {
+        perror("poll");
+        result = -3;
+      }
+      continue;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t_now);
+    wait_us = elapsed_us(&t_wait, &t_now);
+    if (first_us < 0)
+    {
+      first_us = elapsed_us(&t_start, &t_now);
+    }
+    total_wait_us += wait_us;
+    max_wait_us = wait_us > max_wait_us ? wait_us : max_wait_us;
+    if (buf == NULL)
+    {
+      n = splice(fifo, NULL, out, NULL, PIPE_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (n == -1 && errno == EINVAL && (buf = malloc(PIPE_CHUNK)) != NULL)
+      {
+        continue;
+      }
+    }
+    else if ((n = read(fifo, buf, PIPE_CHUNK)) > 0 && write_full(out, buf, n) == -1)
+    {
+      n = -1;
+    }
+    if (n == -1 && (errno == EAGAIN || errno == EINTR))
+    {
+      continue;
+    }
+    if (n == -1)
+    {
+      perror("splice");
+      result = -4;
+    }
+    else if (n == 0)
+    {
+      break;
+    }
+    total += n;
+    ++chunks;
+  }
+  close(fifo);
+  free(buf);
+
+  // The end marker, or the error that ended the data early
+  while (result == 0 && mesgq_read(msg_qid, getpid(), &imsg, RECV_TIMEOUT_MS) == -1)
+  {
+    if (errno != EINTR || !running)
+    {
+      client_recv_failed();
+      result = -3;
+    }
+  }
+  if (result == 0 && (imsg.mesg_flags & MESG_F_ERROR))
+  {
+    printf("server error: %.*s\n", imsg.mesg_len, imsg.mesg_data);
+    result = -5;
+  }
+  else if (result == 0 && imsg.mesg_count != total)
+  {
+    printf("transfer cut short: %lld of %lld bytes\n", total, imsg.mesg_count);
+    result = -3;
+  }
+  if (first_us >= 0)
+  {
+    printf("Srv end msg, totalbrecv: %lld totalmsg: %ld\n", total, chunks);
+    printf("wake-up latency: first msg %ld us, avg wait %ld us, max wait %ld us\n", first_us,
+           chunks > 0 ? total_wait_us / chunks : 0L, max_wait_us);
+  }
+  if (regular && (ftruncate(out, total) == -1 || fsync(out) == -1) && result == 0)
+  {
+    perror(opts->outname);
+    result = -4;
+  }
+  if (close(out) == -1 && result == 0)
+  {
+    result = -4;
+  }
+  return result;
+}
+
+// Progress of a ranged fetch, kept in <output>.part: "<size> <mtime> <segment size>
+// <output dev> <output inode>" on the first line, then one '0' or '1' per segment,
+// each flipped in place once that segment's child has written and fsynced it.
+struct range_part
+{
+  long long size;
+  long long mtime;
+  long long seg_size;
+  unsigned long long out_dev; /* the output the segments went to; its own mtime */
+  unsigned long long out_ino; /* moves with every segment, so it is not kept */
+  int nsegs;
+  char *done;
+  int fd;
+  off_t map_off; /* where the '0'/'1' string starts */
+};
+
+// Picks up the progress of an interrupted fetch of the same file, or starts anew
+// (replacing the output). Progress only counts while the output it was written
+// to is still there at full size; a removed, replaced or truncated output starts
+// the fetch over. Returns the number of segments already done, or -1.
+static int range_part_open(struct range_part *part, const char *outname, struct file_info *info,
+                           int clients)
+{
+  char path[FILENAME_SIZE + sizeof(RANGE_PART_SUFFIX)];
+  char head[160];
+  FILE *fp;
+  struct stat st;
+  long long size, mtime, seg_size;
+  unsigned long long out_dev, out_ino;
+  int resumed = 0;
+  int fd;
+  int i;
+  snprintf(path, sizeof(path), "%s%s", outname, RANGE_PART_SUFFIX);
+  part->size = info->size;
+  part->mtime = info->mtime;
+  part->done = NULL;
+  part->fd = -1;
+  if ((fp = fopen(path, "r")) != NULL)
+  {
+    if (fscanf(fp, "%lld %lld %lld %llu %llu\n", &size, &mtime, &seg_size, &out_dev,
+               &out_ino) == 5 &&
+        size == info->size && mtime == info->mtime && seg_size > 0 &&
+        stat(outname, &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= info->size &&
+        (unsigned long long)st.st_dev == out_dev && (unsigned long long)st.st_ino == out_ino)
+    {
+      part->out_dev = out_dev;
+      part->out_ino = out_ino;
+      part->seg_size = seg_size;
+      part->nsegs = (size + seg_size - 1) / seg_size;
+      if ((part->done = calloc(part->nsegs + 1, 1)) != NULL &&
+          fread(part->done, 1, part->nsegs, fp) == (size_t)part->nsegs)
+      {
+        resumed = 1;
+      }
+    }
+    fclose(fp);
+  }
+  if (!resumed)
+  {
+    // Whole sink buffers, so every segment starts O_DIRECT aligned
+    seg_size = info->size / ((long long)clients * RANGE_SEGMENTS_PER_CLIENT) + 1;
+    part->seg_size = (seg_size + SINK_BUF_SIZE - 1) / SINK_BUF_SIZE * SINK_BUF_SIZE;
+    part->nsegs = (info->size + part->seg_size - 1) / part->seg_size;
+    free(part->done);
+    if ((part->done = calloc(part->nsegs + 1, 1)) == NULL)
+    {
+      return -1;
+    }
+    memset(part->done, '0', part->nsegs);
+    if ((fd = open(outname, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1 || fstat(fd, &st) == -1)
+    {
+      perror(outname);
+      if (fd != -1)
+      {
+        close(fd);
+      }
+      return -1;
+    }
+    part->out_dev = st.st_dev;
+    part->out_ino = st.st_ino;
+    // Full size up front, so a resume can tell a truncated output from this one
+    if (info->size > 0 && fallocate(fd, 0, 0, info->size) == -1 &&
+        ftruncate(fd, info->size) == -1)
+    {
+      perror("fallocate");
+    }
+    close(fd);
+  }
+  snprintf(head, sizeof(head), "%lld %lld %lld %llu %llu\n", part->size, part->mtime,
+           part->seg_size, part->out_dev, part->out_ino);
+  part->map_off = strlen(head);
+  if ((part->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1 ||
+      write_full(part->fd, head, part->map_off) == -1 ||
+      write_full(part->fd, part->done, part->nsegs) == -1)
+  {
+    perror(path);
+    return -1;
+  }
+  for (i = 0, resumed = 0; i < part->nsegs; ++i)
+  {
+    resumed += part->done[i] == '1';
+  }
+  return resumed;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		client_ranged
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int client_ranged(int msg_qid, struct client_opts *opts)
+  --                     int msg_qid:      message queue id
+  --     struct client_opts *opts:      as for client; opts->ranges is the number of
+  --                                       segments fetched at once, opts->outname
+  --                                       a regular file
+  --
+  --	RETURNS:		
+  --					 0    on success
+  --          -1    on failure to set up the output or its progress file
+  --          -2    on failure to send the size request
+  --          -3    if some segments failed or the fetch was interrupted (run it
+  --                again to resume)
+  --          -5    if the server reported an error instead of the size
+  --	NOTES:
+  --		Fetches one file as byte ranges served by separate pool workers. A CMD_STAT
+  --    gets the size, which is cut into about RANGE_SEGMENTS_PER_CLIENT segments
+  --    per client. Up to opts->ranges forked children each run an ordinary client()
+  --    for one MESG_F_RANGE request, writing their segment in place (see
+  --    sink_open); a finished child starts the next pending segment. Each child has
+  --    its own pid and therefore its own replies, data queue, credit and SIGALRM.
+  --    Completed segments are recorded in <output>.part, so after a failure or
+  --    Ctrl-C the same command fetches only the missing ones, as long as the file's
+  --    size and mtime are unchanged and the output is still the full-size file the
+  --    segments went to. The progress file goes once every segment is in.
+------------------------------------------------------------------------------------*/
+int client_ranged(int msg_qid, struct client_opts *opts)
+{
+  Mesg omsg;
+  Mesg imsg;
+  struct file_info info;
+  struct range_part part;
+  struct client_opts child;
+  struct timespec t_start, t_end;
+  pid_t pids[RANGE_CLIENTS_MAX];
+  pid_t pid;
+  int segs[RANGE_CLIENTS_MAX];
+  int status;
+  int result;
+  int nrunning = 0;
+  int next = 0;
+  int failed = 0;
+  int resumed;
+  int fd;
+  int i;
+  long took_us;
+  char path[FILENAME_SIZE + sizeof(RANGE_PART_SUFFIX)];
+
+  clock_gettime(CLOCK_MONOTONIC, &t_start);
+  memset(&omsg, 0, offsetof(Mesg, mesg_data));
+  omsg.mtype = LISTEN_MSG;
+  omsg.pid = getpid();
+  omsg.mesg_cmd = CMD_STAT;
+  omsg.mesg_priority = opts->priority;
+  strcpy(omsg.mesg_data, opts->fname);
+  omsg.mesg_len = strlen(opts->fname);
+  if ((result = client_request(msg_qid, &omsg, &imsg)) != 0)
+  {
+    return result;
+  }
+  if (imsg.mesg_cmd != CMD_FILEINFO || imsg.mesg_len < (int)sizeof(info))
+  {
+    printf("server error: %.*s\n", imsg.mesg_len, imsg.mesg_data);
+    return -5;
+  }
+  memcpy(&info, imsg.mesg_data, sizeof(info));
+  if (info.status != 0)
+  {
+    printf("server error: %s: %s\n", opts->fname, strerror(info.status));
+    return -5;
+  }
+  if ((resumed = range_part_open(&part, opts->outname, &info, opts->ranges)) == -1)
+  {
+    if (part.fd != -1)
+    {
+      close(part.fd);
+    }
+    free(part.done);
+    return -1;
+  }
+  printf("file size: %lld bytes, %d segments of %lld, %d already done\n", info.size,
+         part.nsegs, part.seg_size, resumed);
+
+  child = *opts;
+  while (running || nrunning > 0)
+  {
+    while (running && nrunning < opts->ranges && next < part.nsegs)
+    {
+      if (part.done[next] == '1')
+      {
+        ++next;
+        continue;
+      }
+      child.offset = (long long)next * part.seg_size;
+      child.count = info.size - child.offset < part.seg_size ? info.size - child.offset
+                                                             : part.seg_size;
+      // Children inherit stdout's buffer, so it is flushed before each fork
+      fflush(stdout);
+      if ((pid = fork()) == -1)
+      {
+        perror("fork");
+        break;
+      }
+      if (pid == 0)
+      {
+        exit(client(msg_qid, &child) == 0 ? 0 : 1);
+      }
+      pids[nrunning] = pid;
+      segs[nrunning++] = next++;
+    }
+    if (nrunning == 0)
+    {
+      break;
+    }
+    if ((pid = waitpid(-1, &status, 0)) == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      perror("waitpid");
+      break;
+    }
+    for (i = 0; i < nrunning && pids[i] != pid; ++i)
+    {
+    }
+    if (i == nrunning)
+    {
+      continue;
+    }
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+    {
+      part.done[segs[i]] = '1';
+      if (pwrite(part.fd, "1", 1, part.map_off + segs[i]) != 1)
+      {
+        perror("progress");
+      }
+    }
+    else
+    {
+      printf("segment %d (%lld bytes from %lld) failed\n", segs[i], part.seg_size,
+             (long long)segs[i] * part.seg_size);
+      ++failed;
+    }
+    pids[i] = pids[nrunning - 1];
+    segs[i] = segs[--nrunning];
+  }
+  close(part.fd);
+  for (i = 0, next = 0; i < part.nsegs; ++i)
+  {
+    next += part.done[i] == '1';
+  }
+  free(part.done);
+  if (next < part.nsegs)
+  {
+    printf("%d of %d segments missing (%d failed), run again to resume\n", part.nsegs - next,
+           part.nsegs, failed);
+    return -3;
+  }
+  // All in: trim anything a previous, larger file left and make it durable
+  if ((fd = open(opts->outname, O_WRONLY)) == -1 || ftruncate(fd, info.size) == -1 ||
+      fsync(fd) == -1)
+  {
+    perror(opts->outname);
+    if (fd != -1)
+    {
+      close(fd);
+    }
+    return -1;
+  }
+  close(fd);
+  snprintf(path, sizeof(path), "%s%s", opts->outname, RANGE_PART_SUFFIX);
+  unlink(path);
+  clock_gettime(CLOCK_MONOTONIC, &t_end);
+  took_us = elapsed_us(&t_start, &t_end);
+  printf("ranged fetch: %lld bytes in %ld ms, %.2f MB/s, %d clients, %d segments resumed\n",
+         info.size, took_us / 1000, took_us > 0 ? info.size / (double)took_us : 0.0,
+         opts->ranges, resumed);
+  return 0;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		read_full
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int read_full(int fd, char *buf, int len)
+  --                          int fd:      file to read from
+  --                       char *buf:      destination buffer
+  --                         int len:      number of bytes wanted
+  --
+  --	RETURNS:		
+  --					n     bytes read, less than len only at end of file
+  --          -1    on read error
+  --	NOTES:
+  --		read() may return short counts (signals, pipes, large requests); this keeps
+  --    reading until the buffer is full or the file ends.
+------------------------------------------------------------------------------------*/
+int read_full(int fd, char *buf, int len)
+{
+  int got = 0;
+  ssize_t n;
+  while (got < len)
+  {
+    if ((n = read(fd, buf + got, len - got)) == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return -1;
+    }
+    if (n == 0)
+    {
+      break;
+    }
+    got += n;
+  }
+  return got;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		write_full
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int write_full(int fd, const char *buf, int len)
+  --                          int fd:      file to write to
+  --                 const char *buf:      data
+  --                         int len:      number of bytes to write
+  --
+  --	RETURNS:		
+  --					len   on success
+  --          -1    on write error
+  --	NOTES:
+  --		Counterpart of read_full: retries short writes (pipes, signals) until the
+  --    whole buffer is out.
+------------------------------------------------------------------------------------*/
+int write_full(int fd, const char *buf, int len)
+{
+  int put = 0;
+  ssize_t n;
+  while (put < len)
+  {
+    if ((n = write(fd, buf + put, len - put)) == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return -1;
+    }
+    put += n;
+  }
+  return put;
+}
+
+// Takes the cache lock, recovering it if a worker died holding it
+static void cache_lock(void)
+{
+  if (pthread_mutex_lock(&cache->lock) == EOWNERDEAD)
+  {
+    pthread_mutex_consistent(&cache->lock);
+  }
+}
+
+// Drops an unpinned entry and gives its arena space back. Lock held.
+static void cache_drop(struct cache_entry *entry)
+{
+  cache->used -= entry->size;
+  entry->state = CACHE_FREE;
+  entry->path[0] = '\0';
+}
+
+// Finds size bytes of free arena, evicting least recently used unpinned entries
+// until a gap is big enough. Lock held. Returns 0 and the offset, or -1.
+static int cache_alloc(size_t size, size_t *offset)
+{
+  struct cache_entry *used[CACHE_ENTRIES];
+  struct cache_entry *victim;
+  size_t end;
+  size_t next;
+  int nused;
+  int i;
+  int j;
+  while (1)
+  {
+    // Occupied regions sorted by offset, then the first gap that fits
+    nused = 0;
+    for (i = 0; i < CACHE_ENTRIES; ++i)
+    {
+      if (cache->entries[i].state != CACHE_FREE)
+      {
+        for (j = nused; j > 0 && used[j - 1]->offset > cache->entries[i].offset; --j)
+        {
+          used[j] = used[j - 1];
+        }
+        used[j] = &cache->entries[i];
+        ++nused;
+      }
+    }
+    end = 0;
+    for (i = 0; i <= nused; ++i)
+    {
+      next = i < nused ? used[i]->offset : cache->capacity;
+      if (next - end >= size)
+      {
+        *offset = end;
+        return 0;
+      }
+      if (i < nused)
+      {
+        end = used[i]->offset + used[i]->size;
+      }
+    }
+    victim = NULL;
+    for (i = 0; i < nused; ++i)
+    {
+      if (used[i]->state == CACHE_READY && used[i]->refs == 0 &&
+          (victim == NULL || used[i]->last_used < victim->last_used))
+      {
+        victim = used[i];
+      }
+    }
+    if (victim == NULL)
+    {
+      return -1;
+    }
+    printf("cache evict %s (%ld bytes)\n", victim->path, (long)victim->size);
+    cache_drop(victim);
+    ++cache->evictions;
+  }
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		cache_init
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int cache_init(size_t capacity)
+  --                 size_t capacity:      arena size in bytes
+  --
+  --	RETURNS:		
+  --					 0    on success
+  --          -1    on failure
+  --	NOTES:
+  --		Maps the hot-file cache shared by the worker pool. Must run before the
+  --    workers are forked. Arena pages are only backed once files are loaded.
+------------------------------------------------------------------------------------*/
+int cache_init(size_t capacity)
+{
+  pthread_mutexattr_t mattr;
+  cache = mmap(NULL, sizeof(struct file_cache) + capacity, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (cache == MAP_FAILED)
+  {
+    cache = NULL;
+    return -1;
+  }
+  memset(cache, 0, sizeof(struct file_cache));
+  cache->capacity = capacity;
+  pthread_mutexattr_init(&mattr);
+  pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+  if (pthread_mutex_init(&cache->lock, &mattr) != 0)
+  {
+    pthread_mutexattr_destroy(&mattr);
+    munmap(cache, sizeof(struct file_cache) + capacity);
+    cache = NULL;
+    return -1;
+  }
+  pthread_mutexattr_destroy(&mattr);
+  return 0;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		cache_lookup
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		struct cache_entry *cache_lookup(const char *path, struct stat *st,
+  --                                                 int *fill)
+  --                const char *path:      requested file
+  --                 struct stat *st:      its current stat, to spot a changed file
+  --                       int *fill:      set to 1 when the caller must load it
+  --
+  --	RETURNS:		
+  --					entry pinned; ready to copy from if *fill is 0, otherwise reserved for
+  --                the caller to read the file into and publish with cache_release
+  --          NULL  not served from the cache (too big, no room, or another worker
+  --                is still loading it); read the file instead
+  --	NOTES:
+  --		An entry whose size or mtime no longer matches the file is invalidated. If
+  --    transfers still pin it, it is only unlisted and freed by the last of them.
+------------------------------------------------------------------------------------*/
+struct cache_entry *cache_lookup(const char *path, struct stat *st, int *fill)
+{
+  struct cache_entry *entry = NULL;
+  struct cache_entry *slot = NULL;
+  struct cache_entry *e;
+  size_t offset;
+  int i;
+  *fill = 0;
+  if (cache == NULL || !S_ISREG(st->st_mode) || st->st_size == 0 ||
+      (size_t)st->st_size > cache->capacity / CACHE_FILE_FRACTION ||
+      strlen(path) >= FILENAME_SIZE)
+  {
+    return NULL;
+  }
+  cache_lock();
+  for (i = 0; i < CACHE_ENTRIES && entry == NULL; ++i)
+  {
+    e = &cache->entries[i];
+    if (e->state == CACHE_FREE)
+    {
+      slot = slot != NULL ? slot : e;
+      continue;
+    }
+    if (strcmp(e->path, path) != 0)
+    {
+      continue;
+    }
+    if (e->state == CACHE_LOADING)
+    {
+      ++cache->misses;
+      pthread_mutex_unlock(&cache->lock);
+      return NULL;
+    }
+    if (e->size == st->st_size && e->mtime.tv_sec == st->st_mtim.tv_sec &&
+        e->mtime.tv_nsec == st->st_mtim.tv_nsec)
+    {
+      entry = e;
+      continue;
+    }
+    // Stale: the file changed since it was cached
+    ++cache->invalidations;
+    e->path[0] = '\0';
+    if (e->refs == 0)
+    {
+      cache_drop(e);
+      slot = slot != NULL ? slot : e;
+    }
+  }
+  if (entry != NULL)
+  {
+    ++cache->hits;
+    ++entry->refs;
+    entry->last_used = ++cache->clock;
+    pthread_mutex_unlock(&cache->lock);
+    return entry;
+  }
+  ++cache->misses;
+  if (slot == NULL || cache_alloc(st->st_size, &offset) == -1)
+  {
+    pthread_mutex_unlock(&cache->lock);
+    return NULL;
+  }
+  slot->state = CACHE_LOADING;
+  slot->refs = 1;
+  strcpy(slot->path, path);
+  slot->size = st->st_size;
+  slot->mtime = st->st_mtim;
+  slot->offset = offset;
+  slot->last_used = ++cache->clock;
+  cache->used += slot->size;
+  pthread_mutex_unlock(&cache->lock);
+  *fill = 1;
+  return slot;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		cache_release
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		void cache_release(struct cache_entry *entry, int loaded)
+  --      struct cache_entry *entry:      entry from cache_lookup
+  --                     int loaded:      for an entry being filled, 1 publishes it
+  --                                      and keeps the pin, 0 abandons it; -1 just
+  --                                      drops the pin
+  --
+  --	RETURNS:		
+  --     
+  --	NOTES:
+  --		Finishes a load and/or unpins an entry. An entry invalidated while pinned
+  --    is freed when its last user lets go.
+------------------------------------------------------------------------------------*/
+void cache_release(struct cache_entry *entry, int loaded)
+{
+  cache_lock();
+  if (entry->state == CACHE_LOADING && loaded == 0)
+  {
+    cache_drop(entry);
+  }
+  else if (entry->state == CACHE_LOADING && loaded == 1)
+  {
+    entry->state = CACHE_READY;
+  }
+  if (loaded != 1 && entry->refs > 0)
+  {
+    --entry->refs;
+  }
+  if (entry->state == CACHE_READY && entry->refs == 0 && entry->path[0] == '\0')
+  {
+    cache_drop(entry);
+  }
+  pthread_mutex_unlock(&cache->lock);
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		cache_report
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		void cache_report(void)
+  --
+  --	RETURNS:		
+  --     
+  --	NOTES:
+  --		Prints the cache counters. Run by the server on SIGUSR1 and at shutdown.
+------------------------------------------------------------------------------------*/
+void cache_report(void)
+{
+  if (cache == NULL)
+  {
+    return;
+  }
+  cache_lock();
+  printf("cache: %lu hits, %lu misses, %lu evictions, %lu invalidations, %zu/%zu bytes used\n",
+         cache->hits, cache->misses, cache->evictions, cache->invalidations,
+         cache->used, cache->capacity);
+  pthread_mutex_unlock(&cache->lock);
+  fflush(stdout);
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		src_open
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int src_open(struct xfer_src *src, const char *path)
+  --          struct xfer_src *src:      source to set up
+  --              const char *path:      requested file
+  --
+  --	RETURNS:		
+  --					 0    on success
+  --          -1    if the file cannot be opened
+  --	NOTES:
+  --		Picks where a transfer reads from. A cache hit needs no open or read at
+  --    all. On a cacheable miss the whole file is read into the arena once and
+  --    this transfer is served from there as well; if that read comes up short
+  --    (the file changed under us) the entry is abandoned and the file streamed.
+  --    A streamed file is marked for sequential access, so the kernel reads
+  --    ahead further.
+------------------------------------------------------------------------------------*/
+int src_open(struct xfer_src *src, const char *path)
+{
+  struct stat st;
+  int fill;
+  src->fd = -1;
+  src->mem = NULL;
+  src->pos = 0;
+  src->limit = -1;
+  src->entry = NULL;
+  src->ra = NULL;
+  if (stat(path, &st) == -1)
+  {
+    return -1;
+  }
+  src->size = st.st_size;
+  src->mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  src->entry = cache_lookup(path, &st, &fill);
+  if (src->entry != NULL && !fill)
+  {
+    src->mem = cache->arena + src->entry->offset;
+    return 0;
+  }
+  if ((src->fd = open(path, O_RDONLY)) == -1)
+  {
+    if (src->entry != NULL)
+    {
+      cache_release(src->entry, 0);
+      src->entry = NULL;
+    }
+    return -1;
+  }
+  if (src->entry != NULL)
+  {
+    if (read_full(src->fd, cache->arena + src->entry->offset, src->size) == src->size)
+    {
+      cache_release(src->entry, 1);
+      src->mem = cache->arena + src->entry->offset;
+      close(src->fd);
+      src->fd = -1;
+      return 0;
+    }
+    cache_release(src->entry, 0);
+    src->entry = NULL;
+    lseek(src->fd, 0, SEEK_SET);
+  }
+  posix_fadvise(src->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  return 0;
+}
+
+// Narrows a source to count bytes from off (all the rest if count < 0), clipped
+// to the file as it was opened
+static void src_range(struct xfer_src *src, long long off, long long count)
+{
+  if (off < 0 || off > src->size)
+  {
+    off = off < 0 ? 0 : src->size;
+  }
+  if (count < 0 || count > src->size - off)
+  {
+    count = src->size - off;
+  }
+  src->pos = off;
+  src->limit = off + count;
+  if (src->fd != -1)
+  {
+    lseek(src->fd, off, SEEK_SET);
+  }
+}
+
+// Bytes the transfer will deliver, as announced in the file info
+static long long src_bytes(struct xfer_src *src)
+{
+  return src->limit >= 0 ? src->limit - src->pos : src->size;
+}
+
+// Body of a transfer's reader thread: keeps every read-ahead buffer full, one
+// read_full each, until the range or the file ends, a read fails or the
+// transfer closes it. Blocks every signal, so SIGALRM timeouts always land on
+// the sending thread.
+static void *readahead_thread(void *arg)
+{
+  struct readahead *ra = arg;
+  sigset_t all;
+  char *buf;
+  int len;
+  int n;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, NULL);
+  pthread_mutex_lock(&ra->lock);
+  while (1)
+  {
+    while (ra->filled - ra->taken == READAHEAD_BUFS && !ra->closing)
+    {
+      pthread_cond_wait(&ra->cond, &ra->lock);
+    }
+    if (ra->closing)
+    {
+      break;
+    }
+    pthread_mutex_unlock(&ra->lock);
+    buf = ra->mem + (size_t)(ra->filled % READAHEAD_BUFS) * READAHEAD_BUF_SIZE;
+    len = ra->remaining >= 0 && ra->remaining < READAHEAD_BUF_SIZE ? ra->remaining
+                                                                   : READAHEAD_BUF_SIZE;
+    n = len > 0 ? read_full(ra->fd, buf, len) : 0;
+    pthread_mutex_lock(&ra->lock);
+    if (n == -1)
+    {
+      ra->error = errno;
+    }
+    else if (n > 0)
+    {
+      ra->len[ra->filled % READAHEAD_BUFS] = n;
+      ++ra->filled;
+      if (ra->remaining >= 0)
+      {
+        ra->remaining -= n;
+      }
+    }
+    pthread_cond_signal(&ra->cond);
+    if (n < len || n <= 0)
+    {
+      ra->eof = 1;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&ra->lock);
+  return 0;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		src_readahead
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int src_readahead(struct xfer_src *src)
+  --          struct xfer_src *src:      source opened (and narrowed) for a transfer
+  --
+  --	RETURNS:		
+  --					 0    if a reader thread now runs ahead of the transfer
+  --          -1    if the source is read inline (cached, small, or no thread)
+  --	NOTES:
+  --		Splits reading a streamed file from sending it: a reader thread keeps up to
+  --    READAHEAD_BUFS buffers of READAHEAD_BUF_SIZE filled ahead of the sender, so
+  --    the disk keeps working while a send waits for queue room or client credit,
+  --    and the queue keeps filling while a read waits for the disk. src_read then
+  --    copies out of those buffers. Sources in the cache, or too small to gain,
+  --    are left as they are, as are the shared sources of striped senders, which
+  --    pread at their own offsets. Stopped by src_close.
+------------------------------------------------------------------------------------*/
+int src_readahead(struct xfer_src *src)
+{
+  struct readahead *ra;
+  sigset_t all, old;
+  int result;
+  if (src->fd == -1 || src_bytes(src) < READAHEAD_MIN || (ra = calloc(1, sizeof(*ra))) == NULL)
+  {
+    return -1;
+  }
+  if ((ra->mem = malloc((size_t)READAHEAD_BUFS * READAHEAD_BUF_SIZE)) == NULL)
+  {
+    free(ra);
+    return -1;
+  }
+  ra->fd = src->fd;
+  ra->remaining = src->limit >= 0 ? src->limit - src->pos : -1;
+  pthread_mutex_init(&ra->lock, NULL);
+  pthread_cond_init(&ra->cond, NULL);
+  posix_fadvise(src->fd, src->pos, 0, POSIX_FADV_WILLNEED);
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  result = pthread_create(&ra->thread, NULL, readahead_thread, ra);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (result != 0)
+  {
+    printf("read-ahead thread create failed\n");
+    free(ra->mem);
+    free(ra);
+    return -1;
+  }
+  src->ra = ra;
+  return 0;
+}
+
+// Copies the next len bytes out of the read-ahead buffers, waiting for the
+// reader when they run dry. Returns fewer only once the reader has stopped, and
+// -1 (errno set) if its read failed before anything was copied.
+static int readahead_copy(struct readahead *ra, char *buf, int len)
+{
+  int got = 0;
+  int n;
+  char *from;
+  while (got < len)
+  {
+    if (!ra->holding)
+    {
+      pthread_mutex_lock(&ra->lock);
+      while (ra->taken == ra->filled && !ra->eof)
+      {
+        pthread_cond_wait(&ra->cond, &ra->lock);
+      }
+      ra->holding = ra->taken != ra->filled;
+      pthread_mutex_unlock(&ra->lock);
+      if (!ra->holding)
+      {
+        if (ra->error != 0 && got == 0)
+        {
+          errno = ra->error;
+          return -1;
+        }
+        break;
+      }
+    }
+    from = ra->mem + (size_t)(ra->taken % READAHEAD_BUFS) * READAHEAD_BUF_SIZE;
+    n = ra->len[ra->taken % READAHEAD_BUFS] - ra->off;
+    n = n < len - got ? n : len - got;
+    memcpy(buf + got, from + ra->off, n);
+    got += n;
+    ra->off += n;
+    if (ra->off == ra->len[ra->taken % READAHEAD_BUFS])
+    {
+      ra->off = 0;
+      ra->holding = 0;
+      pthread_mutex_lock(&ra->lock);
+      ++ra->taken;
+      pthread_cond_signal(&ra->cond);
+      pthread_mutex_unlock(&ra->lock);
+    }
+  }
+  return got;
+}
+
+// Next len bytes of the transfer (fewer only at the end), from memory or the file.
+// Past what the reader thread fetched the file is read directly, so a transfer
+// still follows a file that grew after the reader hit its end. A read error gives
+// -1 even if some bytes were had, as the transfer cannot go on past it.
+static int src_read(struct xfer_src *src, char *buf, int len)
+{
+  int n;
+  int got = 0;
+  if (src->limit >= 0 && len > src->limit - src->pos)
+  {
+    len = src->limit - src->pos;
+  }
+  if (src->ra != NULL)
+  {
+    if ((got = readahead_copy(src->ra, buf, len)) == -1)
+    {
+      return -1;
+    }
+    src->pos += got;
+    buf += got;
+    len -= got;
+    if (len == 0)
+    {
+      return got;
+    }
+    // Short of the end only because the reader failed: not to be taken for EOF
+    if (src->ra->error != 0)
+    {
+      errno = src->ra->error;
+      return -1;
+    }
+  }
+  if (src->mem == NULL)
+  {
+    if ((n = read_full(src->fd, buf, len)) == -1)
+    {
+      return -1;
+    }
+    src->pos += n;
+    return got + n;
+  }
+  if (len > src->size - src->pos)
+  {
+    len = src->size - src->pos;
+  }
+  memcpy(buf, src->mem + src->pos, len);
+  src->pos += len;
+  return len;
+}
+
+// len bytes of the transfer from offset off (fewer only at the end). Leaves the
+// read position alone, so the sender threads of a striped transfer can share a src.
+static int src_pread(struct xfer_src *src, char *buf, int len, off_t off)
+{
+  int got = 0;
+  int n;
+  if (src->limit >= 0 && len > src->limit - off)
+  {
+    len = off < src->limit ? src->limit - off : 0;
+  }
+  if (src->mem == NULL)
+  {
+    while (got < len && (n = pread(src->fd, buf + got, len - got, off + got)) != 0)
+    {
+      if (n == -1)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        return -1;
+      }
+      got += n;
+    }
+    return got;
+  }
+  if (off >= src->size)
+  {
+    return 0;
+  }
+  if (len > src->size - off)
+  {
+    len = src->size - off;
+  }
+  memcpy(buf, src->mem + off, len);
+  return len;
+}
+
+// Unpins the cache entry or closes the file, stopping its reader thread first
+static void src_close(struct xfer_src *src)
+{
+  if (src->entry != NULL)
+  {
+    cache_release(src->entry, -1);
+  }
+  if (src->ra != NULL)
+  {
+    pthread_mutex_lock(&src->ra->lock);
+    src->ra->closing = 1;
+    pthread_cond_signal(&src->ra->cond);
+    pthread_mutex_unlock(&src->ra->lock);
+    pthread_join(src->ra->thread, NULL);
+    pthread_mutex_destroy(&src->ra->lock);
+    pthread_cond_destroy(&src->ra->cond);
+    free(src->ra->mem);
+    free(src->ra);
+    src->ra = NULL;
+  }
+  if (src->fd != -1)
+  {
+    close(src->fd);
+  }
+}
+
+// Drops whatever is still queued for a client that has gone away, so its packets
+// do not take up the shared queue for good
+static void purge_client(int msg_qid, pid_t client_pid)
+{
+  Mesg dead;
+  while (mesgq_read(msg_qid, client_pid, &dead, 0) != -1)
+  {
+  }
+}
+
+// Once the end marker is out, waits for the client to remove the private data
+// queue, which it does after reading everything, or to die. Either way the caller
+// can then remove it without pulling it from under a client still reading.
+static void linger_data_queue(int data_qid, pid_t client_pid)
+{
+  Mesg stale;
+  while (mesgq_read(data_qid, getpid(), &stale, RING_WAIT_MS) != -1 || errno == EINTR ||
+         (errno == ETIMEDOUT && (kill(MESG_PID(client_pid), 0) == 0 || errno != ESRCH)))
+  {
+  }
+}
+
+// Blocks until the client of a queue transfer has granted at least one more packet.
+// Grants left over from an earlier client of this worker are dropped. Returns -1
+// if the client went away. With a negative poll_ms it never checks, for threads
+// that must leave SIGALRM alone: the client's death is then noticed by whoever
+// removes the queue from under it.
+static int credit_wait(int msg_qid, pid_t client_pid, int *credits, int poll_ms)
+{
+  Mesg cmsg;
+  int result = 0;
+  int idle = *credits <= 0;
+  if (idle)
+  {
+    sched_idle(1);
+  }
+  while (*credits <= 0 && result == 0)
+  {
+    if (mesgq_read(msg_qid, getpid(), &cmsg, poll_ms) == -1)
+    {
+      if ((errno == ETIMEDOUT && kill(MESG_PID(client_pid), 0) == -1 && errno == ESRCH) ||
+          (errno != ETIMEDOUT && errno != EINTR))
+      {
+        result = -1;
+      }
+      continue;
+    }
+    if (cmsg.mesg_cmd == CMD_CREDIT && cmsg.pid == client_pid && cmsg.mesg_len == sizeof(int))
+    {
+      *credits += *(int *)cmsg.mesg_data;
+    }
+  }
+  if (idle)
+  {
+    sched_idle(0);
+  }
+  --*credits;
+  return result;
+}
+
+// CLOCK_MONOTONIC now, in ns
+static long long now_ns(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Bumps a live counter; the stripe threads of a worker share its counters
+static void stats_add(unsigned long long *counter, unsigned long long n)
+{
+  __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+// Marks ws busy with a request from client_pid
+static void stats_begin(struct worker_stats *ws, pid_t client_pid, int priority)
+{
+  ws->pid = getpid();
+  ws->client_pid = client_pid;
+  ws->priority = priority;
+  ws->start_bytes = __atomic_load_n(&ws->bytes, __ATOMIC_RELAXED);
+  ws->start_packets = __atomic_load_n(&ws->packets, __ATOMIC_RELAXED);
+  __atomic_store_n(&ws->started_ns, now_ns(), __ATOMIC_RELEASE);
+}
+
+// Marks ws idle again, adding the request to the totals
+static void stats_end(struct worker_stats *ws)
+{
+  stats_add(&ws->busy_ns, now_ns() - ws->started_ns);
+  stats_add(&ws->transfers, 1);
+  __atomic_store_n(&ws->started_ns, 0, __ATOMIC_RELEASE);
+}
+
+// Data bytes per packet before the queue limits are known: MAXMESSAGEDATA /
+// priority, or with -a as large as a packet goes (tune_queue may then shrink it)
+static int base_packet_size(int priority)
+{
+  int size;
+  if (packet_autotune)
+  {
+    return MAXMESSAGEDATA;
+  }
+  size = MAXMESSAGEDATA / (priority > 0 ? priority : 1);
+  return size < 1 ? 1 : size;
+}
+
+// Transfers the pool is serving right now, this one included
+static int busy_workers(void)
+{
+  int busy = 0;
+  int i;
+  for (i = 0; i < shared->nworkers; ++i)
+  {
+    busy += shared->slots[i].busy;
+  }
+  return busy > 0 ? busy : 1;
+}
+
+// Sizes a new data queue from the live kernel limits (msgctl IPC_INFO and
+// IPC_STAT): msg_qbytes is raised to hold CREDIT_WINDOW_MAX packets, or the
+// queue's share of TUNE_QUEUE_BUDGET if less, as far as this process may (past
+// msgmnb only with CAP_SYS_RESOURCE). Then *packet_size is cut to what one message
+// may carry and, with -a, until TUNE_MIN_WINDOW packets fit, and *window is set
+// to the packets the queue holds next to a couple of credit grants, so a
+// client granting that many never blocks the sender. Returns -1 (leaving both
+// alone) if the queue cannot be inspected.
+static int tune_queue(int qid, long budget, int *packet_size, int *window)
+{
+  struct msginfo limits;
+  struct msqid_ds ds;
+  unsigned long before;
+  long reserve = 2 * (MESGHDRSIZE + sizeof(int));
+  long want = CREDIT_WINDOW_MAX * (long)(MESGHDRSIZE + *packet_size) + reserve;
+  long fit;
+  if (msgctl(0, IPC_INFO, (struct msqid_ds *)&limits) == -1 ||
+      msgctl(qid, IPC_STAT, &ds) == -1)
+  {
+    perror("data queue limits");
+    return -1;
+  }
+  before = ds.msg_qbytes;
+  if (want > budget)
+  {
+    want = budget;
+  }
+  if (want > (long)ds.msg_qbytes)
+  {
+    ds.msg_qbytes = want;
+    if (msgctl(qid, IPC_SET, &ds) == -1 && limits.msgmnb > (long)before)
+    {
+      ds.msg_qbytes = limits.msgmnb;
+      msgctl(qid, IPC_SET, &ds);
+    }
+    msgctl(qid, IPC_STAT, &ds);
+  }
+  fit = (long)ds.msg_qbytes - reserve;
+  if (packet_autotune && fit / TUNE_MIN_WINDOW - (long)MESGHDRSIZE < *packet_size)
+  {
+    *packet_size = fit / TUNE_MIN_WINDOW - MESGHDRSIZE;
+    if (*packet_size < TUNE_MIN_PACKET)
+    {
+      *packet_size = TUNE_MIN_PACKET;
+    }
+  }
+  if (*packet_size > limits.msgmax - (long)MESGHDRSIZE)
+  {
+    *packet_size = limits.msgmax - MESGHDRSIZE;
+  }
+  *window = fit / (long)(MESGHDRSIZE + *packet_size);
+  *window = *window < 1 ? 1 : (*window > CREDIT_WINDOW_MAX ? CREDIT_WINDOW_MAX : *window);
+  printf("data queue %d: msg_qbytes %lu -> %lu (msgmnb %d, budget %ld), packet %d, window %d\n",
+         qid, before, (unsigned long)ds.msg_qbytes, limits.msgmnb, budget, *packet_size,
+         *window);
+  return 0;
+}
+
+// Where the next outgoing packet is built: a ring slot, or the local message
+static Mesg *next_packet(struct shm_ring *ring, Mesg *local, pid_t client_pid)
+{
+  if (ring != NULL && my_stats != NULL &&
+      ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= SHM_RING_SLOTS)
+  {
+    stats_add(&my_stats->stalls, 1);
+  }
+  return ring != NULL ? ring_reserve(ring, client_pid) : local;
+}
+
+// Hands a built packet to the client over whichever transport is in use. Queue
+// packets wait for this transfer's turn first. The send is tried without
+// blocking first, so a full queue shows up in the stall counter.
+static int put_packet(int msg_qid, struct shm_ring *ring, Mesg *pkt)
+{
+  int result = 0;
+  long long n;
+  if (ring != NULL)
+  {
+    ring_advance(&ring->head, &ring->head_waiters);
+  }
+  else
+  {
+    sched_acquire(MESGHDRSIZE + pkt->mesg_len);
+    if (my_stats == NULL)
+    {
+      result = mesgq_send(msg_qid, pkt);
+    }
+    else if (msgsnd(msg_qid, pkt, MESGHDRSIZE + pkt->mesg_len, IPC_NOWAIT) == -1)
+    {
+      if (errno == EAGAIN)
+      {
+        stats_add(&my_stats->stalls, 1);
+      }
+      result = mesgq_send(msg_qid, pkt);
+    }
+  }
+  if (my_stats != NULL && pkt->mesg_cmd == CMD_FETCH)
+  {
+    if (result == -1)
+    {
+      stats_add(&my_stats->send_failures, 1);
+    }
+    else
+    {
+      // Packed, the records are counted as the packets they are
+      n = pkt->mesg_flags & MESG_F_PACKED ? pkt->mesg_count : 0;
+      stats_add(&my_stats->bytes, pkt->mesg_len - n * sizeof(struct packet_rec));
+      stats_add(&my_stats->packets, n > 0 ? n : 1);
+    }
+  }
+  return result;
+}
+
+// Sends a CMD_FILEINFO: the reply that opens a transfer, which always goes over
+// the shared queue where the client waits for it before moving to the private data
+// queues or the ring, and in a batch the header of every further file, which goes
+// down the data path (queue or ring slot) right behind the previous file's packets.
+// The path follows the struct in mesg_data, cut to fit.
+static int send_fileinfo(int qid, struct shm_ring *ring, pid_t client_pid, int priority,
+                         struct file_info *info, const char *path)
+{
+  Mesg local;
+  Mesg *reply;
+  int len = strlen(path);
+  if ((reply = next_packet(ring, &local, client_pid)) == NULL)
+  {
+    return -1;
+  }
+  if (len > MAXMESSAGEDATA - (int)sizeof(*info) - 1)
+  {
+    len = MAXMESSAGEDATA - (int)sizeof(*info) - 1;
+  }
+  reply->mtype = client_pid;
+  reply->pid = getpid();
+  reply->mesg_cmd = CMD_FILEINFO;
+  reply->mesg_flags = 0;
+  reply->mesg_seq = 0;
+  reply->mesg_crc = 0;
+  reply->mesg_sum = 0;
+  reply->mesg_offset = 0;
+  reply->mesg_count = 0;
+  reply->mesg_priority = priority;
+  reply->mesg_len = sizeof(*info) + len;
+  memcpy(reply->mesg_data, info, sizeof(*info));
+  memcpy(reply->mesg_data + sizeof(*info), path, len);
+  return put_packet(qid, ring, reply);
+}
+
+// Answers a CMD_STAT with a file info alone: size and mtime, or the errno
+static int serve_stat(int msg_qid, Mesg *imsg)
+{
+  struct stat st;
+  struct file_info info;
+  memset(&info, 0, sizeof(info));
+  info.files = 1;
+  if (stat(imsg->mesg_data, &st) == -1)
+  {
+    info.status = errno;
+  }
+  else
+  {
+    info.size = st.st_size;
+    info.mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  }
+  return send_fileinfo(msg_qid, NULL, imsg->pid, imsg->mesg_priority, &info, imsg->mesg_data);
+}
+
+// Ends a request with an error text in place of the file info reply
+static void refuse_client(int msg_qid, pid_t client_pid, const char *reason)
+{
+  Mesg emsg;
+  emsg.mtype = client_pid;
+  emsg.pid = getpid();
+  emsg.mesg_cmd = CMD_FETCH;
+  emsg.mesg_flags = MESG_F_ERROR;
+  emsg.mesg_seq = 0;
+  emsg.mesg_crc = 0;
+  emsg.mesg_sum = 0;
+  emsg.mesg_offset = 0;
+  emsg.mesg_count = 0;
+  emsg.mesg_priority = -1;
+  strcpy(emsg.mesg_data, reason);
+  emsg.mesg_len = strlen(reason);
+  mesgq_send(msg_qid, &emsg);
+}
+
+// Turns pkt into an end marker that carries the errno of a failed file read in
+// place of data, so the client fails the transfer rather than taking it as the
+// end of the file. The caller addresses it and sets its seq.
+static void read_failed(Mesg *pkt, int err)
+{
+  pkt->mesg_flags = MESG_F_ERROR;
+  pkt->mesg_crc = 0;
+  pkt->mesg_sum = 0;
+  pkt->mesg_count = 0;
+  pkt->mesg_priority = -1;
+  pkt->mesg_len = snprintf(pkt->mesg_data, MAXMESSAGEDATA, "File read error: %s", strerror(err));
+}
+
+// Serves a MESG_F_PIPE request: the file info over the shared queue, then the
+// file's bytes spliced from the page cache into the client's FIFO (written from
+// the arena if the file is cached), then an end marker over the queue with the
+// byte count in mesg_count. The data never passes through a Mesg. Only the one
+// file (or range) is sent; a whole file is followed while it grows, as for the
+// other transports. No checksum: the bytes are never seen here.
+// The FIFO is named after the filename in mesg_data. It is opened without
+// following a symlink and must be a FIFO owned by the client's user, so a
+// request cannot have the file written anywhere else.
+static int serve_pipe(int msg_qid, Mesg *imsg)
+{
+  char proc[32];
+  const char *name = imsg->mesg_data + strlen(imsg->mesg_data) + 1;
+  struct stat st;
+  struct stat owner;
+  struct xfer_src src;
+  struct file_info info;
+  Mesg emsg;
+  loff_t off;
+  long long left;
+  long long sent = 0;
+  ssize_t n;
+  int chunk;
+  int fifo;
+  int result = 0;
+  if (imsg->mesg_flags & (MESG_F_BATCH | MESG_F_MANIFEST))
+  {
+    refuse_client(msg_qid, imsg->pid, "Pipe transfers take a single file");
+    return -2;
+  }
+  if (name - imsg->mesg_data >= imsg->mesg_len)
+  {
+    refuse_client(msg_qid, imsg->pid, "Pipe transfers need a FIFO");
+    return -2;
+  }
+  // The client holds the read end open already, so this does not block
+  snprintf(proc, sizeof(proc), "/proc/%d", MESG_PID(imsg->pid));
+  if ((fifo = open(name, O_WRONLY | O_NONBLOCK | O_NOFOLLOW | O_NOCTTY)) == -1)
+  {
+    perror(name);
+    refuse_client(msg_qid, imsg->pid, "Pipe open error");
+    return -2;
+  }
+  if (fstat(fifo, &st) == -1 || !S_ISFIFO(st.st_mode) || stat(proc, &owner) == -1 ||
+      st.st_uid != owner.st_uid)
+  {
+    printf("not the client's FIFO: %s\n", name);
+    refuse_client(msg_qid, imsg->pid, "Pipe is not the client's FIFO");
+    close(fifo);
+    return -2;
+  }
+  fcntl(fifo, F_SETFL, fcntl(fifo, F_GETFL) & ~O_NONBLOCK);
+  if (src_open(&src, imsg->mesg_data) == -1)
+  {
+    printf("file open failed: %s\n", imsg->mesg_data);
+    refuse_client(msg_qid, imsg->pid, "File Open error");
+    close(fifo);
+    return -2;
+  }
+  if (imsg->mesg_flags & MESG_F_RANGE)
+  {
+    src_range(&src, imsg->mesg_offset, imsg->mesg_count);
+  }
+  memset(&info, 0, sizeof(info));
+  info.size = src_bytes(&src);
+  info.mtime = src.mtime;
+  info.packet_size = PIPE_CHUNK;
+  info.files = 1;
+  if (send_fileinfo(msg_qid, NULL, imsg->pid, imsg->mesg_priority, &info, imsg->mesg_data) == -1)
+  {
+    printf("svr sent failed\n");
+    close(fifo);
+    src_close(&src);
+    return -1;
+  }
+  if (self != NULL)
+  {
+    self->replied = 1;
+  }
+  off = src.pos;
+  left = src.limit >= 0 ? src.limit - src.pos : -1;
+  while (result == 0 && left != 0)
+  {
+    chunk = left < 0 || left > PIPE_CHUNK ? PIPE_CHUNK : left;
+    if (src.mem != NULL)
+    {
+      n = off < src.size ? (src.size - off < chunk ? src.size - off : chunk) : 0;
+      if (n > 0 && write_full(fifo, src.mem + off, n) == -1)
+      {
+        n = -1;
+      }
+      off += n > 0 ? n : 0;
+    }
+    else
+    {
+      n = splice(src.fd, &off, fifo, NULL, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+    }
+    if (n == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      result = n;
+      break;
+    }
+    sent += n;
+    left -= left > 0 ? n : 0;
+    if (my_stats != NULL)
+    {
+      stats_add(&my_stats->bytes, n);
+      stats_add(&my_stats->packets, 1);
+    }
+  }
+  // The client sees the end of the data as end of file, then waits for the marker
+  close(fifo);
+  src_close(&src);
+  if (result == -1 && errno == EPIPE)
+  {
+    printf("client %d went away\n", imsg->pid);
+    return -1;
+  }
+  if (result == -1)
+  {
+    perror("splice");
+    refuse_client(msg_qid, imsg->pid, "File read error");
+    return -1;
+  }
+  emsg.mtype = imsg->pid;
+  emsg.pid = getpid();
+  emsg.mesg_cmd = CMD_FETCH;
+  emsg.mesg_flags = 0;
+  emsg.mesg_seq = 0;
+  emsg.mesg_crc = 0;
+  emsg.mesg_sum = 0;
+  emsg.mesg_offset = 0;
+  emsg.mesg_count = sent;
+  emsg.mesg_priority = -1;
+  emsg.mesg_len = 0;
+  printf("read file terminated, %lld bytes spliced\n", sent);
+  return mesgq_send(msg_qid, &emsg);
+}
+
+// Fills in the files a request asks for: its filename, every name of a
+// MESG_F_BATCH list, or every line of a MESG_F_MANIFEST file on the server.
+// Returns -1 if the manifest cannot be read.
+static int batch_load(Mesg *imsg, struct batch *batch)
+{
+  struct stat st;
+  char *p;
+  char *end;
+  int fd;
+  int n;
+  batch->buf = NULL;
+  batch->count = 0;
+  batch->multi = (imsg->mesg_flags & (MESG_F_BATCH | MESG_F_MANIFEST)) != 0;
+  if (!batch->multi)
+  {
+    p = imsg->mesg_data;
+    end = p + imsg->mesg_len;
+  }
+  else if (imsg->mesg_flags & MESG_F_BATCH)
+  {
+    // NUL separated; check_framing terminated the last one
+    p = imsg->mesg_data;
+    end = p + imsg->mesg_len;
+  }
+  else
+  {
+    if ((fd = open(imsg->mesg_data, O_RDONLY)) == -1 || fstat(fd, &st) == -1 ||
+        (batch->buf = malloc(st.st_size + 1)) == NULL ||
+        (n = read_full(fd, batch->buf, st.st_size)) == -1)
+    {
+      if (fd != -1)
+      {
+        close(fd);
+      }
+      free(batch->buf);
+      return -1;
+    }
+    close(fd);
+    batch->buf[n] = '\0';
+    for (p = batch->buf; p < batch->buf + n; ++p)
+    {
+      if (*p == '\n' || *p == '\r')
+      {
+        *p = '\0';
+      }
+    }
+    p = batch->buf;
+    end = batch->buf + n;
+  }
+  // One path per NUL terminated string, skipping empty ones
+  batch->paths = malloc((end - p + 1) / 2 * sizeof(char *) + sizeof(char *));
+  if (batch->paths == NULL)
+  {
+    free(batch->buf);
+    return -1;
+  }
+  if (!batch->multi)
+  {
+    batch->paths[batch->count++] = p;
+    return 0;
+  }
+  for (; p < end; p += strlen(p) + 1)
+  {
+    if (*p != '\0')
+    {
+      batch->paths[batch->count++] = p;
+    }
+  }
+  return 0;
+}
+
+static void batch_free(struct batch *batch)
+{
+  free(batch->paths);
+  free(batch->buf);
+}
+
+// Body of one sender thread of a striped transfer. Each packet is read with its
+// own pread at seq * packet_size, so the threads never share a file position.
+static void *stripe_sender(void *arg)
+{
+  struct stripe_set *set = arg;
+  Mesg pkt;
+  long long seq;
+  long long end = 0;  /* end of this thread's last packet, from base */
+  unsigned int sum = 0;
+  unsigned int raw;
+  int count;
+  int index;
+  int i;
+  int failed = 0;
+  int read_err = 0;
+  pthread_mutex_lock(&set->lock);
+  index = set->started++;
+  pthread_mutex_unlock(&set->lock);
+  for (seq = index; seq < set->packets && !failed; seq += set->stripes)
+  {
+    if (credit_wait(set->qids[index], set->client_pid, &set->credits[index], -1) == -1)
+    {
+      failed = 1;
+      break;
+    }
+    pkt.mesg_offset = set->base + (off_t)seq * set->packet_size;
+    if ((count = src_pread(set->src, pkt.mesg_data, set->packet_size, pkt.mesg_offset)) == -1)
+    {
+      // Ends the file here for the client, which reads this seq in turn
+      read_err = errno;
+      perror("file read");
+      read_failed(&pkt, read_err);
+      pkt.mtype = set->client_pid;
+      pkt.pid = getpid();
+      pkt.mesg_cmd = CMD_FETCH;
+      pkt.mesg_seq = seq;
+      put_packet(set->qids[index], NULL, &pkt);
+      failed = 1;
+      break;
+    }
+    // The file checksum is a sum over every thread's packets, each shifted by
+    // the bytes that follow it: here up to this thread's next packet
+    raw = mesgq_crc32c_raw(0, pkt.mesg_data, count);
+    pkt.mesg_crc = raw ^ (count == set->packet_size ? set->crc_full : mesgq_crc32c_pad(count));
+    i = seq * set->packet_size + count - end == (long long)set->stripes * set->packet_size;
+    sum = mesgq_crc32c_shift(sum, i ? set->crc_stride
+                                    : mesgq_crc32c_zeros(seq * set->packet_size + count - end));
+    sum ^= raw;
+    end = seq * set->packet_size + count;
+    pkt.mesg_sum = 0;
+    if (seq == set->packets - 1)
+    {
+      // The end marker waits for every other thread's share (all of it comes
+      // before this packet, so none of them waits on it in turn)
+      pthread_mutex_lock(&set->lock);
+      while (set->running > 1)
+      {
+        pthread_cond_wait(&set->done, &set->lock);
+      }
+      for (i = 0; i < set->stripes; ++i)
+      {
+        if (i != index)
+        {
+          sum ^= mesgq_crc32c_shift(set->sums[i], mesgq_crc32c_zeros(end - set->sum_ends[i]));
+        }
+      }
+      pthread_mutex_unlock(&set->lock);
+      pkt.mesg_sum = sum ^ mesgq_crc32c_pad(end);
+    }
+    pkt.mtype = set->client_pid;
+    pkt.pid = getpid();
+    pkt.mesg_cmd = CMD_FETCH;
+    pkt.mesg_flags = 0;
+    pkt.mesg_seq = seq;
+    pkt.mesg_count = 0;
+    pkt.mesg_len = count;
+    pkt.mesg_priority = seq == set->packets - 1 ? -1 : set->priority;
+    failed = put_packet(set->qids[index], NULL, &pkt) == -1;
+  }
+  pthread_mutex_lock(&set->lock);
+  set->sums[index] = sum;
+  set->sum_ends[index] = end;
+  set->failed |= failed;
+  set->unread |= read_err != 0;
+  --set->running;
+  pthread_cond_broadcast(&set->done);
+  pthread_mutex_unlock(&set->lock);
+  return NULL;
+}
+
+// Runs a striped transfer: starts a sender thread per data queue and waits for
+// them, checking every RING_WAIT_MS that the client is still there. If it is not
+// (or a thread could not be started) the queues are removed, which fails whatever
+// the senders are blocked on. Returns 0 once every packet went out, -3 if a read
+// failed and the client was told, -1 otherwise.
+static int stripe_send(struct stripe_set *set)
+{
+  pthread_condattr_t cattr;
+  sigset_t all, old;
+  struct timespec deadline;
+  int created;
+  int i;
+  int aborted = 0;
+  set->started = 0;
+  set->failed = 0;
+  set->unread = 0;
+  memset(set->sums, 0, sizeof(set->sums));
+  memset(set->sum_ends, 0, sizeof(set->sum_ends));
+  set->crc_stride = mesgq_crc32c_zeros((long long)set->stripes * set->packet_size);
+  set->crc_full = mesgq_crc32c_pad(set->packet_size);
+  pthread_mutex_init(&set->lock, NULL);
+  pthread_condattr_init(&cattr);
+  pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+  pthread_cond_init(&set->done, &cattr);
+  pthread_condattr_destroy(&cattr);
+  // The senders leave every signal, SIGALRM included, to this thread
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  pthread_mutex_lock(&set->lock);
+  for (created = 0; created < set->stripes; ++created)
+  {
+    if (pthread_create(&set->threads[created], NULL, stripe_sender, set) != 0)
+    {
+      printf("stripe thread create failed\n");
+      aborted = 1;
+      remove_queues(set->qids, set->stripes);
+      break;
+    }
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  set->running = created;
+  while (set->running > 0)
+  {
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += RING_WAIT_MS * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+      deadline.tv_sec += 1;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    if (pthread_cond_timedwait(&set->done, &set->lock, &deadline) == ETIMEDOUT && !aborted &&
+        kill(MESG_PID(set->client_pid), 0) == -1 && errno == ESRCH)
+    {
+      printf("client %d went away\n", set->client_pid);
+      aborted = 1;
+      remove_queues(set->qids, set->stripes);
+    }
+  }
+  pthread_mutex_unlock(&set->lock);
+  for (i = 0; i < created; ++i)
+  {
+    pthread_join(set->threads[i], NULL);
+  }
+  pthread_cond_destroy(&set->done);
+  pthread_mutex_destroy(&set->lock);
+  if (aborted || set->failed)
+  {
+    return set->unread && !aborted ? -3 : -1;
+  }
+  printf("read file terminated, %lld packets over %d queues\n", set->packets, set->stripes);
+  return 0;
+}
+
+// Fills pkt's payload from the packer's stage: span bytes compressed into at most
+// packet_size if that saves at least 1/COMPRESS_MIN_GAIN, otherwise packet_size
+// bytes as they are. A compressed packet that overflows only shrinks span; a
+// poor ratio on a packet's worth sends the next COMPRESS_BACKOFF packets raw
+// without trying. Returns 1 if this is the last packet of the file, -1 if the
+// file could not be read.
+static int pack_packet(struct packer *pk, struct xfer_src *src, Mesg *pkt, int packet_size)
+{
+  int want = pk->skip > 0 ? packet_size : pk->span;
+  int count = 0;
+  int keep;
+  int raw;
+  int n;
+  if (pk->have < want && !pk->eof)
+  {
+    // Slide down, keeping a window's worth of what was sent
+    keep = pk->off < COMPRESS_WINDOW ? pk->off : COMPRESS_WINDOW;
+    memmove(pk->stage, pk->stage + pk->off - keep, keep + pk->have);
+    pk->off = keep;
+    n = sizeof(pk->stage) - keep - pk->have;
+    if ((n = src_read(src, pk->stage + keep + pk->have, n)) == -1)
+    {
+      return -1;
+    }
+    pk->eof = keep + pk->have + n < (int)sizeof(pk->stage);
+    pk->have += n;
+  }
+  raw = want < pk->have ? want : pk->have;
+  pkt->mesg_offset = src->pos - pk->have;
+  pkt->mesg_flags = 0;
+  pkt->mesg_count = 0;
+  if (pk->skip > 0)
+  {
+    --pk->skip;
+  }
+  else if (raw > 0)
+  {
+    count = lz_compress(pk->stage, pk->off, pk->off + raw, pkt->mesg_data, packet_size,
+                        pk->table);
+    if (count > 0 && count <= raw - raw / COMPRESS_MIN_GAIN)
+    {
+      pkt->mesg_flags = MESG_F_LZ;
+      pkt->mesg_count = raw;
+      pk->raw_bytes += raw;
+      pk->wire_bytes += count;
+      ++pk->packed;
+      // Aim a little under a full packet, the next span compresses differently
+      n = (long long)raw * packet_size / count - raw / 16;
+      pk->span = n < packet_size ? packet_size : (n > COMPRESS_SPAN_MAX ? COMPRESS_SPAN_MAX : n);
+    }
+    else
+    {
+      if (count == -1 && raw > packet_size)
+      {
+        pk->span = raw / 2 > packet_size ? raw / 2 : packet_size;
+      }
+      else
+      {
+        pk->skip = COMPRESS_BACKOFF;
+      }
+      count = 0;
+    }
+  }
+  if (count == 0)
+  {
+    raw = packet_size < pk->have ? packet_size : pk->have;
+    memcpy(pkt->mesg_data, pk->stage + pk->off, raw);
+    count = raw;
+    ++pk->plain;
+  }
+  pkt->mesg_len = count;
+  pk->off += raw;
+  pk->have -= raw;
+  return pk->eof && pk->have == 0;
+}
+
+// Fills pkt with up to records packets of packet_size bytes, each behind its
+// struct packet_rec, from one read of the source, and adds them to the file
+// checksum. The packet the file ends in (short, maybe empty) is the last record.
+// Returns 1 if this is the last message of the file, -1 if the file could not be
+// read.
+static int pack_records(struct xfer_src *src, Mesg *pkt, int packet_size, int records,
+                        unsigned int *sum)
+{
+  char stage[MAXMESSAGEDATA];
+  struct packet_rec rec;
+  int got;
+  int off = 0;
+  int len = 0;
+  int n = 0;
+  pkt->mesg_offset = src->pos;
+  if ((got = src_read(src, stage, records * packet_size)) == -1)
+  {
+    return -1;
+  }
+  do
+  {
+    rec.len = got - off < packet_size ? got - off : packet_size;
+    rec.crc = mesgq_crc32c(0, stage + off, rec.len);
+    *sum = mesgq_crc32c_combine(*sum, rec.crc, rec.len);
+    memcpy(pkt->mesg_data + len, &rec, sizeof(rec));
+    memcpy(pkt->mesg_data + len + sizeof(rec), stage + off, rec.len);
+    len += sizeof(rec) + rec.len;
+    off += rec.len;
+  } while (++n < records && rec.len == packet_size);
+  pkt->mesg_flags = MESG_F_PACKED;
+  pkt->mesg_count = n;
+  pkt->mesg_len = len;
+  pkt->mesg_crc = 0;
+  return rec.len < packet_size;
+}
+
+// Sends one file down a single data queue (or the ring). Each packet is filled by
+// one read straight into the outgoing buffer (a ring slot for shm). mesg_len is the
+// only framing, so binary data (including NUL bytes) goes through as is. A short
+// read is the last packet and carries the end marker, even if it is empty. Queue
+// packets also need a credit from the client first, which bounds what this
+// transfer can have sitting in the queue. With a packer (pk) the packets are
+// built by pack_packet instead, and the end marker goes on whichever packet
+// empties the file. Every packet carries the CRC32C of its payload, the end
+// marker that of the whole file as read (before compression). With records > 1
+// (queue only) each message and credit carries that many packets (pack_records).
+// A read error ends the file with an error message (read_failed) and returns -3.
+static int send_file(int msg_qid, int out_qid, struct shm_ring *ring, struct xfer_src *src,
+                     Mesg *imsg, int packet_size, int records, int *credits,
+                     struct packer *pk)
+{
+  Mesg local;
+  Mesg *pkt;
+  unsigned int seq = 0;
+  unsigned int sum = 0; /* CRC32C of the file data sent so far */
+  int count;
+  int last;
+  int err;
+  if (pk != NULL)
+  {
+    // A new window for every file, as the client starts over with each
+    pk->off = 0;
+    pk->have = 0;
+    pk->eof = 0;
+  }
+  do
+  {
+    if ((ring == NULL && credit_wait(out_qid, imsg->pid, credits, RING_WAIT_MS) == -1) ||
+        (pkt = next_packet(ring, &local, imsg->pid)) == NULL)
+    {
+      printf("client %d went away\n", imsg->pid);
+      purge_client(msg_qid, imsg->pid);
+      return -1;
+    }
+    if (pk != NULL)
+    {
+      last = pack_packet(pk, src, pkt, packet_size);
+      count = pkt->mesg_len;
+    }
+    else if (records > 1)
+    {
+      last = pack_records(src, pkt, packet_size, records, &sum);
+      count = pkt->mesg_len;
+    }
+    else
+    {
+      pkt->mesg_offset = src->pos;
+      count = src_read(src, pkt->mesg_data, packet_size);
+      pkt->mesg_flags = 0;
+      pkt->mesg_count = 0;
+      pkt->mesg_len = count;
+      last = count == -1 ? -1 : count < packet_size;
+    }
+    if (last == -1)
+    {
+      err = errno;
+      perror("file read");
+      read_failed(pkt, err);
+      count = 0;
+    }
+    else if (pkt->mesg_flags & MESG_F_LZ)
+    {
+      pkt->mesg_crc = mesgq_crc32c(0, pkt->mesg_data, count);
+      sum = mesgq_crc32c(sum, pk->stage + pk->off - pkt->mesg_count, pkt->mesg_count);
+    }
+    else if (!(pkt->mesg_flags & MESG_F_PACKED))
+    {
+      pkt->mesg_crc = mesgq_crc32c(0, pkt->mesg_data, count);
+      sum = mesgq_crc32c_combine(sum, pkt->mesg_crc, count);
+    }
+    pkt->mesg_sum = last == 1 ? sum : 0;
+    pkt->mtype = imsg->pid;
+    pkt->pid = getpid();
+    pkt->mesg_cmd = CMD_FETCH;
+    pkt->mesg_seq = seq++;
+    pkt->mesg_priority = last ? -1 : imsg->mesg_priority;
+    // Send it!
+    if (put_packet(out_qid, ring, pkt) == -1)
+    {
+      printf("svr sent failed\n");
+      return -1;
+    }
+  } while (!last);
+  if (last == -1)
+  {
+    return -3;
+  }
+  printf("read file terminated, last msg %d bytes, crc32c %08x\n", count, sum);
+  return 0;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		server_transfer_proc
+  --
+  --	DATE:			    Mar 27, 2019
+  --
+  --	REVISIONS:		Mar 27, 2019
+  --                Oct 16, 2026 - block reads, binary safe framing
+  --                Oct 16, 2026 - shared memory ring transport
+  --                Oct 16, 2026 - serve hot files from the shared cache
+  --                Oct 16, 2026 - file size reply before the data
+  --                Oct 16, 2026 - credit flow control on the queue
+  --                Oct 16, 2026 - private data queue per transfer
+  --                Oct 16, 2026 - striping over several data queues
+  --                Oct 16, 2026 - batched multi-file requests
+  --                Oct 16, 2026 - byte range requests and CMD_STAT
+  --                Oct 16, 2026 - compressed packets
+  --                Oct 16, 2026 - CRC32C checks
+  --                Oct 16, 2026 - data queues sized from the kernel limits
+  --                Oct 16, 2026 - read-ahead thread
+  --                Oct 16, 2026 - spliced pipe transport
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int server_transfer_proc(int msg_qid, Mesg imsg)
+  --                     int msg_qid:      message queue id
+  --                       Mesg imsg:      Msg struct data from initial message
+  --
+  --	RETURNS:		
+  --					 0    on success
+  --          -1    on failure of message send
+  --          -2    on failure to open file     
+  --          -3    on failure to read it, reported to the client
+  --	NOTES:
+  --		Server transfer process function. This is run when this application is set to 
+  --    be run in server mode, and an incoming message from a client specifies a file
+  --    request
+  --    This function will
+  --      (1) Attempt to open a file (a hot file is found in the shared cache)
+  --      (2) Read the content of a file: a streamed file is read ahead in large
+  --          blocks by a reader thread (see src_readahead), each packet copied
+  --          out of its buffers, a cached one copied per packet
+  --      (3) Fill up buffer size according to imsg structure passed in
+  --      (4) Send message into msg_qid whenever
+  --          (4.1) Buffer size according to priority is filled
+  --          (4.2) File to be read is finished reading
+  --      (5) Send a final message with priority -1 to the client to signal EOT
+  --    Before any data the client gets a CMD_FILEINFO reply with the file size over
+  --    the queue, or instead an error end message if the file cannot be opened.
+  --    Over the queue a packet is only sent against a CMD_CREDIT grant from the
+  --    client (see credit_wait), so one slow reader cannot fill the shared queue.
+  --    Queue packets and credits go through an IPC_PRIVATE queue made for this
+  --    transfer and named in the file info reply; the shared queue only sees
+  --    requests, replies and errors. The worker removes it once the client has
+  --    (see linger_data_queue) or on failure. Each data queue is sized when it is
+  --    made (see tune_queue): msg_qbytes raised within the kernel limits and a
+  --    share of TUNE_QUEUE_BUDGET split over the busy workers, and the window
+  --    that then fits is suggested to the client in the file info. With -a the
+  --    packet size comes from the same limits instead of the priority, which
+  --    still sets the transfer's bandwidth share.
+  --    A request with stripe bits in its flags gets that many private queues
+  --    instead, each fed by its own sender thread (see stripe_send); packet seq
+  --    goes through queue seq % stripes, so the client can read them back in
+  --    order round robin. The packet count is fixed by the size in the file info
+  --    reply, so unlike an ordinary transfer a striped one does not follow a file
+  --    that grows while it is sent.
+  --    A MESG_F_BATCH or MESG_F_MANIFEST request names several files (see
+  --    batch_load). They share the data queues and go out back to back, each
+  --    behind its own file info; one that cannot be opened gets a file info
+  --    with its errno as status and no packets, and the batch carries on. Grants
+  --    left over from one file are used for the next.
+  --    A MESG_F_RANGE request only gets mesg_count bytes from mesg_offset (clipped
+  --    to the file), the file info announcing that many; every data packet
+  --    carries its file offset in mesg_offset. A CMD_STAT is answered with a file
+  --    info alone (size and mtime, or the errno) and no transfer.
+  --    With MESG_F_SHM the packets are built directly in the client's ring slots
+  --    and published instead of sent; the packet contents are the same either way.
+  --    With MESG_F_PIPE there are no packets: the file is spliced into the
+  --    client's FIFO (see serve_pipe).
+  --    With MESG_F_COMPRESS (not striped) each packet is compressed as it is
+  --    built (see pack_packet), so the client can still write data out as it
+  --    comes; matches may refer back to the last COMPRESS_WINDOW bytes of the
+  --    file already sent, which the client has in front of its output. A
+  --    MESG_F_LZ packet carries up to COMPRESS_SPAN_MAX file bytes, mesg_count
+  --    of them, and one that would not shrink enough goes out raw. Data that
+  --    does not compress is only tried again every COMPRESS_BACKOFF packets.
+  --    Every data packet carries the CRC32C of its payload in mesg_crc, and the
+  --    end marker the CRC32C of the file's data in mesg_sum. Striped senders each
+  --    sum their own packets; the one with the end marker combines the others'.
+  --    A read error ends the file (and the request) with a MESG_F_ERROR message
+  --    on the data path, in place of the packet that could not be read.
+------------------------------------------------------------------------------------*/
+int server_transfer_proc(int msg_qid, Mesg imsg)
+{
+  struct shm_ring *ring = NULL;
+  struct batch batch;
+  if (imsg.mesg_cmd == CMD_STAT)
+  {
+    return serve_stat(msg_qid, &imsg);
+  }
+  if (imsg.mesg_flags & MESG_F_PIPE)
+  {
+    return serve_pipe(msg_qid, &imsg);
+  }
+  printf("srv transfer proc %d called for client proc: %d\n", getpid(), imsg.pid);
+  if ((imsg.mesg_flags & MESG_F_SHM) && (ring = ring_attach(imsg.pid)) == NULL)
+  {
+    // No ring to report through, the client also watches the queue
+    refuse_client(msg_qid, imsg.pid, "Shared memory attach error");
+    return -2;
+  }
+  if (batch_load(&imsg, &batch) == -1)
+  {
+    printf("manifest open failed: %s\n", imsg.mesg_data);
+    refuse_client(msg_qid, imsg.pid, "Manifest open error");
+    if (ring != NULL)
+    {
+      ring_close(ring, imsg.pid);
+    }
+    return -2;
+  }
+  if (batch.multi && (imsg.mesg_flags & MESG_F_RANGE))
+  {
+    refuse_client(msg_qid, imsg.pid, "Range requests take a single file");
+    batch_free(&batch);
+    if (ring != NULL)
+    {
+      ring_close(ring, imsg.pid);
+    }
+    return -2;
+  }
+  printf("Transfer Requested: prior:%d, type:%lu, pid:%d, incLen:%d, shm:%d, files:%d\nmsg:%s\n",
+         imsg.mesg_priority,
+         imsg.mtype,
+         imsg.pid,
+         imsg.mesg_len,
+         ring != NULL,
+         batch.count,
+         imsg.mesg_data);
+  int packetSize = base_packet_size(imsg.mesg_priority);
+  // Queue transfers get private queues (one per stripe); the shared one only
+  // carries control traffic
+  int stripes = (imsg.mesg_flags & MESG_STRIPE_MASK) >> MESG_STRIPE_SHIFT;
+  int nqids = 0;
+  if (ring != NULL)
+  {
+    stripes = 0;
+  }
+  else if (stripes < 1)
+  {
+    stripes = 1;
+  }
+  else if (stripes > STRIPES_MAX)
+  {
+    stripes = STRIPES_MAX;
+  }
+  // Striped packets sit at fixed offsets, so only a single stream is compressed
+  struct packer *pk = NULL;
+  if ((imsg.mesg_flags & MESG_F_COMPRESS) && stripes <= 1 &&
+      (pk = calloc(1, sizeof(*pk))) != NULL)
+  {
+    pk->span = 2 * packetSize;
+    memset(pk->table, -1, sizeof(pk->table));
+  }
+  struct xfer_src src;
+  struct file_info info;
+  struct stripe_set set;
+  memset(&info, 0, sizeof(info));
+  memset(set.credits, 0, sizeof(set.credits));
+  set.client_pid = imsg.pid;
+  set.priority = imsg.mesg_priority;
+  set.packet_size = packetSize;
+  set.stripes = stripes;
+  int result = 0;
+  long budget;
+  int window;
+  int records = 1;
+  int wire;
+  int f;
+  int i;
+  for (f = 0; f < batch.count && result == 0; ++f)
+  {
+    // Opens file to read, or finds it in the cache
+    info.status = src_open(&src, batch.paths[f]) == -1 ? errno : 0;
+    if (info.status != 0)
+    {
+      printf("file open failed: %s\n", batch.paths[f]);
+      if (!batch.multi)
+      {
+        // Fail: Send ASCII error msg, in place of the file info reply
+        refuse_client(msg_qid, imsg.pid, "File Open error");
+        result = -2;
+        break;
+      }
+    }
+    else
+    {
+      printf("file open success%s: %s\n", src.mem != NULL ? " (cached)" : "", batch.paths[f]);
+      if (imsg.mesg_flags & MESG_F_RANGE)
+      {
+        src_range(&src, imsg.mesg_offset, imsg.mesg_count);
+        printf("range: %lld bytes from %lld\n", src_bytes(&src), (long long)src.pos);
+      }
+      if (stripes <= 1)
+      {
+        src_readahead(&src);
+      }
+    }
+    if (f == 0)
+    {
+      for (nqids = 0; nqids < stripes; ++nqids)
+      {
+        if ((set.qids[nqids] = msgget(IPC_PRIVATE, IPC_CREAT | 0660)) == -1)
+        {
+          break;
+        }
+      }
+      if (nqids < stripes)
+      {
+        perror("data queue");
+        remove_queues(set.qids, nqids);
+        nqids = 0;
+        refuse_client(msg_qid, imsg.pid, "Data queue error");
+        result = -2;
+      }
+      else if (self != NULL)
+      {
+        memcpy(self->data_qids, set.qids, stripes * sizeof(int));
+        self->ndata_qids = stripes;
+      }
+      // Small packets of a single queue go several to a message if the client
+      // takes them that way, saving a send (and credit, and scheduler turn) each
+      if ((imsg.mesg_flags & MESG_F_COALESCE) && stripes == 1 && ring == NULL && pk == NULL)
+      {
+        records = MAXMESSAGEDATA / (int)(sizeof(struct packet_rec) + packetSize);
+      }
+      wire = records > 1 ? records * (int)(sizeof(struct packet_rec) + packetSize) : packetSize;
+      // Each queue gets its share of the budget; the message size found for the
+      // first fits the rest, and the window is the smallest any of them takes
+      budget = TUNE_QUEUE_BUDGET / ((self != NULL ? busy_workers() : 1) * (nqids > 0 ? nqids : 1));
+      for (i = 0; i < nqids; ++i)
+      {
+        if (tune_queue(set.qids[i], budget, &wire, &window) == 0 &&
+            (info.window == 0 || window < info.window))
+        {
+          info.window = window;
+        }
+      }
+      if (records > 1)
+      {
+        records = wire / (int)(sizeof(struct packet_rec) + packetSize);
+      }
+      if (records < 2)
+      {
+        records = 1;
+        packetSize = wire < packetSize ? wire : packetSize;
+      }
+      printf("Transfer packet size will be: %d, %d to a message\n", packetSize, records);
+      set.packet_size = packetSize;
+      if (pk != NULL)
+      {
+        pk->span = 2 * packetSize;
+      }
+    }
+    info.size = info.status == 0 ? src_bytes(&src) : 0;
+    info.mtime = info.status == 0 ? src.mtime : 0;
+    info.packet_size = packetSize;
+    info.records = records;
+    info.stripes = stripes;
+    memcpy(info.data_qids, set.qids, stripes * sizeof(int));
+    info.index = f;
+    info.files = batch.count;
+    // The first goes over the shared queue, later ones follow the data
+    if (result == 0 && send_fileinfo(f == 0 ? msg_qid : set.qids[0], f == 0 ? NULL : ring,
+                                     imsg.pid, imsg.mesg_priority, &info, batch.paths[f]) == -1)
+    {
+      printf("svr sent failed\n");
+      result = -1;
+    }
+    if (result == 0 && f == 0 && self != NULL)
+    {
+      self->replied = 1;
+    }
+    if (info.status == 0)
+    {
+      if (result == 0)
+      {
+        set.src = &src;
+        set.packets = src_bytes(&src) / packetSize + 1;
+        set.base = src.pos;
+        result = stripes > 1 ? stripe_send(&set)
+                             : send_file(msg_qid, ring != NULL ? msg_qid : set.qids[0], ring,
+                                         &src, &imsg, packetSize, records, &set.credits[0],
+                                         pk);
+      }
+      src_close(&src);
+    }
+  }
+  if (pk != NULL)
+  {
+    if (pk->packed > 0)
+    {
+      printf("compressed %llu bytes to %llu (%llu%%) in %lu packets, %lu sent raw\n",
+             pk->raw_bytes, pk->wire_bytes, pk->wire_bytes * 100 / pk->raw_bytes, pk->packed,
+             pk->plain);
+    }
+    free(pk);
+  }
+  if (ring != NULL)
+  {
+    ring_close(ring, imsg.pid);
+  }
+  // A client told of a read error still has to get the message off the queue
+  for (f = 0; (result == 0 || result == -3) && f < nqids; ++f)
+  {
+    linger_data_queue(set.qids[f], imsg.pid);
+  }
+  remove_queues(set.qids, nqids);
+  if (self != NULL)
+  {
+    self->ndata_qids = 0;
+  }
+  batch_free(&batch);
+  return result;
+}
+
+// Takes the scheduler lock, recovering it if a worker died holding it
+static void sched_lock(void)
+{
+  if (pthread_mutex_lock(&shared->lock) == EOWNERDEAD)
+  {
+    pthread_mutex_consistent(&shared->lock);
+  }
+}
+
+// Starts a DRR round: every scheduled flow gets quantum * weight more bytes,
+// up to SCHED_DEFICIT_CAP rounds worth. Called with the lock held.
+static void sched_refill(void)
+{
+  int i;
+  long cap;
+  for (i = 0; i < shared->nworkers; ++i)
+  {
+    struct worker_slot *slot = &shared->slots[i];
+    if (slot->weight > 0)
+    {
+      cap = (long)SCHED_DEFICIT_CAP * SCHED_QUANTUM * slot->weight;
+      slot->deficit += (long)SCHED_QUANTUM * slot->weight;
+      if (slot->deficit > cap)
+      {
+        slot->deficit = cap;
+      }
+    }
+  }
+  ++shared->rounds;
+  pthread_cond_broadcast(&shared->refill);
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		sched_init
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int sched_init(void)
+  --
+  --	RETURNS:		
+  --					 0    on success
+  --          -1    on failure
+  --	NOTES:
+  --		Sets up the process shared lock and condition in the shared table. The lock
+  --    is robust so a worker killed while holding it does not wedge the others.
+------------------------------------------------------------------------------------*/
+int sched_init(void)
+{
+  pthread_mutexattr_t mattr;
+  pthread_condattr_t cattr;
+  pthread_mutexattr_init(&mattr);
+  pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+  pthread_condattr_init(&cattr);
+  pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+  pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+  if (pthread_mutex_init(&shared->lock, &mattr) != 0 ||
+      pthread_cond_init(&shared->refill, &cattr) != 0)
+  {
+    return -1;
+  }
+  pthread_mutexattr_destroy(&mattr);
+  pthread_condattr_destroy(&cattr);
+  return 0;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		sched_join
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		void sched_join(int priority)
+  --                    int priority:      client's mesg_priority
+  --
+  --	RETURNS:		
+  --     
+  --	NOTES:
+  --		Registers this worker's transfer with the scheduler. The weight is the
+  --    priority, so a larger -p buys a proportionally larger share of the queue.
+  --    The transfer starts with an empty deficit and gets its first quantum with
+  --    the next round.
+------------------------------------------------------------------------------------*/
+void sched_join(int priority)
+{
+  if (self == NULL)
+  {
+    return;
+  }
+  sched_lock();
+  self->weight = priority < 1 ? 1 : (priority > SCHED_WEIGHT_MAX ? SCHED_WEIGHT_MAX : priority);
+  self->waiting = 0;
+  self->deficit = 0;
+  self->bytes_sent = 0;
+  self->bytes_reported = 0;
+  pthread_mutex_unlock(&shared->lock);
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		sched_leave
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		void sched_leave(struct worker_slot *slot)
+  --         struct worker_slot *slot:      slot whose transfer is over
+  --
+  --	RETURNS:		
+  --     
+  --	NOTES:
+  --		Takes a transfer out of the scheduler, either from its worker when it ends
+  --    or from the server when the worker died. Waiters are woken since the flow
+  --    that was holding the round up may have been this one.
+------------------------------------------------------------------------------------*/
+void sched_leave(struct worker_slot *slot)
+{
+  if (slot == NULL || shared == NULL)
+  {
+    return;
+  }
+  sched_lock();
+  slot->weight = 0;
+  slot->waiting = 0;
+  slot->idle = 0;
+  slot->deficit = 0;
+  pthread_cond_broadcast(&shared->refill);
+  pthread_mutex_unlock(&shared->lock);
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		sched_acquire
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		void sched_acquire(int bytes)
+  --                       int bytes:      size of the message about to be sent
+  --
+  --	RETURNS:		
+  --     
+  --	NOTES:
+  --		Deficit round robin across the pool. A transfer may send while its deficit
+  --    covers the message; otherwise it waits. When every scheduled transfer is
+  --    waiting the round is over and the last one in starts the next. Over a round
+  --    each transfer sends about SCHED_QUANTUM * weight bytes, whatever its
+  --    packet size.
+  --    Starvation guard: a transfer can be held up outside the scheduler (blocked
+  --    on a full queue, slow disk) and never mark itself waiting. Anyone waiting
+  --    longer than SCHED_MAX_WAIT_MS starts the next round regardless, and banked
+  --    deficit is capped so the late flow cannot burst past the others afterwards.
+  --    A transfer waiting for client credit is idle (see sched_idle) and does
+  --    not hold up a round at all. The sender threads of a striped transfer
+  --    share its deficit; waiting counts how many of them are blocked here.
+------------------------------------------------------------------------------------*/
+void sched_acquire(int bytes)
+{
+  struct timespec deadline;
+  int i;
+  int all_waiting;
+  if (self == NULL || self->weight == 0)
+  {
+    return;
+  }
+  sched_lock();
+  ++self->waiting;
+  while (self->deficit < bytes)
+  {
+    all_waiting = 1;
+    for (i = 0; i < shared->nworkers && all_waiting; ++i)
+    {
+      if (shared->slots[i].weight > 0 && !shared->slots[i].waiting && !shared->slots[i].idle)
+      {
+        all_waiting = 0;
+      }
+    }
+    if (all_waiting)
+    {
+      sched_refill();
+      continue;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += SCHED_MAX_WAIT_MS * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+      deadline.tv_sec += 1;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    switch (pthread_cond_timedwait(&shared->refill, &shared->lock, &deadline))
+    {
+    case EOWNERDEAD:
+      pthread_mutex_consistent(&shared->lock);
+      break;
+    case ETIMEDOUT:
+      if (self->deficit < bytes)
+      {
+        ++shared->forced_rounds;
+        sched_refill();
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  self->deficit -= bytes;
+  self->bytes_sent += bytes;
+  --self->waiting;
+  pthread_mutex_unlock(&shared->lock);
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		sched_idle
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		void sched_idle(int idle)
+  --                        int idle:      1 while blocked on the client, 0 after
+  --
+  --	RETURNS:		
+  --     
+  --	NOTES:
+  --		Takes this worker's transfer out of the round while it has no credit from
+  --    its client, and puts it back. Going idle wakes the waiters so one of them
+  --    can start the next round straight away instead of after SCHED_MAX_WAIT_MS.
+  --    Calls nest (one per sender thread of a striped transfer): the transfer
+  --    counts as idle while any of them is.
+------------------------------------------------------------------------------------*/
+void sched_idle(int idle)
+{
+  if (self == NULL || self->weight == 0)
+  {
+    return;
+  }
+  sched_lock();
+  self->idle += idle ? 1 : -1;
+  if (idle)
+  {
+    pthread_cond_broadcast(&shared->refill);
+  }
+  pthread_mutex_unlock(&shared->lock);
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		dump_shares
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		void dump_shares(void)
+  --
+  --	RETURNS:		
+  --     
+  --	NOTES:
+  --		Prints, for every scheduled transfer, its weight and the bytes it sent since
+  --    the previous dump as a share of all scheduled bytes in that interval. Run by
+  --    the server on SIGUSR1.
+------------------------------------------------------------------------------------*/
+void dump_shares(void)
+{
+  int i;
+  unsigned long delta;
+  unsigned long total = 0;
+  sched_lock();
+  for (i = 0; i < shared->nworkers; ++i)
+  {
+    if (shared->slots[i].weight > 0)
+    {
+      total += shared->slots[i].bytes_sent - shared->slots[i].bytes_reported;
+    }
+  }
+  printf("shares: %lu bytes scheduled, %lu rounds (%lu forced)\n",
+         total, shared->rounds, shared->forced_rounds);
+  for (i = 0; i < shared->nworkers; ++i)
+  {
+    struct worker_slot *slot = &shared->slots[i];
+    if (slot->weight > 0)
+    {
+      delta = slot->bytes_sent - slot->bytes_reported;
+      printf("  client %d weight %d: %lu bytes, %.1f%%\n", slot->client_pid, slot->weight,
+             delta, total > 0 ? 100.0 * delta / total : 0.0);
+      slot->bytes_reported = slot->bytes_sent;
+    }
+  }
+  pthread_mutex_unlock(&shared->lock);
+  fflush(stdout);
+}
+
+// qsort order of admission waits
+static int cmp_wait(const void *a, const void *b)
+{
+  long long x = *(const long long *)a;
+  long long y = *(const long long *)b;
+  return x < y ? -1 : x > y;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		serve_stats
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --                Oct 16, 2026 - backlog depth, admission counters and waits
+  --                Oct 16, 2026 - engine and transfer cap apart from the workers
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int serve_stats(int msg_qid, pid_t client_pid,
+  --                                struct worker_stats *table, int n,
+  --                                struct backlog *bl)
+  --                     int msg_qid:      message queue id
+  --                pid_t client_pid:      who sent the CMD_STATS
+  --      struct worker_stats *table:      live counters to sum up
+  --                           int n:      entries in table
+  --             struct backlog *bl:      the pool's admission control, NULL for
+  --                                       the uring engine (which has none)
+  --
+  --	RETURNS:		
+  --					 0    on success
+  --          -1    if the reply could not be queued
+  --	NOTES:
+  --		Answers a CMD_STATS with a struct srv_stats: the engine, its processes and
+  --    its cap on concurrent transfers (n either way), the counters of every entry
+  --    added up, plus one row for each busy entry (the first STATS_ROWS_MAX), and
+  --    the backlog's depth and counters with the median and 99th percentile of
+  --    the last BACKLOG_WAIT_SAMPLES admission waits. Only reads the counters, so
+  --    it never waits for a worker. The reply is sent without blocking; if the
+  --    queue is full it is dropped and the client times out, rather than the
+  --    listener stalling.
+------------------------------------------------------------------------------------*/
+int serve_stats(int msg_qid, pid_t client_pid, struct worker_stats *table, int n,
+                struct backlog *bl)
+{
+  Mesg reply;
+  struct srv_stats *st = (struct srv_stats *)reply.mesg_data;
+  struct worker_stats *ws;
+  struct xfer_stats *row;
+  struct timespec now;
+  long long waits[BACKLOG_WAIT_SAMPLES];
+  long long started;
+  long long now_at;
+  int nwaits;
+  int i;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  now_at = now.tv_sec * 1000000000LL + now.tv_nsec;
+  memset(st, 0, sizeof(*st));
+  st->uptime_us = elapsed_us(&stats_epoch, &now);
+  st->engine = bl != NULL ? ENGINE_POOL : ENGINE_URING;
+  st->workers = bl != NULL ? n : 1;
+  st->max_xfers = n;
+  for (i = 0; i < n; ++i)
+  {
+    ws = &table[i];
+    st->bytes += __atomic_load_n(&ws->bytes, __ATOMIC_RELAXED);
+    st->packets += __atomic_load_n(&ws->packets, __ATOMIC_RELAXED);
+    st->send_failures += __atomic_load_n(&ws->send_failures, __ATOMIC_RELAXED);
+    st->stalls += __atomic_load_n(&ws->stalls, __ATOMIC_RELAXED);
+    st->transfers += __atomic_load_n(&ws->transfers, __ATOMIC_RELAXED);
+    st->busy_us += __atomic_load_n(&ws->busy_ns, __ATOMIC_RELAXED) / 1000;
+    if ((started = __atomic_load_n(&ws->started_ns, __ATOMIC_ACQUIRE)) == 0)
+    {
+      continue;
+    }
+    ++st->active;
+    if (st->rows < STATS_ROWS_MAX)
+    {
+      row = &st->xfers[st->rows++];
+      row->worker_pid = ws->pid;
+      row->client_pid = ws->client_pid;
+      row->priority = ws->priority;
+      row->bytes = __atomic_load_n(&ws->bytes, __ATOMIC_RELAXED) - ws->start_bytes;
+      row->packets = __atomic_load_n(&ws->packets, __ATOMIC_RELAXED) - ws->start_packets;
+      row->elapsed_us = now_at > started ? (now_at - started) / 1000 : 0;
+    }
+  }
+  st->backlog_cap = -1;
+  if (bl != NULL)
+  {
+    st->backlog = bl->len;
+    st->backlog_cap = bl->cap;
+    st->admitted = bl->dispatched;
+    st->queued = bl->queued;
+    st->rejected = bl->rejected;
+    st->shed = bl->shed;
+    st->abandoned = bl->abandoned;
+    st->wait_max_us = bl->wait_max_us;
+    nwaits = bl->dispatched < BACKLOG_WAIT_SAMPLES ? (int)bl->dispatched : BACKLOG_WAIT_SAMPLES;
+    if (nwaits > 0)
+    {
+      memcpy(waits, bl->waits, nwaits * sizeof(waits[0]));
+      qsort(waits, nwaits, sizeof(waits[0]), cmp_wait);
+      st->wait_p50_us = waits[(nwaits - 1) / 2];
+      st->wait_p99_us = waits[(nwaits - 1) * 99 / 100];
+    }
+  }
+  reply.mtype = client_pid;
+  reply.pid = getpid();
+  reply.mesg_cmd = CMD_STATS;
+  reply.mesg_flags = 0;
+  reply.mesg_seq = 0;
+  reply.mesg_crc = 0;
+  reply.mesg_sum = 0;
+  reply.mesg_offset = 0;
+  reply.mesg_count = 0;
+  reply.mesg_priority = 0;
+  reply.mesg_len = sizeof(*st);
+  if (msgsnd(msg_qid, &reply, MESGHDRSIZE + reply.mesg_len, IPC_NOWAIT) == -1)
+  {
+    perror("stats reply");
+    return -1;
+  }
+  return 0;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		spawn_worker
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int spawn_worker(int msg_qid, int slot)
+  --                     int msg_qid:      message queue id
+  --                        int slot:      index of the worker slot to fill
+  --
+  --	RETURNS:		
+  --					 pid  of the new worker (in the server)
+  --          -1    on fork failure
+  --	NOTES:
+  --		Forks one pool worker into the given slot. The worker never returns here.
+------------------------------------------------------------------------------------*/
+int spawn_worker(int msg_qid, int slot)
+{
+  pid_t pid;
+  fflush(stdout);
+  switch (pid = fork())
+  {
+  case -1:
+    perror("fork failed");
+    return -1;
+  case 0:
+    worker_loop(msg_qid, slot);
+    exit(0);
+  default:
+    shared->slots[slot].pid = pid;
+    return pid;
+  }
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		worker_loop
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --                Oct 16, 2026 - CMD_DONE to the listener after each request
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		void worker_loop(int msg_qid, int slot)
+  --                     int msg_qid:      message queue id
+  --                        int slot:      this worker's slot in the shared table
+  --
+  --	RETURNS:		
+  --     Does not return, exits the process
+  --	NOTES:
+  --		Body of a pre-forked pool worker. Blocks on DISPATCH_MSG and runs
+  --    server_transfer_proc for each request the server forwards. Queue transfers
+  --    are registered with the bandwidth scheduler for their duration. The server
+  --    never dispatches more requests than there are workers, so whichever worker
+  --    is idle takes the next one straight away; the rest wait in the server's
+  --    backlog. Each finished request is counted in the slot and announced with
+  --    a CMD_DONE on the listen mtype, waking the server to dispatch the next.
+  --    Exits on CMD_SHUTDOWN (queued behind pending requests, so they drain first)
+  --    or when the server dies.
+------------------------------------------------------------------------------------*/
+void worker_loop(int msg_qid, int slot)
+{
+  struct Mesg imsg;
+  struct Mesg done;
+  struct worker_slot *me = &shared->slots[slot];
+  struct timespec t_start, t_end;
+  long took_us;
+  self = me;
+  memset(&done, 0, offsetof(Mesg, mesg_data));
+  done.mtype = LISTEN_MSG;
+  done.pid = getpid();
+  done.mesg_cmd = CMD_DONE;
+  my_stats = &stats_table[slot];
+  // Ctrl-C should still just kill it, and it must not outlive the server
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  signal(SIGCHLD, SIG_DFL);
+  signal(SIGUSR1, SIG_IGN);
+  signal(SIGPIPE, SIG_IGN); /* a pipe transfer's client died: EPIPE instead */
+  prctl(PR_SET_PDEATHSIG, SIGTERM);
+  if (getppid() == 1)
+  {
+    exit(0);
+  }
+  printf("worker %d ready in slot %d\n", getpid(), slot);
+  while (1)
+  {
+    if (mesgq_read(msg_qid, DISPATCH_MSG, &imsg, -1) == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      perror("worker msgrcv");
+      exit(1);
+    }
+    if (imsg.mesg_cmd == CMD_SHUTDOWN)
+    {
+      printf("worker %d exiting after %lu jobs\n", getpid(), me->jobs);
+      exit(0);
+    }
+    ++me->taken;
+    me->client_pid = imsg.pid;
+    me->ndata_qids = 0;
+    me->replied = 0;
+    me->busy = 1;
+    if (imsg.mesg_cmd == CMD_FETCH && !(imsg.mesg_flags & (MESG_F_SHM | MESG_F_PIPE)))
+    {
+      sched_join(imsg.mesg_priority);
+    }
+    stats_begin(my_stats, imsg.pid, imsg.mesg_priority);
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    server_transfer_proc(msg_qid, imsg);
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+    stats_end(my_stats);
+    if (me->weight > 0)
+    {
+      took_us = elapsed_us(&t_start, &t_end);
+      printf("client %d weight %d: %lu bytes in %ld ms, %.2f MB/s\n", imsg.pid, me->weight,
+             me->bytes_sent, took_us / 1000, took_us > 0 ? (double)me->bytes_sent / took_us : 0.0);
+      sched_leave(me);
+    }
+    me->busy = 0;
+    ++me->jobs;
+    // Without blocking: if the queue is full the server catches up on its next wake-up
+    msgsnd(msg_qid, &done, MESGHDRSIZE, IPC_NOWAIT);
+    printf("proc function finished\n");
+  }
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		reap_workers
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --                Oct 16, 2026 - count the request a dead worker was serving as done
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		void reap_workers(int msg_qid)
+  --                     int msg_qid:      message queue id
+  --
+  --	RETURNS:		
+  --     
+  --	NOTES:
+  --		Collects every exited worker so no zombies are left behind. A worker that
+  --    died in the middle of a transfer gets its client an error end message, so the
+  --    client does not wait for data that will never come, and the request is
+  --    counted as finished so the backlog does not hold a place for it. While the
+  --    server is still running the slot is refilled with a fresh worker.
+------------------------------------------------------------------------------------*/
+void reap_workers(int msg_qid)
+{
+  pid_t pid;
+  int status;
+  int i;
+  Mesg emsg;
+  child_exited = 0;
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+  {
+    for (i = 0; i < shared->nworkers; ++i)
+    {
+      if (shared->slots[i].pid == pid)
+      {
+        break;
+      }
+    }
+    if (i == shared->nworkers)
+    {
+      continue;
+    }
+    printf("worker %d in slot %d exited, status %d\n", pid, i, status);
+    shared->slots[i].pid = 0;
+    shared->slots[i].jobs = shared->slots[i].taken;
+    if (shared->slots[i].busy)
+    {
+      // A client reading private queues learns from their removal (EIDRM); one
+      // still waiting for the reply, or on a ring, polls the shared queue
+      remove_queues(shared->slots[i].data_qids, shared->slots[i].ndata_qids);
+      if (shared->slots[i].ndata_qids == 0 || !shared->slots[i].replied)
+      {
+        const char *crash_err = "Transfer worker crashed";
+        emsg.mtype = shared->slots[i].client_pid;
+        emsg.pid = getpid();
+        emsg.mesg_cmd = CMD_FETCH;
+        emsg.mesg_flags = MESG_F_ERROR;
+        emsg.mesg_priority = -1;
+        strcpy(emsg.mesg_data, crash_err);
+        emsg.mesg_len = strlen(crash_err);
+        mesgq_send(msg_qid, &emsg);
+      }
+      shared->slots[i].busy = 0;
+    }
+    if (stats_table[i].started_ns != 0)
+    {
+      stats_end(&stats_table[i]);
+    }
+    sched_leave(&shared->slots[i]);
+    if (running)
+    {
+      spawn_worker(msg_qid, i);
+    }
+  }
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		uring_setup
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int uring_setup(struct uring *ur, unsigned entries)
+  --               struct uring *ur:      rings to fill in
+  --               unsigned entries:      submission queue depth
+  --
+  --	RETURNS:		
+  --					 0    on success
+  --          -1    on failure (no io_uring in this kernel, or not permitted)
+  --	NOTES:
+  --		Creates an io_uring instance with the raw syscalls and maps its rings.
+------------------------------------------------------------------------------------*/
+int uring_setup(struct uring *ur, unsigned entries)
+{
+  struct io_uring_params params;
+  void *sq;
+  void *cq;
+  size_t sq_size;
+  size_t cq_size;
+  memset(&params, 0, sizeof(params));
+  memset(ur, 0, sizeof(*ur));
+  if ((ur->fd = syscall(__NR_io_uring_setup, entries, &params)) == -1)
+  {
+    return -1;
+  }
+  sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if ((params.features & IORING_FEAT_SINGLE_MMAP) && cq_size > sq_size)
+  {
+    sq_size = cq_size;
+  }
+  sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ur->fd, IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED)
+  {
+    close(ur->fd);
+    return -1;
+  }
+  cq = sq;
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+  {
+    cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+              ur->fd, IORING_OFF_CQ_RING);
+    if (cq == MAP_FAILED)
+    {
+      close(ur->fd);
+      return -1;
+    }
+  }
+  ur->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+                  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQES);
+  if (ur->sqes == MAP_FAILED)
+  {
+    close(ur->fd);
+    return -1;
+  }
+  ur->sq_head = (unsigned *)((char *)sq + params.sq_off.head);
+  ur->sq_tail = (unsigned *)((char *)sq + params.sq_off.tail);
+  ur->sq_mask = (unsigned *)((char *)sq + params.sq_off.ring_mask);
+  ur->sq_array = (unsigned *)((char *)sq + params.sq_off.array);
+  ur->cq_head = (unsigned *)((char *)cq + params.cq_off.head);
+  ur->cq_tail = (unsigned *)((char *)cq + params.cq_off.tail);
+  ur->cq_mask = (unsigned *)((char *)cq + params.cq_off.ring_mask);
+  ur->cqes = (struct io_uring_cqe *)((char *)cq + params.cq_off.cqes);
+  ur->sq_entries = params.sq_entries;
+  return 0;
+}
+
+// Next free submission entry, or NULL when the submission ring is full
+static struct io_uring_sqe *uring_get_sqe(struct uring *ur)
+{
+  unsigned tail = *ur->sq_tail;
+  unsigned index;
+  if (tail - __atomic_load_n(ur->sq_head, __ATOMIC_ACQUIRE) >= ur->sq_entries)
+  {
+    return NULL;
+  }
+  index = tail & *ur->sq_mask;
+  memset(&ur->sqes[index], 0, sizeof(struct io_uring_sqe));
+  ur->sq_array[index] = index;
+  __atomic_store_n(ur->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ++ur->pending;
+  return &ur->sqes[index];
+}
+
+// Submits queued entries, optionally blocking until one completion is ready
+static int uring_enter(struct uring *ur, int wait)
+{
+  int result;
+  result = syscall(__NR_io_uring_enter, ur->fd, ur->pending, wait ? 1 : 0,
+                   wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  if (result >= 0)
+  {
+    ur->pending = 0;
+  }
+  return result;
+}
+
+// Packet buffer for seq: a slot of the client's ring, or a staging packet
+static Mesg *uring_buf(struct uring_xfer *x, unsigned seq)
+{
+  if (x->ring != NULL)
+  {
+    return &x->ring->slots[seq % SHM_RING_SLOTS];
+  }
+  return &x->bufs[seq % URING_XFER_BUFS];
+}
+
+// Sets up a transfer slot for a new request, replying with an error on failure.
+// active counts the transfers in progress with this one, for tune_queue.
+static int uring_start(int msg_qid, struct uring_xfer *x, Mesg *imsg, int active)
+{
+  struct stat st;
+  struct file_info info;
+  int i;
+  if (imsg->mesg_flags & (MESG_F_BATCH | MESG_F_MANIFEST))
+  {
+    refuse_client(msg_qid, imsg->pid, "Batch requests need the pool engine");
+    return -1;
+  }
+  if (imsg->mesg_flags & MESG_F_PIPE)
+  {
+    refuse_client(msg_qid, imsg->pid, "Pipe transfers need the pool engine");
+    return -1;
+  }
+  if (imsg->mesg_cmd == CMD_STAT || (imsg->mesg_flags & MESG_F_RANGE))
+  {
+    refuse_client(msg_qid, imsg->pid, "Range requests need the pool engine");
+    return -1;
+  }
+  if ((x->fd = open(imsg->mesg_data, O_RDONLY)) == -1 || fstat(x->fd, &st) == -1)
+  {
+    printf("file open failed: %s\n", imsg->mesg_data);
+    if (x->fd != -1)
+    {
+      close(x->fd);
+    }
+    refuse_client(msg_qid, imsg->pid, "File Open error");
+    return -1;
+  }
+  x->ring = NULL;
+  if ((imsg->mesg_flags & MESG_F_SHM) && (x->ring = ring_attach(imsg->pid)) == NULL)
+  {
+    close(x->fd);
+    refuse_client(msg_qid, imsg->pid, "Shared memory attach error");
+    return -1;
+  }
+  if (x->ring == NULL && x->bufs == NULL &&
+      (x->bufs = malloc(URING_XFER_BUFS * sizeof(Mesg))) == NULL)
+  {
+    close(x->fd);
+    refuse_client(msg_qid, imsg->pid, "Server out of memory");
+    return -1;
+  }
+  x->packet_size = base_packet_size(imsg->mesg_priority);
+  x->data_qid = -1;
+  if (x->ring == NULL && (x->data_qid = msgget(IPC_PRIVATE, IPC_CREAT | 0660)) == -1)
+  {
+    perror("data queue");
+    close(x->fd);
+    refuse_client(msg_qid, imsg->pid, "Data queue error");
+    return -1;
+  }
+  memset(&info, 0, sizeof(info));
+  if (x->data_qid != -1)
+  {
+    tune_queue(x->data_qid, TUNE_QUEUE_BUDGET / active, &x->packet_size, &info.window);
+  }
+  info.size = st.st_size;
+  info.mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  info.packet_size = x->packet_size;
+  info.stripes = x->data_qid != -1;
+  info.data_qids[0] = x->data_qid;
+  info.files = 1;
+  if (send_fileinfo(msg_qid, NULL, imsg->pid, imsg->mesg_priority, &info, imsg->mesg_data) == -1)
+  {
+    close(x->fd);
+    if (x->ring != NULL)
+    {
+      ring_close(x->ring, imsg->pid);
+    }
+    else
+    {
+      msgctl(x->data_qid, IPC_RMID, NULL);
+    }
+    return -1;
+  }
+  x->client_pid = imsg->pid;
+  x->priority = imsg->mesg_priority;
+  x->weight = imsg->mesg_priority < 1 ? 1 : (imsg->mesg_priority > SCHED_WEIGHT_MAX ? SCHED_WEIGHT_MAX : imsg->mesg_priority);
+  x->credits = 0;
+  x->gone = 0;
+  x->read_seq = 0;
+  x->send_seq = 0;
+  x->reading = 0;
+  x->eof_seen = 0;
+  x->done = 0;
+  x->bytes = 0;
+  x->sum = 0;
+  x->blocked = 0;
+  for (i = 0; i < URING_XFER_BUFS; ++i)
+  {
+    x->state[i] = 0;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &x->started);
+  x->active = 1;
+  printf("uring transfer to %d started: %s, packet %d, shm %d\n", x->client_pid,
+         imsg->mesg_data, x->packet_size, x->ring != NULL);
+  return 0;
+}
+
+// Notes that a transfer could not make progress; drops it if its client is gone
+static void uring_stalled(int msg_qid, struct uring_xfer *x)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (!x->blocked)
+  {
+    x->blocked = 1;
+    x->blocked_since = now;
+  }
+  else if (elapsed_us(&x->blocked_since, &now) > URING_STALL_MS * 1000L)
+  {
+    if (kill(MESG_PID(x->client_pid), 0) == -1 && errno == ESRCH)
+    {
+      printf("client %d went away\n", x->client_pid);
+      purge_client(msg_qid, x->client_pid);
+      x->done = 1;
+      x->gone = 1;
+    }
+    x->blocked_since = now;
+  }
+}
+
+// Sends up to weight ready packets in order and queues reads to refill the
+// buffers, counting them in ws. Returns the number of packets sent.
+static int uring_pump(int msg_qid, struct uring *ur, struct uring_xfer *x, int index,
+                      struct worker_stats *ws)
+{
+  int sent = 0;
+  int b;
+  Mesg *pkt;
+  Mesg cmsg;
+  unsigned int sum;
+  struct io_uring_sqe *sqe;
+  // Pick up credit grants only once they are needed
+  while (!x->done && x->ring == NULL && x->credits <= 0 &&
+         mesgq_read(x->data_qid, getpid(), &cmsg, 0) != -1)
+  {
+    if (cmsg.mesg_cmd == CMD_CREDIT && cmsg.mesg_len == sizeof(int))
+    {
+      x->credits += *(int *)cmsg.mesg_data;
+    }
+  }
+  while (!x->done && sent < x->weight)
+  {
+    b = x->send_seq % URING_XFER_BUFS;
+    if (x->state[b] != 2)
+    {
+      break;
+    }
+    if (x->ring == NULL && x->credits <= 0)
+    {
+      uring_stalled(msg_qid, x);
+      break;
+    }
+    pkt = uring_buf(x, x->send_seq);
+    pkt->mtype = x->client_pid;
+    pkt->pid = getpid();
+    pkt->mesg_cmd = CMD_FETCH;
+    pkt->mesg_seq = x->send_seq;
+    pkt->mesg_offset = (off_t)x->send_seq * x->packet_size;
+    if (x->len[b] < 0)
+    {
+      read_failed(pkt, -x->len[b]);
+      sum = x->sum;
+    }
+    else
+    {
+      pkt->mesg_flags = 0;
+      pkt->mesg_count = 0;
+      pkt->mesg_len = x->len[b];
+      pkt->mesg_priority = x->len[b] == x->packet_size ? x->priority : -1;
+      // Done again if the send has to be retried, so the sum only moves once it went
+      pkt->mesg_crc = mesgq_crc32c(0, pkt->mesg_data, pkt->mesg_len);
+      sum = mesgq_crc32c_combine(x->sum, pkt->mesg_crc, pkt->mesg_len);
+      pkt->mesg_sum = pkt->mesg_priority == -1 ? sum : 0;
+    }
+    if (x->ring != NULL)
+    {
+      ring_advance(&x->ring->head, &x->ring->head_waiters);
+    }
+    else if (msgsnd(x->data_qid, pkt, MESGHDRSIZE + pkt->mesg_len, IPC_NOWAIT) == -1)
+    {
+      if (errno == EAGAIN || errno == EINTR)
+      {
+        if (errno == EAGAIN && !x->blocked)
+        {
+          stats_add(&ws->stalls, 1);
+        }
+        uring_stalled(msg_qid, x);
+        break;
+      }
+      perror("uring msgsnd");
+      stats_add(&ws->send_failures, 1);
+      x->done = 1;
+      break;
+    }
+    x->blocked = 0;
+    x->state[b] = 0;
+    x->sum = sum;
+    if (x->ring == NULL)
+    {
+      --x->credits;
+    }
+    x->bytes += x->len[b] > 0 ? x->len[b] : 0;
+    stats_add(&ws->bytes, x->len[b] > 0 ? x->len[b] : 0);
+    stats_add(&ws->packets, 1);
+    ++x->send_seq;
+    ++sent;
+    if (pkt->mesg_priority == -1)
+    {
+      x->done = 1;
+    }
+  }
+  while (!x->done && !x->eof_seen && x->read_seq - x->send_seq < URING_XFER_BUFS)
+  {
+    if (x->ring != NULL &&
+        x->read_seq - __atomic_load_n(&x->ring->tail, __ATOMIC_ACQUIRE) >= SHM_RING_SLOTS)
+    {
+      if (!x->blocked)
+      {
+        stats_add(&ws->stalls, 1);
+      }
+      uring_stalled(msg_qid, x);
+      break;
+    }
+    if ((sqe = uring_get_sqe(ur)) == NULL)
+    {
+      break;
+    }
+    b = x->read_seq % URING_XFER_BUFS;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = x->fd;
+    sqe->addr = (unsigned long)uring_buf(x, x->read_seq)->mesg_data;
+    sqe->len = x->packet_size;
+    sqe->off = (unsigned long long)x->read_seq * x->packet_size;
+    sqe->user_data = (unsigned long long)index * URING_XFER_BUFS + b;
+    x->state[b] = 1;
+    ++x->reading;
+    ++x->read_seq;
+  }
+  return sent;
+}
+
+// Releases a finished transfer once no read still targets its buffers
+static int uring_finish(int msg_qid, struct uring_xfer *x)
+{
+  struct timespec now;
+  long took_us;
+  Mesg stale;
+  if (!x->done || x->reading > 0)
+  {
+    return 0;
+  }
+  if (x->data_qid != -1)
+  {
+    // Like linger_data_queue: keep the queue until the client removes it or dies
+    if (!x->gone && (mesgq_read(x->data_qid, getpid(), &stale, 0) != -1 ||
+                     (errno != EIDRM && errno != EINVAL)))
+    {
+      uring_stalled(msg_qid, x);
+      return 0;
+    }
+    msgctl(x->data_qid, IPC_RMID, NULL);
+    x->data_qid = -1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  took_us = elapsed_us(&x->started, &now);
+  printf("client %d weight %d: %lu bytes in %ld ms, %.2f MB/s\n", x->client_pid, x->weight,
+         x->bytes, took_us / 1000, took_us > 0 ? (double)x->bytes / took_us : 0.0);
+  close(x->fd);
+  if (x->ring != NULL)
+  {
+    ring_close(x->ring, x->client_pid);
+    x->ring = NULL;
+  }
+  x->active = 0;
+  return 1;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		uring_server
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int uring_server(int msg_qid, int max_xfers)
+  --                     int msg_qid:      message queue id
+  --                   int max_xfers:      cap on concurrent transfers
+  --
+  --	RETURNS:		
+  --					 0    on success
+  --          -1    if io_uring is not available (nothing was served)
+  --	NOTES:
+  --		Single process transfer engine. Every pass of the loop
+  --      (1) takes new requests off LISTEN_MSG while there is room (blocking only
+  --          when nothing is active; extra requests wait in the queue)
+  --      (2) for every active transfer, sends up to weight ready packets in order
+  --          (msgsnd with IPC_NOWAIT, or publishing a ring slot) and queues reads
+  --          for up to URING_XFER_BUFS packets ahead
+  --      (3) submits the reads and collects completions, blocking for one only
+  --          when nothing else made progress
+  --    When every transfer is waiting on its client (full queue or ring) it backs
+  --    off for URING_BACKOFF_US rather than spin. A transfer stuck for more than
+  --    URING_STALL_MS has its client checked and is dropped if it is gone.
+  --    Requests to stripe a transfer are served over a single data queue.
+  --    CMD_SHUTDOWN or SIGINT/SIGTERM stop new requests; active ones finish.
+  --    CMD_STATS is answered from counters kept per transfer slot, taken off
+  --    LISTEN_MSG like a request (so not while every slot is in use).
+  --    Context switches and transfer totals are printed on exit.
+------------------------------------------------------------------------------------*/
+int uring_server(int msg_qid, int max_xfers)
+{
+  struct uring ur;
+  struct uring_xfer *xfers;
+  struct worker_stats *xstats;
+  struct io_uring_cqe *cqe;
+  struct rusage usage;
+  Mesg imsg;
+  unsigned head;
+  int accepting = 1;
+  int nactive = 0;
+  int inflight = 0;
+  int progress;
+  int timeout;
+  int i;
+  int b;
+  unsigned long served = 0;
+  unsigned long total_bytes = 0;
+  if (uring_setup(&ur, URING_ENTRIES) == -1)
+  {
+    perror("io_uring_setup");
+    return -1;
+  }
+  if ((xfers = calloc(max_xfers, sizeof(struct uring_xfer))) == NULL)
+  {
+    close(ur.fd);
+    return -1;
+  }
+  xstats = mmap(NULL, max_xfers * sizeof(struct worker_stats), PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (xstats == MAP_FAILED)
+  {
+    free(xfers);
+    close(ur.fd);
+    return -1;
+  }
+  printf("uring engine running %d, up to %d transfers\n", getpid(), max_xfers);
+  while (accepting || nactive > 0)
+  {
+    // (1) new requests
+    timeout = nactive == 0 ? REAP_INTERVAL_MS : 0;
+    while (accepting && running && nactive < max_xfers &&
+           mesgq_read(msg_qid, LISTEN_MSG, &imsg, timeout) != -1)
+    {
+      timeout = 0;
+      if (imsg.mesg_cmd == CMD_SHUTDOWN)
+      {
+        printf("shutdown requested by pid %d\n", imsg.pid);
+        accepting = 0;
+        break;
+      }
+      if (imsg.mesg_cmd == CMD_STATS)
+      {
+        serve_stats(msg_qid, imsg.pid, xstats, max_xfers, NULL);
+        continue;
+      }
+      for (i = 0; xfers[i].active; ++i)
+      {
+      }
+      if (uring_start(msg_qid, &xfers[i], &imsg, nactive + 1) == 0)
+      {
+        stats_begin(&xstats[i], imsg.pid, imsg.mesg_priority);
+        ++nactive;
+      }
+    }
+    if (!running)
+    {
+      accepting = 0;
+    }
+
+    // (2) sends and read-ahead
+    progress = 0;
+    for (i = 0; i < max_xfers; ++i)
+    {
+      if (xfers[i].active)
+      {
+        inflight -= xfers[i].reading;
+        progress += uring_pump(msg_qid, &ur, &xfers[i], i, &xstats[i]);
+        inflight += xfers[i].reading;
+        if (uring_finish(msg_qid, &xfers[i]))
+        {
+          stats_end(&xstats[i]);
+          --nactive;
+          ++served;
+          total_bytes += xfers[i].bytes;
+          ++progress;
+        }
+      }
+    }
+
+    // (3) submit and complete reads
+    if (ur.pending > 0 || inflight > 0)
+    {
+      if (uring_enter(&ur, progress == 0 && inflight > 0) == -1 && errno != EINTR)
+      {
+        perror("io_uring_enter");
+        break;
+      }
+    }
+    head = *ur.cq_head;
+    while (head != __atomic_load_n(ur.cq_tail, __ATOMIC_ACQUIRE))
+    {
+      cqe = &ur.cqes[head & *ur.cq_mask];
+      i = cqe->user_data / URING_XFER_BUFS;
+      b = cqe->user_data % URING_XFER_BUFS;
+      if (cqe->res < 0)
+      {
+        errno = -cqe->res;
+        perror("uring read");
+      }
+      xfers[i].len[b] = cqe->res; /* -errno: uring_pump ends the file with the error */
+      xfers[i].state[b] = 2;
+      if (xfers[i].len[b] < xfers[i].packet_size)
+      {
+        xfers[i].eof_seen = 1;
+      }
+      --xfers[i].reading;
+      --inflight;
+      ++progress;
+      ++head;
+    }
+    __atomic_store_n(ur.cq_head, head, __ATOMIC_RELEASE);
+    if (progress == 0 && nactive > 0)
+    {
+      usleep(URING_BACKOFF_US);
+    }
+  }
+  getrusage(RUSAGE_SELF, &usage);
+  printf("uring engine served %lu transfers, %lu bytes, %ld voluntary / %ld involuntary ctx switches\n",
+         served, total_bytes, usage.ru_nvcsw, usage.ru_nivcsw);
+  for (i = 0; i < max_xfers; ++i)
+  {
+    free(xfers[i].bufs);
+  }
+  free(xfers);
+  munmap(xstats, max_xfers * sizeof(struct worker_stats));
+  close(ur.fd);
+  return 0;
+}
+
+// Requests handed to the pool and not finished yet, in the dispatch queue or
+// being served
+static int pool_in_flight(struct backlog *bl)
+{
+  unsigned long done = 0;
+  int i;
+  for (i = 0; i < bl->nworkers; ++i)
+  {
+    done += shared->slots[i].jobs;
+  }
+  return (int)(bl->dispatched - done);
+}
+
+// Whether backlog entry a is to be served before b
+static int backlog_before(struct backlog_entry *a, struct backlog_entry *b)
+{
+  if (a->msg->mesg_priority != b->msg->mesg_priority)
+  {
+    return a->msg->mesg_priority > b->msg->mesg_priority;
+  }
+  return a->seq < b->seq;
+}
+
+static void backlog_sift_up(struct backlog *bl, int i)
+{
+  struct backlog_entry e = bl->heap[i];
+  while (i > 0 && backlog_before(&e, &bl->heap[(i - 1) / 2]))
+  {
+    bl->heap[i] = bl->heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  bl->heap[i] = e;
+}
+
+static void backlog_sift_down(struct backlog *bl, int i)
+{
+  struct backlog_entry e = bl->heap[i];
+  int child;
+  while ((child = 2 * i + 1) < bl->len)
+  {
+    if (child + 1 < bl->len && backlog_before(&bl->heap[child + 1], &bl->heap[child]))
+    {
+      ++child;
+    }
+    if (!backlog_before(&bl->heap[child], &e))
+    {
+      break;
+    }
+    bl->heap[i] = bl->heap[child];
+    i = child;
+  }
+  bl->heap[i] = e;
+}
+
+// Takes entry i out of the heap, which keeps its order
+static struct backlog_entry backlog_take(struct backlog *bl, int i)
+{
+  struct backlog_entry e = bl->heap[i];
+  if (i != --bl->len)
+  {
+    bl->heap[i] = bl->heap[bl->len];
+    backlog_sift_up(bl, i);
+    backlog_sift_down(bl, i);
+  }
+  return e;
+}
+
+// How long a client turned away should wait before asking again: the backlog
+// ahead of it and the requests in progress, served at the pool's mean service
+// time so far. Requests in progress count with the time they have taken yet, so
+// there is an estimate before the first one ends.
+static int retry_after_ms(struct backlog *bl)
+{
+  unsigned long long busy_ns = 0;
+  unsigned long long served = 0;
+  long long now = now_ns();
+  long long started;
+  long long ms;
+  int i;
+  for (i = 0; i < bl->nworkers; ++i)
+  {
+    busy_ns += __atomic_load_n(&stats_table[i].busy_ns, __ATOMIC_RELAXED);
+    served += __atomic_load_n(&stats_table[i].transfers, __ATOMIC_RELAXED);
+    if ((started = __atomic_load_n(&stats_table[i].started_ns, __ATOMIC_ACQUIRE)) != 0 &&
+        now > started)
+    {
+      busy_ns += now - started;
+      ++served;
+    }
+  }
+  ms = served > 0 ? (long long)(busy_ns / served / 1000000) : BUSY_RETRY_MIN_MS;
+  ms = ms * (bl->len + bl->nworkers) / bl->nworkers;
+  return ms < BUSY_RETRY_MIN_MS ? BUSY_RETRY_MIN_MS
+                                : (ms > BACKLOG_MAX_WAIT_MS ? BACKLOG_MAX_WAIT_MS : (int)ms);
+}
+
+// Answers a request with CMD_BUSY. Sent without blocking, like the stats reply:
+// with the queue full it is dropped and the client times out instead.
+static void send_busy(int msg_qid, struct backlog *bl, pid_t client_pid, const char *why)
+{
+  Mesg reply;
+  int retry_ms = retry_after_ms(bl);
+  reply.mtype = client_pid;
+  reply.pid = getpid();
+  reply.mesg_cmd = CMD_BUSY;
+  reply.mesg_flags = MESG_F_ERROR;
+  reply.mesg_seq = 0;
+  reply.mesg_crc = 0;
+  reply.mesg_sum = 0;
+  reply.mesg_offset = 0;
+  reply.mesg_count = retry_ms;
+  reply.mesg_priority = -1;
+  reply.mesg_len = snprintf(reply.mesg_data, MAXMESSAGEDATA, "Server busy (%s), retry in %d ms",
+                            why, retry_ms);
+  if (msgsnd(msg_qid, &reply, MESGHDRSIZE + reply.mesg_len, IPC_NOWAIT) == -1)
+  {
+    perror("busy reply");
+  }
+}
+
+// Hands a request to the pool, noting how long it waited for a worker. One that
+// cannot be handed over is answered busy, so its client does not wait in vain.
+static int backlog_dispatch(int msg_qid, struct backlog *bl, Mesg *msg, long long queued_ns)
+{
+  long long wait_us = (now_ns() - queued_ns) / 1000;
+  msg->mtype = DISPATCH_MSG;
+  if (mesgq_send(msg_qid, msg) == -1)
+  {
+    perror("dispatch");
+    send_busy(msg_qid, bl, msg->pid, "could not be dispatched");
+    return -1;
+  }
+  bl->waits[bl->dispatched % BACKLOG_WAIT_SAMPLES] = wait_us;
+  ++bl->dispatched;
+  if (wait_us > bl->wait_max_us)
+  {
+    bl->wait_max_us = wait_us;
+  }
+  return 0;
+}
+
+// Turns away every entry held longer than BACKLOG_MAX_WAIT_MS, so the wait for
+// a worker stays bounded and its client hears so while it is still listening
+static void backlog_shed(int msg_qid, struct backlog *bl, long long now)
+{
+  int i;
+  int kept = 0;
+  for (i = 0; i < bl->len; ++i)
+  {
+    if (now - bl->heap[i].queued_ns < BACKLOG_MAX_WAIT_MS * 1000000LL)
+    {
+      bl->heap[kept++] = bl->heap[i];
+      continue;
+    }
+    send_busy(msg_qid, bl, bl->heap[i].msg->pid, "waited too long");
+    free(bl->heap[i].msg);
+    ++bl->shed;
+  }
+  if (kept == bl->len)
+  {
+    return;
+  }
+  printf("backlog: %d requests waited over %d ms, turned away\n", bl->len - kept,
+         BACKLOG_MAX_WAIT_MS);
+  bl->len = kept;
+  for (i = bl->len / 2 - 1; i >= 0; --i)
+  {
+    backlog_sift_down(bl, i);
+  }
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		admit_request
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int admit_request(int msg_qid, struct backlog *bl, Mesg *imsg)
+  --                     int msg_qid:      message queue id
+  --             struct backlog *bl:      the pool's admission control
+  --                      Mesg *imsg:      request read from the listen mtype
+  --
+  --	RETURNS:		
+  --					 0    if it went straight to a worker
+  --           1    if it waits in the backlog
+  --          -1    if it was turned away busy, or could not be dispatched (the
+  --                client is then told busy as well)
+  --	NOTES:
+  --		Decides what becomes of a request the pool is to serve. With a worker free
+  --    and nobody waiting it is dispatched at once. Otherwise it joins the backlog,
+  --    ordered by mesg_priority and then arrival. A full backlog makes room for it
+  --    only if it outranks the lowest request held, which is then the one turned
+  --    away; else the newcomer is. Either way the client gets a CMD_BUSY at once,
+  --    naming how long to wait before asking again, rather than waiting in vain.
+------------------------------------------------------------------------------------*/
+int admit_request(int msg_qid, struct backlog *bl, Mesg *imsg)
+{
+  struct backlog_entry e;
+  struct backlog_entry bumped;
+  int worst;
+  int i;
+  e.queued_ns = now_ns();
+  e.seq = bl->arrivals++;
+  if (bl->len == 0 && pool_in_flight(bl) < bl->nworkers)
+  {
+    return backlog_dispatch(msg_qid, bl, imsg, e.queued_ns);
+  }
+  if (bl->len == bl->cap)
+  {
+    // The lowest entry of a heap is one of its leaves
+    worst = -1;
+    for (i = bl->len / 2; i < bl->len; ++i)
+    {
+      if (worst == -1 || backlog_before(&bl->heap[worst], &bl->heap[i]))
+      {
+        worst = i;
+      }
+    }
+    ++bl->rejected;
+    if (worst == -1 || imsg->mesg_priority <= bl->heap[worst].msg->mesg_priority)
+    {
+      send_busy(msg_qid, bl, imsg->pid, "backlog full");
+      return -1;
+    }
+    bumped = backlog_take(bl, worst);
+    send_busy(msg_qid, bl, bumped.msg->pid, "bumped by a higher priority");
+    free(bumped.msg);
+  }
+  if ((e.msg = malloc(offsetof(Mesg, mesg_data) + imsg->mesg_len + 1)) == NULL)
+  {
+    send_busy(msg_qid, bl, imsg->pid, "out of memory");
+    ++bl->rejected;
+    return -1;
+  }
+  memcpy(e.msg, imsg, offsetof(Mesg, mesg_data) + imsg->mesg_len + 1);
+  bl->heap[bl->len++] = e;
+  backlog_sift_up(bl, bl->len - 1);
+  return 1;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		backlog_pump
+  --
+  --	DATE:			    Oct 16, 2026
+  --
+  --	REVISIONS:		Oct 16, 2026
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int backlog_pump(int msg_qid, struct backlog *bl, int drain)
+  --                     int msg_qid:      message queue id
+  --             struct backlog *bl:      the pool's admission control
+  --                       int drain:      dispatch everything held, the server is
+  --                                       shutting down
+  --
+  --	RETURNS:		
+  --					 n    requests dispatched
+  --	NOTES:
+  --		Hands the backlog's best requests to the pool while it has fewer in flight
+  --    than workers (or all of them, when draining). A request whose client is no
+  --    longer there is dropped instead; one the pool could not be handed is
+  --    answered CMD_BUSY. Every BACKLOG_SCAN_MS it also turns away
+  --    the requests held longer than BACKLOG_MAX_WAIT_MS.
+------------------------------------------------------------------------------------*/
+int backlog_pump(int msg_qid, struct backlog *bl, int drain)
+{
+  struct backlog_entry e;
+  long long now = now_ns();
+  int n = 0;
+  if (!drain && now - bl->scanned_ns >= BACKLOG_SCAN_MS * 1000000LL)
+  {
+    bl->scanned_ns = now;
+    backlog_shed(msg_qid, bl, now);
+  }
+  while (bl->len > 0 && (drain || pool_in_flight(bl) < bl->nworkers))
+  {
+    e = backlog_take(bl, 0);
+    if (kill(MESG_PID(e.msg->pid), 0) == -1 && errno == ESRCH)
+    {
+      ++bl->abandoned;
+    }
+    else if (backlog_dispatch(msg_qid, bl, e.msg, e.queued_ns) == 0)
+    {
+      ++bl->queued;
+      ++n;
+    }
+    free(e.msg);
+  }
+  return n;
+}
+
+/*------------------------------------------------------------------------------------
+  --	FUNCTION:		server
+  --
+  --	DATE:			    Mar 27, 2019
+  --
+  --	REVISIONS:		Mar 27, 2019
+  --                Oct 16, 2026 - blocking listen, shutdown on signal or CMD_SHUTDOWN
+  --                Oct 16, 2026 - pre-forked worker pool instead of fork per request
+  --                Oct 16, 2026 - io_uring engine option
+  --                Oct 16, 2026 - hot-file cache
+  --                Oct 16, 2026 - live transfer statistics
+  --                Oct 16, 2026 - admission control, priority ordered backlog
+  --
+  --	DESIGNERS:		Jacky Li
+  --
+  --	PROGRAMMER:		Jacky Li
+  --
+  --	INTERFACE:		int server(int msg_qid, int pool_size, int engine,
+  --                           size_t cache_bytes, int backlog)
+  --                     int msg_qid:      message queue id
+  --                   int pool_size:      number of transfer workers, which is also
+  --                                       the cap on concurrent transfers
+  --                      int engine:      ENGINE_POOL, or ENGINE_URING to serve
+  --                                       everything from this process (see
+  --                                       uring_server); pool_size is then the cap
+  --                                       on concurrent transfers
+  --              size_t cache_bytes:      size of the hot-file cache shared by the
+  --                                       workers, 0 for none
+  --                     int backlog:      requests the pool may hold while every
+  --                                       worker is busy, 0 to turn them away
+  --
+  --	RETURNS:		
+  --					 0    on success
+  --          -1    on unrecoverable error (pool setup failed, queue removed)
+  --	NOTES:
+  --     Server Mode:
+  --         (1) Open/Create a message queue on the OS (shared config on both Srv + Client)
+  --         (2) Pre-forks pool_size workers sharing a worker table
+  --         (3) Blocks until message queue has mtype MAXPID + 500
+  --              - CMD_FETCH: forwarded to DISPATCH_MSG for the next idle worker
+  --                if one is free, else held in the backlog (admit_request), or
+  --                answered CMD_BUSY when that is full
+  --              - CMD_DONE: a worker is free, the best request held goes to it
+  --                (backlog_pump); requests held past BACKLOG_MAX_WAIT_MS are
+  --                answered CMD_BUSY
+  --              - CMD_SHUTDOWN: stops listening
+  --              - CMD_STATS: answered here from the workers' live counters
+  --         (4) SIGINT/SIGTERM interrupt the wait and stop the server as well
+  --         (5) SIGCHLD (or the periodic wake-up) reaps and respawns workers
+  --         (6) SIGUSR1 prints the current bandwidth share of each transfer and
+  --             the cache counters
+  --         (7) On the way out, the backlog is dispatched and every worker told
+  --             to exit once the requests before it are served, and waited for
+------------------------------------------------------------------------------------*/
+int server(int msg_qid, int pool_size, int engine, size_t cache_bytes, int backlog)
+{
+  clock_gettime(CLOCK_MONOTONIC, &stats_epoch);
+  if (engine == ENGINE_URING)
+  {
+    if (uring_server(msg_qid, pool_size) == 0)
+    {
+      return 0;
+    }
+    printf("io_uring unavailable, falling back to the worker pool\n");
+    if (pool_size > POOL_SIZE_MAX)
+    {
+      pool_size = POOL_SIZE_DEFAULT;
+    }
+  }
+  printf("server function running %d, pool of %d workers\n", getpid(), pool_size);
+  struct Mesg imsg;
+  struct backlog bl;
+  int recv_len;
+  int i;
+  memset(&bl, 0, sizeof(bl));
+  bl.cap = backlog;
+  bl.nworkers = pool_size;
+  if ((bl.heap = malloc((backlog > 0 ? backlog : 1) * sizeof(struct backlog_entry))) == NULL)
+  {
+    perror("backlog");
+    return -1;
+  }
+  shared = mmap(NULL, sizeof(struct srv_shared), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED)
+  {
+    perror("mmap");
+    return -1;
+  }
+  memset(shared, 0, sizeof(struct srv_shared));
+  shared->nworkers = pool_size;
+  stats_table = mmap(NULL, pool_size * sizeof(struct worker_stats), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (stats_table == MAP_FAILED)
+  {
+    perror("mmap");
+    return -1;
+  }
+  if (sched_init() == -1)
+  {
+    printf("scheduler init failed\n");
+    return -1;
+  }
+  if (cache_bytes > 0 && cache_init(cache_bytes) == -1)
+  {
+    perror("cache");
+    return -1;
+  }
+  for (i = 0; i < pool_size; ++i)
+  {
+    if (spawn_worker(msg_qid, i) == -1)
+    {
+      return -1;
+    }
+  }
+  // Listen for incoming
+  while (running)
+  {
+    if (child_exited)
+    {
+      reap_workers(msg_qid);
+    }
+    if (dump_requested)
+    {
+      dump_requested = 0;
+      dump_shares();
+      cache_report();
+    }
+    backlog_pump(msg_qid, &bl, 0);
+    recv_len = mesgq_read(msg_qid, LISTEN_MSG, &imsg, REAP_INTERVAL_MS);
+    if (recv_len == -1)
+    {
+      if (errno == EINTR || errno == ETIMEDOUT)
+      {
+        child_exited = 1;
+        continue;
+      }
+      perror("msgrcv");
+      break;
+    }
+    if (imsg.mesg_cmd == CMD_SHUTDOWN)
+    {
+      printf("shutdown requested by pid %d\n", imsg.pid);
+      break;
+    }
+    if (imsg.mesg_cmd == CMD_STATS)
+    {
+      serve_stats(msg_qid, imsg.pid, stats_table, pool_size, &bl);
+      continue;
+    }
+    if (imsg.mesg_cmd == CMD_DONE)
+    {
+      continue;
+    }
+    // Message rec'd
+    printf("Init msg got size: %d\n", recv_len);
+    // Reads filename from IPC channel
+    printf("Incoming: prior:%d, type:%lu, pid:%d, incLen:%d\nmsg:%s\n",
+           imsg.mesg_priority,
+           imsg.mtype,
+           imsg.pid,
+           imsg.mesg_len,
+           imsg.mesg_data);
+    // Hand it to the pool, or hold it until a worker is free
+    admit_request(msg_qid, &bl, &imsg);
   }
-  return qid;
-}
+  printf("server %d stopped listening, %d requests held\n", getpid(), bl.len);
 
-/*------------------------------------------------------------------------------------
-  --	FUNCTION:		read_message
-  --
-  --	DATE:			    Mar 27, 2019
-  --
-  --	REVISIONS:		Mar 27, 2019
-  --
-  --	DESIGNERS:		Jacky Li
-  --
-  --	PROGRAMMER:		Jacky Li
-  --
-  --	INTERFACE:		int read_message(int qid, long mtype, struct Mesg *imsg)
-  --                  int qid:      message queue id
-  --               long mtype:      message mtype for the queue to identify
-  --               Mseg *imsg:      The message struct to be populated from the queue
-  --
-  --	RETURNS:		
-  --					n     number of bytes written to mtext[] array in message struct
-  --          -1    on failure       
-  --	NOTES:
-  --		Wrapper function for reading from a message queue
-------------------------------------------------------------------------------------*/
-int read_message(int qid, long mtype, struct Mesg *imsg)
-{
-  int result;
-  int length;
-  length = sizeof(struct Mesg) - sizeof(long);
-  if ((result = msgrcv(qid, imsg, length, mtype, IPC_NOWAIT)) == -1)
+  // Drain: what is held, then one shutdown per worker queued behind it
+  running = 0;
+  backlog_pump(msg_qid, &bl, 1);
+  free(bl.heap);
+  imsg.mtype = DISPATCH_MSG;
+  imsg.mesg_cmd = CMD_SHUTDOWN;
+  imsg.mesg_len = 0;
+  imsg.pid = getpid();
+  for (i = 0; i < pool_size; ++i)
   {
-    return (-1);
+    if (shared->slots[i].pid > 0 && msgsnd(msg_qid, &imsg, MESGHDRSIZE, 0) == -1)
+    {
+      perror("worker shutdown");
+    }
   }
-  return (result);
-}
-
-/*------------------------------------------------------------------------------------
-  --	FUNCTION:		send_message
-  --
-  --	DATE:			    Mar 27, 2019
-  --
-  --	REVISIONS:		Mar 27, 2019
-  --
-  --	DESIGNERS:		Jacky Li
-  --
-  --	PROGRAMMER:		Jacky Li
-  --
-  --	INTERFACE:		int send_message(int qid, Mesg *omsg)
-  --                  int qid:      message queue id
-  --               Mseg *omsg:      The message struct to be sent over to the queue
-  --
-  --	RETURNS:		
-  --					0     on success
-  --          -1    on failure       
-  --	NOTES:
-  --		Wrapper function for reading from a message queue
-------------------------------------------------------------------------------------*/
-int send_message(int qid, Mesg *omsg)
-{
-  int result;
-  int length = sizeof(Mesg) - sizeof(long);
-  if ((result = msgsnd(qid, omsg, length, 0)) < 0)
+  while (wait(NULL) > 0 || errno == EINTR)
   {
-    return -1;
   }
-  return (result);
+  cache_report();
+  return 0;
 }
 
 /*------------------------------------------------------------------------------------
-  --	FUNCTION:		clientThread
+  --	FUNCTION:		request_shutdown
   --
-  --	DATE:			    Mar 27, 2019
+  --	DATE:			    Oct 16, 2026
   --
-  --	REVISIONS:		Mar 27, 2019
+  --	REVISIONS:		Oct 16, 2026
   --
   --	DESIGNERS:		Jacky Li
   --
   --	PROGRAMMER:		Jacky Li
   --
-  --	INTERFACE:		void *clientThread(void *msg_qid)
-  --                  void *msg_qid:      void pointer to message queue id, to be used
+  --	INTERFACE:		int request_shutdown(int msg_qid)
+  --                     int msg_qid:      message queue id
   --
   --	RETURNS:		
-  --     
+  --					 0    on success
+  --          -1    on failure to send the control message
   --	NOTES:
-  --		Client thread function
+  --		Sends CMD_SHUTDOWN to the server's listen mtype, waking it from its blocking
+  --    receive so it exits without needing a signal.
 ------------------------------------------------------------------------------------*/
-void *clientThread(void *msg_qid)
+int request_shutdown(int msg_qid)
 {
-  printf("client thread initiated, passed in qid: %d\n", *(int *)msg_qid);
-  while (1)
+  Mesg omsg;
+  omsg.mtype = LISTEN_MSG;
+  omsg.mesg_cmd = CMD_SHUTDOWN;
+  omsg.mesg_len = 0;
+  omsg.mesg_priority = 0;
+  omsg.pid = getpid();
+  omsg.mesg_data[0] = '\0';
+  if (mesgq_send(msg_qid, &omsg) == -1)
   {
+    perror("shutdown request");
+    return -1;
   }
+  printf("shutdown sent to %d\n", msg_qid);
   return 0;
 }
 
 /*------------------------------------------------------------------------------------
-  --	FUNCTION:		client
+  --	FUNCTION:		request_stats
   --
-  --	DATE:			    Mar 27, 2019
+  --	DATE:			    Oct 16, 2026
   --
-  --	REVISIONS:		Mar 27, 2019
+  --	REVISIONS:		Oct 16, 2026
+  --                Oct 16, 2026 - backlog and admission waits
+  --                Oct 16, 2026 - engine and transfer cap
   --
   --	DESIGNERS:		Jacky Li
   --
   --	PROGRAMMER:		Jacky Li
   --
-  --	INTERFACE:		int client(int msg_qid, char *fname, int priority)
+  --	INTERFACE:		int request_stats(int msg_qid)
   --                     int msg_qid:      message queue id
-  --                     char *fname:      Filename to query from server
-  --                    int priority:      The priority of this request to server
   --
   --	RETURNS:		
   --					 0    on success
-  --          -1    on failure of thread creation
-  --          -2    on failure to send over initial connect message to server       
+  --          -1    if the request could not be sent or no reply came
   --	NOTES:
-  --		Client function to be run by this program when specified to be in client mode
-  --      (1) Will send to a server process with pre-defined IPC channel
-  --          - Init message, with 
-  --              (1) this process ID
-  --              (2) Priority for the server to allocate resources to this request
-  --              (3) a filename that the server will send over
-  --      (2) Wait for the message queue to be populated with mtype = this process ID
-  --      (3) Once the incoming buffer is filled, write to console
-  --      (4) Will keep reading for the same mtype until server sends message with 
-  --          Priority == -1, then this process will die
+  --		Sends CMD_STATS to the server's listen mtype and prints the snapshot it
+  --    answers with: totals since the server started, the pool's backlog and how
+  --    long requests waited for a worker, then one line per transfer in progress.
 ------------------------------------------------------------------------------------*/
-int client(int msg_qid, char *fname, int priority)
+int request_stats(int msg_qid)
 {
-  // Req: Create thread
-  pthread_t th_clnt;
-  if (pthread_create(&th_clnt, NULL, clientThread, &msg_qid) != 0)
-  {
-    perror("thread creation error");
-    return -1;
-  }
-
-  // Reads filename from stdin
   Mesg omsg;
-  // Prep First init message to be sent
+  Mesg imsg;
+  struct srv_stats *st = (struct srv_stats *)imsg.mesg_data;
+  struct xfer_stats *row;
+  int i;
   omsg.mtype = LISTEN_MSG;
-  strcpy(omsg.mesg_data, fname);
-  omsg.mesg_priority = priority;
-  omsg.mesg_len = strlen(fname);
+  omsg.mesg_cmd = CMD_STATS;
+  omsg.mesg_flags = 0;
+  omsg.mesg_len = 0;
+  omsg.mesg_priority = 0;
   omsg.pid = getpid();
-
-  // Writes filename to IPC channel
-  printf("string to be sent to %d, length: %ld\n", msg_qid, strlen(fname));
-  if (send_message(msg_qid, &omsg) == -1)
+  omsg.mesg_data[0] = '\0';
+  if (mesgq_send(msg_qid, &omsg) == -1)
   {
-    return -2;
+    perror("stats request");
+    return -1;
   }
-  printf("Client has sent: pid:%d\n", omsg.pid);
-
-  // Starts reading from server
-  Mesg imsg;
-  unsigned long num_msg = 0;
-  unsigned long complete_msg = 0;
-  unsigned long total_bytes_recv = 0;
-  unsigned long curr_bytes_recv = 0;
-  while (1)
+  do
   {
-    if (read_message(msg_qid, (long)getpid(), &imsg) > 0)
+    if (mesgq_read(msg_qid, getpid(), &imsg, RECV_TIMEOUT_MS) == -1)
     {
-      ++num_msg;
-      // total_bytes_recv += imsg.mesg_len;
-      total_bytes_recv += strlen(imsg.mesg_data);
-      curr_bytes_recv += imsg.mesg_len; //Because null term.
-      if (curr_bytes_recv >= MAXMESSAGEDATA)
-      {
-        ++complete_msg;
-        printf("inc buffer filled: %lu\n", complete_msg);
-        curr_bytes_recv = curr_bytes_recv - MAXMESSAGEDATA;
-      }
-      if (imsg.mesg_priority < 0)
-      {
-        printf("Srv end msg, totalbrecv: %ld totalmsg: %ld\n", total_bytes_recv, num_msg);
-        return 0;
-      }
+      perror("stats reply");
+      return -1;
     }
+  } while (imsg.mesg_cmd != CMD_STATS || imsg.mesg_len < (int)sizeof(*st));
+  printf("server %d up %.1f s, %s engine, %d worker%s, %d transfers in progress (max %d)\n",
+         imsg.pid, st->uptime_us / 1e6, st->engine == ENGINE_URING ? "uring" : "pool",
+         st->workers, st->workers == 1 ? "" : "s", st->active, st->max_xfers);
+  printf("  %lld requests served in %.1f s, %lld bytes in %lld packets\n", st->transfers,
+         st->busy_us / 1e6, st->bytes, st->packets);
+  printf("  %lld send failures, %lld sends found the queue or ring full\n",
+         st->send_failures, st->stalls);
+  if (st->backlog_cap >= 0)
+  {
+    printf("  backlog %d/%d: %lld admitted, %lld after waiting, %lld turned away busy, "
+           "%lld shed, %lld abandoned\n", st->backlog, st->backlog_cap, st->admitted,
+           st->queued, st->rejected, st->shed, st->abandoned);
+    printf("  wait for a worker: p50 %.1f ms, p99 %.1f ms, max %.1f ms\n",
+           st->wait_p50_us / 1000.0, st->wait_p99_us / 1000.0, st->wait_max_us / 1000.0);
+  }
+  if (st->rows > 0)
+  {
+    printf("  %8s %8s %4s %12s %9s %10s %8s\n", "worker", "client", "prio", "bytes",
+           "packets", "elapsed_ms", "MB/s");
+  }
+  for (i = 0; i < st->rows; ++i)
+  {
+    row = &st->xfers[i];
+    printf("  %8d %8d %4d %12lld %9lld %10lld %8.2f\n", row->worker_pid, row->client_pid,
+           row->priority, row->bytes, row->packets, row->elapsed_us / 1000,
+           row->elapsed_us > 0 ? (double)row->bytes / row->elapsed_us : 0.0);
+  }
+  if (st->active > st->rows)
+  {
+    printf("  ... and %d more\n", st->active - st->rows);
   }
-
   return 0;
 }
 
+// mesgq callbacks of client_async: count the data, keep the outcome (a total
+// that does not match what came through async_data counts as a failure)
+static void async_data(void *arg, const char *data, int len, long long offset)
+{
+  (void)data;
+  (void)offset;
+  ((struct async_rx *)arg)->bytes += len;
+}
+
+static void async_done(void *arg, int status, long long bytes, const char *why)
+{
+  struct async_rx *rx = arg;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  rx->status = status;
+  rx->us = elapsed_us(rx->start, &now);
+  if (status == 0 && bytes != rx->bytes)
+  {
+    rx->status = status = EBADMSG;
+    why = "byte count does not match the data delivered";
+  }
+  if (status != 0)
+  {
+    printf("%s: %s%s%s\n", rx->path, strerror(status), why != NULL ? ": " : "",
+           why != NULL ? why : "");
+  }
+}
+
 /*------------------------------------------------------------------------------------
-  --	FUNCTION:		server_transfer_proc
+  --	FUNCTION:		client_async
   --
-  --	DATE:			    Mar 27, 2019
+  --	DATE:			    Oct 16, 2026
   --
-  --	REVISIONS:		Mar 27, 2019
+  --	REVISIONS:		Oct 16, 2026
   --
   --	DESIGNERS:		Jacky Li
   --
   --	PROGRAMMER:		Jacky Li
   --
-  --	INTERFACE:		int server_transfer_proc(int msg_qid, Mesg imsg)
-  --                     int msg_qid:      message queue id
-  --                       Mesg imsg:      Msg struct data from initial message
+  --	INTERFACE:		int client_async(struct client_opts *opts, int copies)
+  --        struct client_opts *opts:      the -f files, priority and window
+  --                      int copies:      times each file is fetched
   --
   --	RETURNS:		
   --					 0    on success
-  --          -1    on failure of message send
-  --          -2    on failure to open file     
+  --          -1    if any fetch failed or the handle could not be opened
   --	NOTES:
-  --		Server transfer process function. This is run when this application is set to 
-  --    be run in server mode, and an incoming message from a client specifies a file
-  --    request
-  --    This function will
-  --      (1) Attempt to open a file
-  --      (2) Read the content of a file
-  --      (3) Fill up buffer size according to imsg structure passed in
-  --      (4) Send message into msg_qid whenever
-  --          (4.1) Buffer size according to priority is filled
-  --          (4.2) File to be read is finished reading
-  --      (5) Send a final message with priority -1 to the client to signal EOT
+  --		Starts a fetch of every file, copies times over, all at once from this one
+  --    process through mesgq_fetch, then runs mesgq_poll until each has finished.
+  --    The data is only counted (and checked, by the library). Prints each
+  --    request's bytes and completion time, then the aggregate throughput and
+  --    latency percentiles, to set against the same load from as many clients.
 ------------------------------------------------------------------------------------*/
-int server_transfer_proc(int msg_qid, Mesg imsg)
+int client_async(struct client_opts *opts, int copies)
 {
-  struct Mesg smsg;
-  printf("srv transfer proc %d called for client proc: %d\n", getpid(), imsg.pid);
-  // Opens file to read
-  FILE *fp;
-  if ((fp = fopen(imsg.mesg_data, "r")) == NULL)
-  {
-    printf("file open failed: %s\n", imsg.mesg_data);
-    // Fail: Send ASCII error msg
-    smsg.mtype = imsg.mtype;
-    const char *file_io_err = "File Open error";
-    strcpy(smsg.mesg_data, file_io_err);
-    smsg.mesg_len = strlen(file_io_err);
-    smsg.mesg_priority = -1;
-    // Send
-    if (send_message(msg_qid, &smsg) > 0)
-    {
-      printf("svr sent failed\n");
-      return -1;
-    }
-    return -2;
+  struct mesgq_fetch req;
+  struct mesgq *mq;
+  struct async_rx *rx;
+  long long *lat;
+  struct timespec t_start;
+  struct timespec t_end;
+  const char *name = opts->names;
+  long long total = 0;
+  long wall_us;
+  int nreqs = opts->nfiles * copies;
+  int ok = 0;
+  int i;
+  if ((mq = mesgq_open(MSG_KEY, nreqs)) == NULL)
+  {
+    perror("mesgq_open");
+    return -1;
   }
-  else
+  rx = calloc(nreqs, sizeof(*rx));
+  lat = calloc(nreqs, sizeof(*lat));
+  if (rx == NULL || lat == NULL)
   {
-    printf("file open success\n");
-    // Success: Write file to IPC channel
-    printf("Transfer Requested: prior:%d, type:%lu, pid:%d, incLen:%d\nmsg:%s\n",
-           imsg.mesg_priority,
-           imsg.mtype,
-           imsg.pid,
-           imsg.mesg_len,
-           imsg.mesg_data);
-    int packetSize = MAXMESSAGEDATA / imsg.mesg_priority;
-    printf("Transfer packet size will be: %d\n", packetSize);
-    char c;
-    int count = 0;
-    while ((c = fgetc(fp)) != EOF && (count < packetSize))
-    {
-      // Fill buffer
-      smsg.mesg_data[count] = c;
-      ++count;
-      if (count == packetSize - 1) // Account for null-terminated
-      {
-        smsg.mesg_data[count] = '\0';
-        smsg.mesg_len = count;
-        smsg.mtype = imsg.pid;
-        // Send it!
-        if (send_message(msg_qid, &smsg) == -1)
-        {
-          printf("svr sent failed\n");
-          return -1;
-        }
-        else
-        {
-          // Cleanup for next packet
-          count = 0;
-          memset(smsg.mesg_data, '\0', MAXMESSAGEDATA);
-        }
-      }
-    }
-    // Attach last null terminated
-    printf("read file terminated\n");
-    smsg.mesg_data[count] = '\0';
-    smsg.mesg_len = count;
-    smsg.mtype = imsg.pid;
-    smsg.mesg_priority = -1;
-
-    // Send message
-    if (send_message(msg_qid, &smsg) > 0)
+    perror("calloc");
+    free(rx);
+    free(lat);
+    mesgq_close(mq);
+    return -1;
+  }
+  memset(&req, 0, sizeof(req));
+  req.priority = opts->priority;
+  req.window = opts->window;
+  req.count = -1;
+  req.on_data = async_data;
+  req.on_done = async_done;
+  clock_gettime(CLOCK_MONOTONIC, &t_start);
+  for (i = 0; i < nreqs; ++i)
+  {
+    rx[i].path = name;
+    rx[i].start = &t_start;
+    rx[i].status = -1;
+    req.path = name;
+    req.arg = &rx[i];
+    if (mesgq_fetch(mq, &req) == -1)
     {
-      printf("svr sent failed\n");
-      return -1;
+      rx[i].status = errno;
+      printf("%s: %s\n", name, strerror(errno));
     }
-    else
+    name += strlen(name) + 1;
+    if (name >= opts->names + opts->names_len)
     {
-      printf("sending over last msg:%s\n", smsg.mesg_data);
+      name = opts->names;
     }
-    fclose(fp);
-    return 0;
   }
-  return 0;
-}
-
-/*------------------------------------------------------------------------------------
-  --	FUNCTION:		server
-  --
-  --	DATE:			    Mar 27, 2019
-  --
-  --	REVISIONS:		Mar 27, 2019
-  --
-  --	DESIGNERS:		Jacky Li
-  --
-  --	PROGRAMMER:		Jacky Li
-  --
-  --	INTERFACE:		int server(int msg_qid)
-  --                     int msg_qid:      message queue id
-  --
-  --	RETURNS:		
-  --					 0    on success
-  --    
-  --	NOTES:
-  --     Server Mode:
-  --         (1) Open/Create a message queue on the OS (shared config on both Srv + Client)
-  --         (2) Continuously waits for message queue to have mtype MAXPID + 500
-  --              - Forks child process to send data to destination specified in message
-------------------------------------------------------------------------------------*/
-int server(int msg_qid)
-{
-  printf("server function running %d\n", getpid());
-  struct Mesg imsg;
-  int recv_len;
-  // Listen for incoming
-  while (1)
+  while (mesgq_pending(mq) > 0 && running)
   {
-    recv_len = read_message(msg_qid, LISTEN_MSG, &imsg);
-    // If message rec'd
-    if (recv_len != -1)
-    {
-      printf("Init msg got size: %d\n", recv_len);
-      // Reads filename from IPC channel
-      printf("Incoming: prior:%d, type:%lu, pid:%d, incLen:%d\nmsg:%s\n",
-             imsg.mesg_priority,
-             imsg.mtype,
-             imsg.pid,
-             imsg.mesg_len,
-             imsg.mesg_data);
-      // Should fork here
-      switch (fork())
-      {
-      case -1:
-        printf("fork failed");
-        exit(666);
-      case 0:
-        // Child
-        server_transfer_proc(msg_qid, imsg);
-        printf("proc function finished\n");
-        return 0;
-      default:
-        // Parent - do nothing
-        break;
-      }
+    mesgq_poll(mq, RECV_TIMEOUT_MS);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t_end);
+  mesgq_close(mq);
+  for (i = 0; i < nreqs; ++i)
+  {
+    if (rx[i].status == 0)
+    {
+      printf("request %d %s: %lld bytes in %lld us\n", i, rx[i].path, rx[i].bytes, rx[i].us);
+      total += rx[i].bytes;
+      lat[ok++] = rx[i].us;
     }
   }
-  return 0;
+  wall_us = elapsed_us(&t_start, &t_end);
+  printf("%d requests from one process, %d failed: %lld bytes in %ld ms, %.1f MB/s\n", nreqs,
+         nreqs - ok, total, wall_us / 1000, wall_us > 0 ? total / (double)wall_us : 0.0);
+  if (ok > 0)
+  {
+    qsort(lat, ok, sizeof(lat[0]), cmp_wait);
+    printf("completion latency: p50 %lld us, p99 %lld us, max %lld us\n", lat[(ok - 1) / 2],
+           lat[(ok - 1) * 99 / 100], lat[ok - 1]);
+  }
+  free(rx);
+  free(lat);
+  return ok == nreqs ? 0 : -1;
 }
 
 void usage()
 {
-  printf("Run with options: -t server OR -t client -f filename -p int_priority\n");
+  printf("Run with options: -t server [-n pool_size] [-e pool|uring] [-c cache_mb] [-a] [-b backlog] OR -t shutdown OR -t stats OR -t client -f filename [-f filename ...] | -F manifest -p int_priority [-m queue|shm|pipe] [-k window] [-s stripes] [-o outfile|- [-d]] [-r segments -o outfile] [-z] [-g] OR -t fetch -f filename [-f filename ...] -p int_priority [-k window] [-n copies]\n");
 }
 
 /*------------------------------------------------------------------------------------
@@ -473,6 +6592,25 @@ void usage()
   --	DATE:			    Mar 27, 2019
   --
   --	REVISIONS:		Mar 27, 2019
+  --                Oct 16, 2026 - shutdown mode, signal handlers
+  --                Oct 16, 2026 - -n pool size
+  --                Oct 16, 2026 - -m transport (queue or shm)
+  --                Oct 16, 2026 - -e transfer engine
+  --                Oct 16, 2026 - -c cache size
+  --                Oct 16, 2026 - -o output file
+  --                Oct 16, 2026 - -d O_DIRECT output
+  --                Oct 16, 2026 - -k credit window
+  --                Oct 16, 2026 - -s stripes
+  --                Oct 16, 2026 - -f more than once, -F manifest (batches)
+  --                Oct 16, 2026 - -r ranged fetch
+  --                Oct 16, 2026 - -z compression
+  --                Oct 16, 2026 - CRC32C setup
+  --                Oct 16, 2026 - stats mode
+  --                Oct 16, 2026 - -a packets sized from the queue limits
+  --                Oct 16, 2026 - -m pipe
+  --                Oct 16, 2026 - -b backlog size
+  --                Oct 16, 2026 - fetch mode (mesgq.c client), -n copies
+  --                Oct 16, 2026 - -g packet coalescing
   --
   --	DESIGNERS:		Jacky Li
   --
@@ -487,30 +6625,87 @@ void usage()
   --      Main executable for this program
   --        [OPTIONS]
   --          [SERVER]
-  --          -t : "server" or "client" - specifies the behaviour of this program
+  --          -t : "server", "client", "fetch", "shutdown" or "stats" - specifies the
+  --               behaviour of this program; "stats" prints the server's live
+  --               counters
+  --          -n : Number of pre-forked transfer workers (default POOL_SIZE_DEFAULT),
+  --               or with -e uring the cap on concurrent transfers (default
+  --               URING_MAX_XFERS)
+  --          -e : "pool" (default) or "uring" - transfer engine
+  --          -c : Hot-file cache size in MB for the pool (default CACHE_MB_DEFAULT,
+  --               0 disables it)
+  --          -a : Size packets from the message queue limits rather than from
+  --               the client's priority (which still sets its bandwidth share)
+  --          -b : Requests the pool holds, by priority, while every worker is busy
+  --               (default BACKLOG_DEFAULT, up to BACKLOG_MAX); past that, or after
+  --               BACKLOG_MAX_WAIT_MS, clients are told to come back later. 0
+  --               turns away whatever finds the workers busy
   --          [CLIENT]
-  --          -f : Specifies which file the server should send
+  --          -f : Specifies which file the server should send; given more than
+  --               once the files are fetched as one batch, back to back
+  --          -F : Fetch every file listed (one per line) in this manifest, which
+  --               the server reads
   --          -p : Priority 
+  --          -m : "queue" (default), "shm" or "pipe" - transport for the file
+  --               data; "pipe" splices it through a FIFO (pool engine, one file,
+  --               without -s, -r, -z or -d)
+  --          -o : Write the received file here ("-" for stdout); by default it is
+  --               only counted
+  --          -d : Write the -o file with O_DIRECT
+  --          -k : Credit window, packets the server may have queued for this
+  --               transfer (queue transport); by default, or with 0, the window
+  --               the server sized the data queue for (CREDIT_WINDOW_DEFAULT if
+  --               it names none)
+  --          -s : Stripe the transfer over this many data queues, each with its
+  --               own sender (up to STRIPES_MAX, queue transport, pool engine)
+  --          -r : Fetch the file as byte ranges, this many at once, each by its own
+  --               child client and pool worker, straight into the -o file (which
+  --               -r needs); an interrupted fetch resumes where it stopped
+  --          -z : Let the server compress packets (pool engine, not striped);
+  --               worth it for text and other redundant data
+  --          -g : Let the server pack several small packets (a high -p) into
+  --               each queue message (pool engine, queue transport, not striped
+  --               or compressed)
+  --          A batch (-f more than once, or -F) needs the pool engine. Its files
+  --          are written to -o one after the other.
+  --          [FETCH]
+  --          -f, -p, -k as for a client, but each -f is a request of its own,
+  --          all in flight at once from this process (queue transport only)
+  --          -n : Fetch every file this many times (default 1), up to
+  --               MESGQ_MAX_REQUESTS requests in all
   --
 ------------------------------------------------------------------------------------*/
 int main(int argc, char *argv[])
 {
   // Optargs
   int opt;
-  char srv_cln[FILENAME_SIZE];
-  char fname[FILENAME_SIZE];
-  int priority;
+  char srv_cln[FILENAME_SIZE] = "";
+  struct client_opts opts;
+  int pool_size = 0;
+  int engine = ENGINE_POOL;
+  int cache_mb = CACHE_MB_DEFAULT;
+  int backlog = BACKLOG_DEFAULT;
+  memset(&opts, 0, sizeof(opts));
+  opts.count = -1;
   // Determine key
   int msg_qid;
   key_t msgq_key = MSG_KEY;
 
   // Create IPC: Msg Queue
-  if ((msg_qid = open_queue(msgq_key)) == -1)
+  if ((msg_qid = mesgq_open_queue(msgq_key)) == -1)
   {
     printf("open queue failed\n");
   }
   printf("open queue ok, qid: %d\n", msg_qid);
 
+  mesgq_crc_init();
+  if (install_signals() == -1)
+  {
+    perror("sigaction");
+    return 1;
+  }
+  mesgq_watch(&running);
+
   // User read args for this function
   while ((opt = getopt(argc, argv, OPTIONS)) != -1)
   {
@@ -520,10 +6715,83 @@ int main(int argc, char *argv[])
       strncpy(srv_cln, optarg, FILENAME_SIZE);
       break;
     case 'f':
-      strncpy(fname, optarg, FILENAME_SIZE);
+      if (opts.nfiles >= 0 && opts.names_len + strlen(optarg) + 1 <= MAXMESSAGEDATA)
+      {
+        strcpy(opts.names + opts.names_len, optarg);
+        opts.names_len += strlen(optarg) + 1;
+        if (opts.nfiles++ == 0)
+        {
+          strncpy(opts.fname, optarg, FILENAME_SIZE - 1);
+        }
+      }
+      else
+      {
+        opts.nfiles = -1;
+      }
+      break;
+    case 'F':
+      strncpy(opts.fname, optarg, FILENAME_SIZE - 1);
+      opts.batch = MESG_F_MANIFEST;
       break;
     case 'p':
-      priority = atoi(optarg);
+      opts.priority = atoi(optarg);
+      break;
+    case 'n':
+      pool_size = atoi(optarg);
+      break;
+    case 'c':
+      cache_mb = atoi(optarg);
+      break;
+    case 'e':
+      if (strcmp(optarg, "uring") == 0)
+      {
+        engine = ENGINE_URING;
+      }
+      else if (strcmp(optarg, "pool") != 0)
+      {
+        engine = -1;
+      }
+      break;
+    case 'd':
+      opts.direct = 1;
+      break;
+    case 'k':
+      opts.window = atoi(optarg);
+      break;
+    case 's':
+      opts.stripes = atoi(optarg);
+      break;
+    case 'r':
+      opts.ranges = atoi(optarg);
+      break;
+    case 'z':
+      opts.compress = MESG_F_COMPRESS;
+      break;
+    case 'g':
+      opts.coalesce = MESG_F_COALESCE;
+      break;
+    case 'a':
+      packet_autotune = 1;
+      break;
+    case 'b':
+      backlog = atoi(optarg);
+      break;
+    case 'o':
+      strncpy(opts.outname, optarg, FILENAME_SIZE - 1);
+      break;
+    case 'm':
+      if (strcmp(optarg, "shm") == 0)
+      {
+        opts.transport = MESG_F_SHM;
+      }
+      else if (strcmp(optarg, "pipe") == 0)
+      {
+        opts.transport = MESG_F_PIPE;
+      }
+      else if (strcmp(optarg, "queue") != 0)
+      {
+        opts.transport = -1;
+      }
       break;
     default:
     case '?':
@@ -534,27 +6802,79 @@ int main(int argc, char *argv[])
 
   if (strcmp(srv_cln, "server") == 0)
   {
-    if (argc != 3)
+    if (pool_size == 0)
+    {
+      pool_size = engine == ENGINE_URING ? URING_MAX_XFERS : POOL_SIZE_DEFAULT;
+    }
+    if (engine == -1 || pool_size < 1 || cache_mb < 0 || cache_mb > CACHE_MB_MAX ||
+        pool_size > (engine == ENGINE_URING ? URING_MAX_XFERS : POOL_SIZE_MAX) ||
+        backlog < 0 || backlog > BACKLOG_MAX)
     {
       usage();
       return 1;
     }
     printf("%s Mode\n", srv_cln);
-    server(msg_qid);
+    server(msg_qid, pool_size, engine, (size_t)cache_mb << 20, backlog);
     printf("server proc %d finished\n", getpid());
     return 0;
   }
 
-  if ((strcmp(srv_cln, "client") == 0) && (argc == 7))
+  if (strcmp(srv_cln, "shutdown") == 0)
+  {
+    return request_shutdown(msg_qid) == 0 ? 0 : 1;
+  }
+
+  if (strcmp(srv_cln, "stats") == 0)
+  {
+    return request_stats(msg_qid) == 0 ? 0 : 1;
+  }
+
+  if (strcmp(srv_cln, "client") == 0)
+  {
+    if (opts.nfiles > 1)
+    {
+      opts.batch = opts.batch == 0 ? MESG_F_BATCH : -1;
+    }
+    if (opts.fname[0] == '\0' || opts.priority < 1 || opts.transport == -1 ||
+        opts.nfiles < 0 || opts.batch == -1 ||
+        opts.window < 0 || opts.window > CREDIT_WINDOW_MAX || opts.stripes < 0 ||
+        opts.stripes > STRIPES_MAX || (opts.stripes > 1 && opts.transport == MESG_F_SHM) ||
+        opts.ranges < 0 || opts.ranges > RANGE_CLIENTS_MAX ||
+        (opts.ranges > 0 && (opts.batch != 0 || opts.outname[0] == '\0' ||
+                             strcmp(opts.outname, "-") == 0)) ||
+        (opts.transport == MESG_F_PIPE &&
+         (opts.batch != 0 || opts.stripes > 1 || opts.ranges > 0 || opts.compress || opts.direct)))
+    {
+      usage();
+      return 1;
+    }
+    printf("%s Mode\n", srv_cln);
+    if (opts.ranges > 0)
+    {
+      return client_ranged(msg_qid, &opts) == 0 ? 0 : 1;
+    }
+    if (opts.transport == MESG_F_PIPE)
+    {
+      return client_spliced(msg_qid, &opts) == 0 ? 0 : 1;
+    }
+    return client(msg_qid, &opts) == 0 ? 0 : 1;
+  }
+
+  if (strcmp(srv_cln, "fetch") == 0)
   {
-    if (argc != 7)
+    if (pool_size == 0)
+    {
+      pool_size = 1;
+    }
+    if (opts.nfiles < 1 || opts.batch != 0 || opts.priority < 1 || opts.window < 0 ||
+        opts.window > CREDIT_WINDOW_MAX || pool_size < 1 ||
+        pool_size > MESGQ_MAX_REQUESTS / opts.nfiles)
     {
       usage();
       return 1;
     }
     printf("%s Mode\n", srv_cln);
-    client(msg_qid, fname, priority);
-    exit(0);
+    return client_async(&opts, pool_size) == 0 ? 0 : 1;
   }
   usage();
   return 0;